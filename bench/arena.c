@@ -0,0 +1,170 @@
+#include "exclib.h"
+#include "bench.h"
+
+/*
+ * What this measures: parsing a request of N "Name: value" header lines,
+ * each field and its two strings allocated as it's parsed, inside one TRY,
+ * with the memory
+ * 1- malloc_cleanup: malloc'd, and freed field by field in a CLEANUP block
+ * 2- arena: from exclib_arena_alloc, given back by the TRY itself
+ * 3- malloc_cleanup_throw, arena_throw: 1 and 2 with the last line malformed,
+ *    so the parser throws half way and the CATCH is taken
+ *
+ * for N of 4, 16 and 64; times are per request.
+ */
+
+#define BENCH_EXC 3
+
+struct field {
+  char *name;
+  char *value;
+  struct field *next;
+};
+
+struct request {
+  struct field *fields;
+  int nfields;
+};
+
+static char *requests[2][3];
+
+static char *make_request(int n, int bad)
+{
+  char *text = (char *)malloc(n * 32 + 1);
+  char *p = text;
+  int i;
+
+  for ( i = 0; i < n; i++ )
+    p += sprintf(p, (bad && i == n - 1) ? "no colon on this line\n" : "X-Header-%d: value %d\n", i, i);
+  return text;
+}
+
+static char *copy(const char *s, size_t n, int arena)
+{
+  char *out = (char *)(arena ? exclib_arena_alloc(n + 1) : malloc(n + 1));
+
+  memcpy(out, s, n);
+  out[n] = '\0';
+  return out;
+}
+
+/* adds each line's field to req as it goes, so whatever's been allocated is on req when it throws */
+static BENCH_NOINLINE void parse(const char *text, struct request *req, int arena)
+{
+  const char *line = text;
+  const char *colon;
+  const char *end;
+  struct field *f;
+
+  while ( *line ) {
+    end = strchr(line, '\n');
+    colon = memchr(line, ':', end - line);
+    if ( !colon )
+      THROW(BENCH_EXC, "malformed header");
+    f = (struct field *)(arena ? exclib_arena_alloc(sizeof(*f)) : malloc(sizeof(*f)));
+    f->name = NULL;
+    f->value = NULL;
+    f->next = req->fields;
+    req->fields = f;
+    req->nfields++;
+    f->name = copy(line, colon - line, arena);
+    f->value = copy(colon + 2, end - colon - 2, arena);
+    line = end + 1;
+  }
+}
+
+static void free_request(struct request *req)
+{
+  struct field *f;
+
+  while ( (f = req->fields) != NULL ) {
+    req->fields = f->next;
+    free(f->name);
+    free(f->value);
+    free(f);
+  }
+}
+
+static void run_malloc(long iterations, const char *text)
+{
+  static struct request req;
+  long i;
+
+  for ( i = 0; i < iterations; i++ ) {
+    req.fields = NULL;
+    req.nfields = 0;
+    TRY {
+      parse(text, &req, 0);
+      bench_sink += req.nfields;
+    } CLEANUP {
+      free_request(&req);
+    } EXCEPT {
+    } CATCH(BENCH_EXC) {
+      bench_sink++;
+    } FINALLY {
+    } ETRY;
+  }
+}
+
+static void run_arena(long iterations, const char *text)
+{
+  static struct request req;
+  long i;
+
+  for ( i = 0; i < iterations; i++ ) {
+    req.fields = NULL;
+    req.nfields = 0;
+    TRY {
+      parse(text, &req, 1);
+      bench_sink += req.nfields;
+    } CLEANUP {
+    } EXCEPT {
+    } CATCH(BENCH_EXC) {
+      bench_sink++;
+    } FINALLY {
+    } ETRY;
+  }
+}
+
+static void malloc_cleanup(long iterations, void *arg)
+{
+  run_malloc(iterations, requests[0][*(int *)arg]);
+}
+
+static void arena(long iterations, void *arg)
+{
+  run_arena(iterations, requests[0][*(int *)arg]);
+}
+
+static void malloc_cleanup_throw(long iterations, void *arg)
+{
+  run_malloc(iterations, requests[1][*(int *)arg]);
+}
+
+static void arena_throw(long iterations, void *arg)
+{
+  run_arena(iterations, requests[1][*(int *)arg]);
+}
+
+int main(void)
+{
+  int lines[] = {4, 16, 64};
+  int which[] = {0, 1, 2};
+  int i;
+
+  for ( i = 0; i < 3; i++ ) {
+    requests[0][i] = make_request(lines[i], 0);
+    requests[1][i] = make_request(lines[i], 1);
+  }
+  for ( i = 0; i < 3; i++ ) {
+    bench_run("arena", "malloc_cleanup", lines[i], malloc_cleanup, &which[i]);
+    bench_run("arena", "arena", lines[i], arena, &which[i]);
+    bench_run("arena", "malloc_cleanup_throw", lines[i], malloc_cleanup_throw, &which[i]);
+    bench_run("arena", "arena_throw", lines[i], arena_throw, &which[i]);
+  }
+  for ( i = 0; i < 3; i++ ) {
+    free(requests[0][i]);
+    free(requests[1][i]);
+  }
+  return 0;
+}
@@ -0,0 +1,56 @@
+#include "exclib.h"
+#include "bench.h"
+
+/*
+ * What this measures: what capturing the native backtrace adds to a THROW
+ * made N plain C calls below its TRY, for N = 8, 32 and 128. Each depth runs
+ * with capture off (throw_nobt) and capturing the whole stack (throw_bt).
+ * Which walker is used is the library's EXCLIB_BACKTRACE; compare
+ * make bench EXCLIB_BACKTRACE=fp with the default unwind.
+ */
+
+#define BENCH_EXC 3
+
+static BENCH_NOINLINE void leaf(void)
+{
+  THROW(BENCH_EXC, "from the bottom");
+}
+
+static BENCH_NOINLINE void chain(int depth)
+{
+  if ( depth <= 1 )
+    leaf();
+  else
+    chain(depth - 1);
+  bench_sink++;
+}
+
+static void throw_at_depth(long iterations, void *arg)
+{
+  int depth = *(int *)arg;
+  long i;
+  for ( i = 0; i < iterations; i++ ) {
+    TRY {
+      chain(depth);
+    } CLEANUP {
+    } EXCEPT {
+    } CATCH(BENCH_EXC) {
+      bench_sink++;
+    } FINALLY {
+    } ETRY;
+  }
+}
+
+int main(void)
+{
+  int depths[] = {8, 32, 128};
+  unsigned int i;
+
+  for ( i = 0; i < sizeof(depths) / sizeof(depths[0]); i++ ) {
+    exclib_set_backtrace_depth(0);
+    bench_run("backtrace", "throw_nobt", depths[i], throw_at_depth, &depths[i]);
+    exclib_set_backtrace_depth(EXC_BACKTRACE_MAX);
+    bench_run("backtrace", "throw_bt", depths[i], throw_at_depth, &depths[i]);
+  }
+  return 0;
+}
@@ -0,0 +1,88 @@
+#include "exclib.h"
+#include "bench.h"
+
+/*
+ * What this measures:
+ * 1- Ingesting records with a TRY around each one
+ * 2- The same records under TRY_BATCH, one armed frame per batch of 1 to
+ *    10000 records
+ * 3- exclib_try_batch, calling a function per record
+ *
+ * ns_per_op is per record. One record in 1000 throws, so the re-arm after a
+ * throw is in the numbers too.
+ */
+
+#define BENCH_RECORDS 10000
+#define BENCH_EXC     3
+
+static int records[BENCH_RECORDS];
+static struct exclib_batch_result results[BENCH_RECORDS];
+
+static BENCH_NOINLINE void ingest(int record)
+{
+  if ( record % 1000 == 999 )
+    THROW(BENCH_EXC, "bad record");
+  bench_sink += record;
+}
+
+static void ingest_item(void *items, int i)
+{
+  ingest(((int *)items)[i]);
+}
+
+static void per_record(long iterations, void *arg)
+{
+  long i;
+  for ( i = 0; i < iterations; i++ ) {
+    TRY {
+      ingest(records[i % BENCH_RECORDS]);
+    } CLEANUP {
+    } EXCEPT {
+    } CATCH(BENCH_EXC) {
+      bench_sink++;
+    } FINALLY {
+    } ETRY;
+  }
+}
+
+static void try_batch(long iterations, void *arg)
+{
+  int size = *(int *)arg;
+  int *batch;
+  volatile int j;
+  long i;
+  int n;
+  for ( i = 0; i < iterations; i += n ) {
+    n = iterations - i < size ? (int)(iterations - i) : size;
+    batch = &records[(i % BENCH_RECORDS) / size * size];
+    TRY_BATCH(j, n, results) {
+      ingest(batch[j]);
+    } ETRY_BATCH;
+  }
+}
+
+static void try_batch_fn(long iterations, void *arg)
+{
+  int size = *(int *)arg;
+  long i;
+  int n;
+  for ( i = 0; i < iterations; i += n ) {
+    n = iterations - i < size ? (int)(iterations - i) : size;
+    bench_sink += exclib_try_batch(ingest_item, &records[(i % BENCH_RECORDS) / size * size], n, results);
+  }
+}
+
+int main(void)
+{
+  int sizes[] = {1, 10, 100, 1000, 10000};
+  unsigned int i;
+
+  for ( i = 0; i < BENCH_RECORDS; i++ )
+    records[i] = (int)i;
+  bench_run("batch", "per_record", 1, per_record, NULL);
+  for ( i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++ ) {
+    bench_run("batch", "try_batch", sizes[i], try_batch, &sizes[i]);
+    bench_run("batch", "try_batch_fn", sizes[i], try_batch_fn, &sizes[i]);
+  }
+  return 0;
+}
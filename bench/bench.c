@@ -0,0 +1,153 @@
+#define _POSIX_C_SOURCE 200112L
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+volatile long bench_sink = 0;
+
+static int bench_header_done = 0;
+
+struct bench_thread {
+    pthread_t thread;
+    pthread_barrier_t *start;
+    bench_fn fn;
+    void *arg;
+    long iterations;
+};
+
+static double bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static unsigned long long bench_ticks(void)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    unsigned int lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((unsigned long long)hi << 32) | lo;
+#elif defined(__GNUC__) && defined(__aarch64__)
+    unsigned long long v;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+#else
+    return 0;
+#endif
+}
+
+static int bench_json(void)
+{
+    char *fmt = getenv("EXCLIB_BENCH_FORMAT");
+    return (fmt != NULL && strcmp(fmt, "json") == 0);
+}
+
+static double bench_target_ns(void)
+{
+    char *ms = getenv("EXCLIB_BENCH_MS");
+    if ( ms != NULL && atol(ms) > 0 )
+	return (double)atol(ms) * 1e6;
+    return 200.0 * 1e6;
+}
+
+static void *bench_thread_main(void *arg)
+{
+    struct bench_thread *t = (struct bench_thread *)arg;
+    pthread_barrier_wait(t->start);
+    t->fn(t->iterations, t->arg);
+    return NULL;
+}
+
+/* Runs fn on `threads` threads at once and returns the wall time in ns */
+static double bench_once(int threads, bench_fn fn, void *arg, long iterations, unsigned long long *ticks)
+{
+    struct bench_thread *workers;
+    pthread_barrier_t start;
+    unsigned long long t0;
+    double begin;
+    double elapsed;
+    int i;
+
+    if ( threads <= 1 ) {
+	t0 = bench_ticks();
+	begin = bench_now_ns();
+	fn(iterations, arg);
+	elapsed = bench_now_ns() - begin;
+	*ticks = bench_ticks() - t0;
+	return elapsed;
+    }
+
+    workers = (struct bench_thread *)calloc(threads, sizeof(struct bench_thread));
+    pthread_barrier_init(&start, NULL, threads + 1);
+    for ( i = 0; i < threads; i++ ) {
+	workers[i].start = &start;
+	workers[i].fn = fn;
+	workers[i].arg = arg;
+	workers[i].iterations = iterations;
+	pthread_create(&workers[i].thread, NULL, bench_thread_main, &workers[i]);
+    }
+    t0 = bench_ticks();
+    begin = bench_now_ns();
+    pthread_barrier_wait(&start);
+    for ( i = 0; i < threads; i++ )
+	pthread_join(workers[i].thread, NULL);
+    elapsed = bench_now_ns() - begin;
+    *ticks = bench_ticks() - t0;
+    pthread_barrier_destroy(&start);
+    free(workers);
+    return elapsed;
+}
+
+void bench_run_threads(const char *bench, const char *name, long param, int threads, bench_fn fn, void *arg)
+{
+    double target = bench_target_ns();
+    double elapsed;
+    double ops;
+    unsigned long long ticks;
+    long iterations = 1000;
+    char *header;
+
+    /* warm up, then grow the iteration count until one single-threaded run hits the target */
+    fn(iterations, arg);
+    for ( ;; ) {
+	elapsed = bench_once(1, fn, arg, iterations, &ticks);
+	if ( elapsed >= target / 4 || iterations >= 1000000000L )
+	    break;
+	if ( elapsed < 1000.0 )
+	    iterations *= 16;
+	else
+	    iterations = (long)((double)iterations * target / elapsed) + 1;
+    }
+    if ( elapsed < target )
+	iterations = (long)((double)iterations * target / elapsed) + 1;
+    if ( threads > 1 )
+	iterations /= threads;
+    if ( iterations < 1 )
+	iterations = 1;
+
+    elapsed = bench_once(threads, fn, arg, iterations, &ticks);
+    ops = (double)iterations * (threads > 1 ? threads : 1);
+
+    if ( bench_json() ) {
+	printf("{\"bench\":\"%s\",\"case\":\"%s\",\"param\":%ld,\"threads\":%d,\"iterations\":%ld,"
+	       "\"ns_per_op\":%.2f,\"cycles_per_op\":%.2f}\n",
+	       bench, name, param, threads, iterations, elapsed / ops, (double)ticks / ops);
+    } else {
+	header = getenv("EXCLIB_BENCH_HEADER");
+	if ( !bench_header_done && (header == NULL || strcmp(header, "0") != 0) )
+	    printf("bench,case,param,threads,iterations,ns_per_op,cycles_per_op\n");
+	printf("%s,%s,%ld,%d,%ld,%.2f,%.2f\n",
+	       bench, name, param, threads, iterations, elapsed / ops, (double)ticks / ops);
+    }
+    bench_header_done = 1;
+    fflush(stdout);
+}
+
+void bench_run(const char *bench, const char *name, long param, bench_fn fn, void *arg)
+{
+    bench_run_threads(bench, name, param, 1, fn, arg);
+}
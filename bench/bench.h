@@ -0,0 +1,41 @@
+#ifndef __EXCLIB_BENCH_H__
+#define __EXCLIB_BENCH_H__
+
+/*
+ * Tiny harness shared by the bench/ programs. Every case is a function that
+ * runs its operation `iterations` times; bench_run calibrates the iteration
+ * count until one run takes EXCLIB_BENCH_MS milliseconds (default 200), then
+ * prints one row per case:
+ *
+ *     bench,case,param,threads,iterations,ns_per_op,cycles_per_op
+ *
+ * EXCLIB_BENCH_FORMAT=json switches to one JSON object per line instead, and
+ * EXCLIB_BENCH_HEADER=0 drops the CSV header (make bench uses this to print it
+ * only once). cycles_per_op is TSC ticks on x86, counter ticks on aarch64 and
+ * 0 elsewhere. For threaded cases ns_per_op is wall time over the operations
+ * done by all threads together, so it should fall as 1/threads when scaling is
+ * linear.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*bench_fn)(long iterations, void *arg);
+
+extern volatile long bench_sink;
+
+extern void bench_run(const char *bench, const char *name, long param, bench_fn fn, void *arg);
+extern void bench_run_threads(const char *bench, const char *name, long param, int threads, bench_fn fn, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#if defined(__GNUC__)
+#define BENCH_NOINLINE __attribute__((noinline))
+#else
+#define BENCH_NOINLINE
+#endif
+
+#endif /* __EXCLIB_BENCH_H__ */
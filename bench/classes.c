@@ -0,0 +1,104 @@
+#include "exclib.h"
+#include "bench.h"
+
+/*
+ * What this measures:
+ * 1- CATCH_CLASS matching a code registered with exclib_class_exception, for
+ *    a class 1 to 32 levels above it
+ * 2- The same for codes that are only covered by a range (exclib_class_range),
+ *    with a few hundred ranges registered
+ * 3- CATCH_GROUP over the same 64 codes, as the baseline for 1
+ */
+
+#define BENCH_ROOT   1
+#define BENCH_CHAIN  100     /* 100..131 are a chain, each under the next, 131 under BENCH_ROOT */
+#define BENCH_LEAF   200     /* 200..263 are each under 100 */
+#define BENCH_RANGES 256     /* 10000 + 100 * i .. + 99, each under 100 */
+
+struct class_case {
+  int cls;
+  int base;
+};
+
+static void catch_class(long iterations, void *arg)
+{
+  struct class_case *c = (struct class_case *)arg;
+  long i;
+  for ( i = 0; i < iterations; i++ ) {
+    TRY {
+      THROW(c->base + (int)(i & 63), "one of 64");
+    } CLEANUP {
+    } EXCEPT {
+    } CATCH_CLASS(c->cls) {
+      bench_sink++;
+    } FINALLY {
+    } ETRY;
+  }
+}
+
+static void catch_range(long iterations, void *arg)
+{
+  struct class_case *c = (struct class_case *)arg;
+  long i;
+  for ( i = 0; i < iterations; i++ ) {
+    TRY {
+      THROW(c->base + (int)((i * 97) % BENCH_RANGES) * 100 + (int)(i & 63), "in a range");
+    } CLEANUP {
+    } EXCEPT {
+    } CATCH_CLASS(c->cls) {
+      bench_sink++;
+    } FINALLY {
+    } ETRY;
+  }
+}
+
+#define BENCH_GROUP8(b) \
+  CATCH_GROUP((b) + 1) CATCH_GROUP((b) + 2) CATCH_GROUP((b) + 3) CATCH_GROUP((b) + 4) \
+  CATCH_GROUP((b) + 5) CATCH_GROUP((b) + 6) CATCH_GROUP((b) + 7) CATCH_GROUP((b) + 8)
+
+static void catch_group(long iterations, void *arg)
+{
+  long i;
+  for ( i = 0; i < iterations; i++ ) {
+    TRY {
+      THROW(BENCH_LEAF + (int)(i & 63), "one of 64");
+    } CLEANUP {
+    } EXCEPT {
+    } CATCH(BENCH_LEAF) {
+    } CATCH_GROUP(BENCH_LEAF + 1) CATCH_GROUP(BENCH_LEAF + 2) CATCH_GROUP(BENCH_LEAF + 3)
+      CATCH_GROUP(BENCH_LEAF + 4) CATCH_GROUP(BENCH_LEAF + 5) CATCH_GROUP(BENCH_LEAF + 6)
+      CATCH_GROUP(BENCH_LEAF + 7) BENCH_GROUP8(BENCH_LEAF + 7) BENCH_GROUP8(BENCH_LEAF + 15)
+      BENCH_GROUP8(BENCH_LEAF + 23) BENCH_GROUP8(BENCH_LEAF + 31) BENCH_GROUP8(BENCH_LEAF + 39)
+      BENCH_GROUP8(BENCH_LEAF + 47) BENCH_GROUP8(BENCH_LEAF + 55) {
+      bench_sink++;
+    } FINALLY {
+    } ETRY;
+  }
+}
+
+int main(void)
+{
+  int depths[] = {1, 2, 4, 8, 16, 32};
+  struct class_case c;
+  unsigned int i;
+
+  for ( i = 0; i < 32; i++ )
+    exclib_class_exception(BENCH_CHAIN + i, i == 31 ? BENCH_ROOT : BENCH_CHAIN + i + 1);
+  for ( i = 0; i < 64; i++ )
+    exclib_class_exception(BENCH_LEAF + i, BENCH_CHAIN);
+  for ( i = 0; i < BENCH_RANGES; i++ )
+    exclib_class_range(10000 + 100 * i, 10000 + 100 * i + 99, BENCH_CHAIN);
+
+  bench_run("classes", "catch_group", 64, catch_group, NULL);
+  c.base = BENCH_LEAF;
+  for ( i = 0; i < sizeof(depths) / sizeof(depths[0]); i++ ) {
+    c.cls = BENCH_CHAIN + depths[i] - 1;
+    bench_run("classes", "catch_class", depths[i], catch_class, &c);
+  }
+  c.base = 10000;
+  for ( i = 0; i < sizeof(depths) / sizeof(depths[0]); i++ ) {
+    c.cls = BENCH_CHAIN + depths[i] - 1;
+    bench_run("classes", "catch_range", depths[i], catch_range, &c);
+  }
+  return 0;
+}
@@ -0,0 +1,164 @@
+#include "exclib.h"
+#include "bench.h"
+
+/*
+ * What this measures:
+ * 1- The no-throw cost of entering and leaving a TRY block
+ * 2- THROW caught by the frame it was thrown in
+ * 3- An exception propagating through N frames that don't handle it
+ *    (the deepuncaught/twolevel pattern, but caught at the top)
+ * 4- CATCH_GROUP dispatch over 64 cases
+ * 5- TRY/THROW/CATCH on several threads at once
+ *
+ * with plain return codes as the baseline for 1-3. The C++ throw baseline
+ * is in bench/cxx.cpp.
+ */
+
+#define BENCH_EXC 3
+
+static BENCH_NOINLINE int rc_leaf(int fail)
+{
+  if ( fail )
+    return BENCH_EXC;
+  bench_sink++;
+  return 0;
+}
+
+static BENCH_NOINLINE int rc_chain(int depth)
+{
+  int rc;
+  if ( depth <= 1 )
+    return rc_leaf(1);
+  rc = rc_chain(depth - 1);
+  if ( rc != 0 )
+    return rc;
+  bench_sink++;
+  return 0;
+}
+
+static BENCH_NOINLINE void exc_chain(int depth)
+{
+  TRY {
+    if ( depth <= 1 )
+      THROW(BENCH_EXC, "propagated");
+    exc_chain(depth - 1);
+  } CLEANUP {
+  } EXCEPT {
+  } FINALLY {
+  } ETRY;
+}
+
+static void retcode_ok(long iterations, void *arg)
+{
+  long i;
+  for ( i = 0; i < iterations; i++ ) {
+    if ( rc_leaf(0) != 0 )
+      bench_sink--;
+  }
+}
+
+static void retcode_error(long iterations, void *arg)
+{
+  long i;
+  for ( i = 0; i < iterations; i++ ) {
+    if ( rc_leaf(1) != 0 )
+      bench_sink++;
+  }
+}
+
+static void retcode_propagate(long iterations, void *arg)
+{
+  int depth = *(int *)arg;
+  long i;
+  for ( i = 0; i < iterations; i++ ) {
+    if ( rc_chain(depth) != 0 )
+      bench_sink++;
+  }
+}
+
+static void try_nothrow(long iterations, void *arg)
+{
+  long i;
+  for ( i = 0; i < iterations; i++ ) {
+    TRY {
+      bench_sink++;
+    } CLEANUP {
+    } EXCEPT {
+    } FINALLY {
+    } ETRY;
+  }
+}
+
+static void throw_catch(long iterations, void *arg)
+{
+  long i;
+  for ( i = 0; i < iterations; i++ ) {
+    TRY {
+      THROW(BENCH_EXC, "caught right here");
+    } CLEANUP {
+    } EXCEPT {
+    } CATCH(BENCH_EXC) {
+      bench_sink++;
+    } FINALLY {
+    } ETRY;
+  }
+}
+
+static void propagate(long iterations, void *arg)
+{
+  int depth = *(int *)arg;
+  long i;
+  for ( i = 0; i < iterations; i++ ) {
+    TRY {
+      exc_chain(depth);
+    } CLEANUP {
+    } EXCEPT {
+    } CATCH(BENCH_EXC) {
+      bench_sink++;
+    } FINALLY {
+    } ETRY;
+  }
+}
+
+#define BENCH_GROUP8(b) \
+  CATCH_GROUP((b) + 1) CATCH_GROUP((b) + 2) CATCH_GROUP((b) + 3) CATCH_GROUP((b) + 4) \
+  CATCH_GROUP((b) + 5) CATCH_GROUP((b) + 6) CATCH_GROUP((b) + 7) CATCH_GROUP((b) + 8)
+
+static void catch_group(long iterations, void *arg)
+{
+  long i;
+  for ( i = 0; i < iterations; i++ ) {
+    TRY {
+      THROW((int)(i & 63) + 1, "one of 64");
+    } CLEANUP {
+    } EXCEPT {
+    } CATCH(1) {
+    } CATCH_GROUP(2) CATCH_GROUP(3) CATCH_GROUP(4) CATCH_GROUP(5)
+      CATCH_GROUP(6) CATCH_GROUP(7) CATCH_GROUP(8)
+      BENCH_GROUP8(8) BENCH_GROUP8(16) BENCH_GROUP8(24)
+      BENCH_GROUP8(32) BENCH_GROUP8(40) BENCH_GROUP8(48) BENCH_GROUP8(56) {
+      bench_sink++;
+    } FINALLY {
+    } ETRY;
+  }
+}
+
+int main(void)
+{
+  int depths[] = {1, 2, 4, 8, 16, 32};
+  int threads[] = {1, 2, 4, 8};
+  unsigned int i;
+
+  bench_run("core", "retcode_ok", 0, retcode_ok, NULL);
+  bench_run("core", "try_nothrow", 0, try_nothrow, NULL);
+  bench_run("core", "retcode_error", 0, retcode_error, NULL);
+  bench_run("core", "throw_catch", 0, throw_catch, NULL);
+  for ( i = 0; i < sizeof(depths) / sizeof(depths[0]); i++ ) {
+    bench_run("core", "retcode_propagate", depths[i], retcode_propagate, &depths[i]);
+    bench_run("core", "propagate", depths[i], propagate, &depths[i]);
+  }
+  bench_run("core", "catch_group", 64, catch_group, NULL);
+  for ( i = 0; i < sizeof(threads) / sizeof(threads[0]); i++ )
+    bench_run_threads("core", "throw_catch_mt", 0, threads[i], throw_catch, NULL);
+  return 0;
+}
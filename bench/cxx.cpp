@@ -0,0 +1,73 @@
+#include "bench.h"
+#include <cstddef>
+
+/*
+ * The C++ baseline for bench/core.c: native table-based exceptions for the
+ * same no-throw, throw/catch and propagation cases.
+ */
+
+#define BENCH_EXC 3
+
+static BENCH_NOINLINE void cxx_leaf(int fail)
+{
+  if ( fail )
+    throw (int)BENCH_EXC;
+  bench_sink++;
+}
+
+static BENCH_NOINLINE void cxx_chain(int depth)
+{
+  if ( depth <= 1 )
+    cxx_leaf(1);
+  else
+    cxx_chain(depth - 1);
+  bench_sink++;
+}
+
+static void try_nothrow(long iterations, void *)
+{
+  for ( long i = 0; i < iterations; i++ ) {
+    try {
+      cxx_leaf(0);
+    } catch ( int ) {
+      bench_sink--;
+    }
+  }
+}
+
+static void throw_catch(long iterations, void *)
+{
+  for ( long i = 0; i < iterations; i++ ) {
+    try {
+      cxx_leaf(1);
+    } catch ( int ) {
+      bench_sink++;
+    }
+  }
+}
+
+static void propagate(long iterations, void *arg)
+{
+  int depth = *(int *)arg;
+  for ( long i = 0; i < iterations; i++ ) {
+    try {
+      cxx_chain(depth);
+    } catch ( int ) {
+      bench_sink++;
+    }
+  }
+}
+
+int main(void)
+{
+  int depths[] = {1, 2, 4, 8, 16, 32};
+  int threads[] = {1, 2, 4, 8};
+
+  bench_run("cxx", "try_nothrow", 0, try_nothrow, NULL);
+  bench_run("cxx", "throw_catch", 0, throw_catch, NULL);
+  for ( unsigned int i = 0; i < sizeof(depths) / sizeof(depths[0]); i++ )
+    bench_run("cxx", "propagate", depths[i], propagate, &depths[i]);
+  for ( unsigned int i = 0; i < sizeof(threads) / sizeof(threads[0]); i++ )
+    bench_run_threads("cxx", "throw_catch_mt", 0, threads[i], throw_catch, NULL);
+  return 0;
+}
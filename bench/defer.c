@@ -0,0 +1,110 @@
+/* EXCLIB_DEFER's push is meant to be a few inlined stores; measure that, and the call it replaces */
+#undef EXCLIB_INLINE
+#define EXCLIB_INLINE 1
+#include "exclib.h"
+#include "bench.h"
+
+/*
+ * What this measures: N calls under one TRY, each taking a resource and
+ * giving it back on the way out, with the release done by
+ * 1- own_try: a TRY/CLEANUP in each call, as before EXCLIB_DEFER
+ * 2- defer_inline: EXCLIB_DEFER into the caller's frame (inlined push)
+ * 3- defer_call: the same through exclib_defer, as without EXCLIB_INLINE
+ * 4- own_try_throw, defer_throw: 1 and 2 with the last call throwing, which
+ *    the outer TRY catches, so every release happens on the error path
+ *
+ * for N of 1, 4 and 16; times are per outer TRY.
+ */
+
+#define BENCH_EXC 3
+
+static void release(void *arg)
+{
+  bench_sink += (long)arg;
+}
+
+static BENCH_NOINLINE void own_try_call(int fail)
+{
+  TRY {
+    bench_sink++;
+    if ( fail )
+      THROW(BENCH_EXC, "failed");
+  } CLEANUP {
+    release((void *)1);
+  } EXCEPT {
+  } FINALLY {
+  } ETRY;
+}
+
+static BENCH_NOINLINE void defer_inline_call(int fail)
+{
+  bench_sink++;
+  EXCLIB_DEFER(release, (void *)1);
+  if ( fail )
+    THROW(BENCH_EXC, "failed");
+}
+
+static BENCH_NOINLINE void defer_call_call(int fail)
+{
+  bench_sink++;
+  exclib_defer(release, (void *)1);
+  if ( fail )
+    THROW(BENCH_EXC, "failed");
+}
+
+static void run_calls(long iterations, int n, int fail, void (*call)(int))
+{
+  long i;
+  int j;
+  for ( i = 0; i < iterations; i++ ) {
+    TRY {
+      for ( j = 0; j < n; j++ )
+	call(fail && j == n - 1);
+    } CLEANUP {
+    } EXCEPT {
+    } CATCH(BENCH_EXC) {
+      bench_sink++;
+    } FINALLY {
+    } ETRY;
+  }
+}
+
+static void own_try(long iterations, void *arg)
+{
+  run_calls(iterations, *(int *)arg, 0, own_try_call);
+}
+
+static void defer_inline(long iterations, void *arg)
+{
+  run_calls(iterations, *(int *)arg, 0, defer_inline_call);
+}
+
+static void defer_call(long iterations, void *arg)
+{
+  run_calls(iterations, *(int *)arg, 0, defer_call_call);
+}
+
+static void own_try_throw(long iterations, void *arg)
+{
+  run_calls(iterations, *(int *)arg, 1, own_try_call);
+}
+
+static void defer_throw(long iterations, void *arg)
+{
+  run_calls(iterations, *(int *)arg, 1, defer_inline_call);
+}
+
+int main(void)
+{
+  int calls[] = {1, 4, 16};
+  unsigned int i;
+
+  for ( i = 0; i < sizeof(calls) / sizeof(calls[0]); i++ ) {
+    bench_run("defer", "own_try", calls[i], own_try, &calls[i]);
+    bench_run("defer", "defer_inline", calls[i], defer_inline, &calls[i]);
+    bench_run("defer", "defer_call", calls[i], defer_call, &calls[i]);
+    bench_run("defer", "own_try_throw", calls[i], own_try_throw, &calls[i]);
+    bench_run("defer", "defer_throw", calls[i], defer_throw, &calls[i]);
+  }
+  return 0;
+}
@@ -0,0 +1,115 @@
+#include "exclib.h"
+#include "bench.h"
+
+/*
+ * What this measures:
+ * 1- Summing through an array of pointers with a THROW_ZERO check on each
+ *    one, against the same loop with no checks and the fault translator
+ *    there to catch a NULL instead (param is the array length, so the TRY
+ *    around the loop is paid once per param elements)
+ * 2- Catching a NULL dereference as EXC_NULLPOINTER, against a THROW of the
+ *    same code caught in the same place
+ */
+
+#define BENCH_LEN 1024
+
+static int values[BENCH_LEN];
+static int *pointers[BENCH_LEN];
+static int *volatile nowhere = NULL;
+
+static BENCH_NOINLINE long sum_checked(int **p, int n)
+{
+  long sum = 0;
+  int i;
+  for ( i = 0; i < n; i++ ) {
+    THROW_ZERO(p[i], EXC_NULLPOINTER, "NULL element");
+    sum += *p[i];
+  }
+  return sum;
+}
+
+static BENCH_NOINLINE long sum_unchecked(int **p, int n)
+{
+  long sum = 0;
+  int i;
+  for ( i = 0; i < n; i++ )
+    sum += *p[i];
+  return sum;
+}
+
+static void checked(long iterations, void *arg)
+{
+  long i;
+  for ( i = 0; i < iterations; i += BENCH_LEN ) {
+    TRY {
+      bench_sink += sum_checked(pointers, BENCH_LEN);
+    } CLEANUP {
+    } EXCEPT {
+    } CATCH(EXC_NULLPOINTER) {
+      bench_sink--;
+    } FINALLY {
+    } ETRY;
+  }
+}
+
+static void translated(long iterations, void *arg)
+{
+  long i;
+  for ( i = 0; i < iterations; i += BENCH_LEN ) {
+    TRY {
+      bench_sink += sum_unchecked(pointers, BENCH_LEN);
+    } CLEANUP {
+    } EXCEPT {
+    } CATCH(EXC_NULLPOINTER) {
+      bench_sink--;
+    } FINALLY {
+    } ETRY;
+  }
+}
+
+static void throw_catch(long iterations, void *arg)
+{
+  long i;
+  for ( i = 0; i < iterations; i++ ) {
+    TRY {
+      THROW(EXC_NULLPOINTER, "NULL");
+    } CLEANUP {
+    } EXCEPT {
+    } CATCH(EXC_NULLPOINTER) {
+      bench_sink++;
+    } FINALLY {
+    } ETRY;
+  }
+}
+
+static void fault_catch(long iterations, void *arg)
+{
+  long i;
+  for ( i = 0; i < iterations; i++ ) {
+    TRY {
+      bench_sink += *nowhere;
+    } CLEANUP {
+    } EXCEPT {
+    } CATCH(EXC_NULLPOINTER) {
+      bench_sink++;
+    } FINALLY {
+    } ETRY;
+  }
+}
+
+int main(void)
+{
+  int i;
+
+  for ( i = 0; i < BENCH_LEN; i++ ) {
+    values[i] = i;
+    pointers[i] = &values[(i * 7) % BENCH_LEN];
+  }
+  if ( exclib_translate_faults() != 0 )
+    return 1;
+  bench_run("fault", "checked", BENCH_LEN, checked, NULL);
+  bench_run("fault", "translated", BENCH_LEN, translated, NULL);
+  bench_run("fault", "throw_catch", 0, throw_catch, NULL);
+  bench_run("fault", "fault_catch", 0, fault_catch, NULL);
+  return 0;
+}
@@ -0,0 +1,121 @@
+/* this file is about the inline fast path whatever the rest of the build uses */
+#undef EXCLIB_INLINE
+#define EXCLIB_INLINE 1
+#include "exclib.h"
+#include "bench.h"
+
+/*
+ * What this measures: a TRY/ETRY pair nothing is thrown into, with the frame
+ * push and pop inlined (EXCLIB_INLINE) against the calls into the library
+ * they replace, and against the context save alone, which is the floor.
+ * 1- setjmp_only: EXCLIB_SETJMP into a frame, and nothing else
+ * 2- try_nothrow_call: exclib_new_exc_frame, the save, exclib_clear_exc_frame
+ *    (TRY/ETRY without EXCLIB_INLINE)
+ * 3- try_nothrow_inline: TRY/ETRY with it
+ * 4- nested_nothrow_*: the same, four TRYs deep
+ * 5- throw_catch_inline: a THROW caught in the same frame, which still takes
+ *    the library's path on the way out
+ */
+
+#define BENCH_EXC 3
+
+static void setjmp_only(long iterations, void *arg)
+{
+  struct exclib_status frame;
+  long i;
+  for ( i = 0; i < iterations; i++ ) {
+    if ( EXCLIB_SETJMP(frame.buf) == 0 )
+      bench_sink++;
+  }
+}
+
+static void try_nothrow_call(long iterations, void *arg)
+{
+  EXCLIB_SITE(site, EXCLIB_SITE_TRY);
+  long i;
+  for ( i = 0; i < iterations; i++ ) {
+    exclib_new_exc_frame(&site);
+    if ( EXCLIB_SETJMP(EXCLIB_EXCEPTION->buf) == 0 )
+      bench_sink++;
+    exclib_clear_exc_frame();
+  }
+}
+
+static void try_nothrow_inline(long iterations, void *arg)
+{
+  long i;
+  for ( i = 0; i < iterations; i++ ) {
+    TRY {
+      bench_sink++;
+    } CLEANUP {
+    } EXCEPT {
+    } FINALLY {
+    } ETRY;
+  }
+}
+
+static void nested_nothrow_call(long iterations, void *arg)
+{
+  EXCLIB_SITE(site, EXCLIB_SITE_TRY);
+  long i;
+  int d;
+  for ( i = 0; i < iterations; i++ ) {
+    for ( d = 0; d < 4; d++ ) {
+      exclib_new_exc_frame(&site);
+      if ( EXCLIB_SETJMP(EXCLIB_EXCEPTION->buf) == 0 )
+	bench_sink++;
+    }
+    for ( d = 0; d < 4; d++ )
+      exclib_clear_exc_frame();
+  }
+}
+
+static void nested_nothrow_inline(long iterations, void *arg)
+{
+  long i;
+  for ( i = 0; i < iterations; i++ ) {
+    TRY {
+      TRY {
+	TRY {
+	  TRY {
+	    bench_sink++;
+	  } EXCEPT {
+	  } FINALLY {
+	  } ETRY;
+	} EXCEPT {
+	} FINALLY {
+	} ETRY;
+      } EXCEPT {
+      } FINALLY {
+      } ETRY;
+    } EXCEPT {
+    } FINALLY {
+    } ETRY;
+  }
+}
+
+static void throw_catch_inline(long iterations, void *arg)
+{
+  long i;
+  for ( i = 0; i < iterations; i++ ) {
+    TRY {
+      THROW(BENCH_EXC, "caught right here");
+    } CLEANUP {
+    } EXCEPT {
+    } CATCH(BENCH_EXC) {
+      bench_sink++;
+    } FINALLY {
+    } ETRY;
+  }
+}
+
+int main(void)
+{
+  bench_run("inline", "setjmp_only", 0, setjmp_only, NULL);
+  bench_run("inline", "try_nothrow_call", 0, try_nothrow_call, NULL);
+  bench_run("inline", "try_nothrow_inline", 0, try_nothrow_inline, NULL);
+  bench_run("inline", "nested_nothrow_call", 4, nested_nothrow_call, NULL);
+  bench_run("inline", "nested_nothrow_inline", 4, nested_nothrow_inline, NULL);
+  bench_run("inline", "throw_catch_inline", 0, throw_catch_inline, NULL);
+  return 0;
+}
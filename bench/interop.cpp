@@ -0,0 +1,70 @@
+#define EXCLIB_CXX 1
+#include "exclib.h"
+#include "bench.h"
+
+/*
+ * What this measures: TRY/THROW across C and C++ (EXCLIB_CXX), for each
+ * pairing of the language the TRY is in with the language of the THROW.
+ * 1- The no-throw cost of a C TRY (setjmp) against a C++ one (a native try
+ *    block; only the frame push and pop are left)
+ * 2- THROW caught one call down: C in C (the bench/core.c case), C++ in C++,
+ *    C into a C++ TRY (thrown as an exclib::exception, unwinding through the
+ *    C frames) and C++ into a C TRY (a longjmp)
+ */
+
+#define BENCH_EXC 3
+
+extern "C" {
+void interop_c_throw(void);
+void interop_c_nothrow(long iterations);
+void interop_c_catch(long iterations, void (*thrower)(void));
+}
+
+static BENCH_NOINLINE void cxx_throw(void)
+{
+  THROW(BENCH_EXC, "thrown from C++");
+}
+
+static void cxx_nothrow(long iterations)
+{
+  for ( long i = 0; i < iterations; i++ ) {
+    TRY {
+      bench_sink++;
+    } CLEANUP {
+    } EXCEPT {
+    } FINALLY {
+    } ETRY;
+  }
+}
+
+static void cxx_catch(long iterations, void (*thrower)(void))
+{
+  for ( long i = 0; i < iterations; i++ ) {
+    TRY {
+      thrower();
+    } CLEANUP {
+    } EXCEPT {
+    } CATCH(BENCH_EXC) {
+      bench_sink++;
+    } FINALLY {
+    } ETRY;
+  }
+}
+
+static void try_nothrow_c(long iterations, void *) { interop_c_nothrow(iterations); }
+static void try_nothrow_cxx(long iterations, void *) { cxx_nothrow(iterations); }
+static void c_catches_c(long iterations, void *) { interop_c_catch(iterations, interop_c_throw); }
+static void c_catches_cxx(long iterations, void *) { interop_c_catch(iterations, cxx_throw); }
+static void cxx_catches_c(long iterations, void *) { cxx_catch(iterations, interop_c_throw); }
+static void cxx_catches_cxx(long iterations, void *) { cxx_catch(iterations, cxx_throw); }
+
+int main(void)
+{
+  bench_run("interop", "try_nothrow_c", 0, try_nothrow_c, NULL);
+  bench_run("interop", "try_nothrow_cxx", 0, try_nothrow_cxx, NULL);
+  bench_run("interop", "c_catches_c", 0, c_catches_c, NULL);
+  bench_run("interop", "c_catches_cxx", 0, c_catches_cxx, NULL);
+  bench_run("interop", "cxx_catches_c", 0, cxx_catches_c, NULL);
+  bench_run("interop", "cxx_catches_cxx", 0, cxx_catches_cxx, NULL);
+  return 0;
+}
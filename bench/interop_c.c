@@ -0,0 +1,39 @@
+#include "exclib.h"
+#include "bench.h"
+
+/* The C half of bench/interop.cpp: setjmp TRY blocks and a C thrower */
+
+#define BENCH_EXC 3
+
+BENCH_NOINLINE void interop_c_throw(void)
+{
+  THROW(BENCH_EXC, "thrown from C");
+}
+
+void interop_c_nothrow(long iterations)
+{
+  long i;
+  for ( i = 0; i < iterations; i++ ) {
+    TRY {
+      bench_sink++;
+    } CLEANUP {
+    } EXCEPT {
+    } FINALLY {
+    } ETRY;
+  }
+}
+
+void interop_c_catch(long iterations, void (*thrower)(void))
+{
+  long i;
+  for ( i = 0; i < iterations; i++ ) {
+    TRY {
+      thrower();
+    } CLEANUP {
+    } EXCEPT {
+    } CATCH(BENCH_EXC) {
+      bench_sink++;
+    } FINALLY {
+    } ETRY;
+  }
+}
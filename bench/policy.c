@@ -0,0 +1,50 @@
+#include "exclib.h"
+#include "bench.h"
+
+/*
+ * What this measures: how much a report the policy suppresses costs, i.e.
+ * an EXCLIB_TRACE during an exception storm. No report is ever printed here;
+ * the policy lets the first through and the bench starts after that.
+ * 1- The same (code, site) every time, the storm case
+ * 2- 64 codes from one site, spread over the key table
+ * 3- The same key from several threads at once
+ */
+
+static void trace_same(long iterations, void *arg)
+{
+  long i;
+  for ( i = 0; i < iterations; i++ )
+    EXCLIB_TRACE("suppressed");
+}
+
+static void trace_codes(long iterations, void *arg)
+{
+  static const struct exclib_site site = { __FILE__, "trace_codes", __LINE__, EXCLIB_SITE_TRACE, 0 };
+  long i;
+  for ( i = 0; i < iterations; i++ ) {
+    if ( exclib_report_allowed((int)(i & 63) + 1, &site) )
+      bench_sink++;
+  }
+}
+
+int main(void)
+{
+  struct exclib_report_policy policy;
+  int threads[] = {1, 2, 4, 8};
+  unsigned int i;
+
+  memset(&policy, 0, sizeof(policy));
+  policy.window_ms = 3600000;
+  policy.rate = 1;
+  policy.burst = 1;
+  exclib_set_report_policy(&policy);
+  exclib_set_report_fd(-1);
+  trace_same(1, NULL);
+  trace_codes(64, NULL);
+
+  bench_run("policy", "trace_suppressed", 0, trace_same, NULL);
+  bench_run("policy", "allowed_64codes", 64, trace_codes, NULL);
+  for ( i = 0; i < sizeof(threads) / sizeof(threads[0]); i++ )
+    bench_run_threads("policy", "trace_suppressed_mt", 0, threads[i], trace_same, NULL);
+  return 0;
+}
@@ -0,0 +1,83 @@
+#include "exclib.h"
+#include "bench.h"
+
+/*
+ * What this measures: what the profiler adds
+ * 1- throw_catch: a THROW caught in the same frame (one clock read at the
+ *    throw, one at the catch when profiling), with the profiler off and on
+ * 2- propagate: the same thrown one frame further in and propagated out
+ *    of it (a hop as well)
+ * 3- try_nothrow: a TRY/ETRY nothing is thrown into; profiling only checks
+ *    the depth, so it should cost the same either way
+ *
+ * param is 0 with the profiler off, 1 with it on.
+ */
+
+#define BENCH_EXC 3
+
+static void throw_catch(long iterations, void *arg)
+{
+  long i;
+  for ( i = 0; i < iterations; i++ ) {
+    TRY {
+      THROW(BENCH_EXC, "profiled");
+    } CLEANUP {
+    } EXCEPT {
+    } CATCH(BENCH_EXC) {
+      bench_sink++;
+    } FINALLY {
+    } ETRY;
+  }
+}
+
+static BENCH_NOINLINE void inner(void)
+{
+  TRY {
+    THROW(BENCH_EXC, "profiled");
+  } CLEANUP {
+  } EXCEPT {
+  } FINALLY {
+  } ETRY;
+}
+
+static void propagate(long iterations, void *arg)
+{
+  long i;
+  for ( i = 0; i < iterations; i++ ) {
+    TRY {
+      inner();
+    } CLEANUP {
+    } EXCEPT {
+    } CATCH(BENCH_EXC) {
+      bench_sink++;
+    } FINALLY {
+    } ETRY;
+  }
+}
+
+static void try_nothrow(long iterations, void *arg)
+{
+  long i;
+  for ( i = 0; i < iterations; i++ ) {
+    TRY {
+      bench_sink++;
+    } CLEANUP {
+    } EXCEPT {
+    } FINALLY {
+    } ETRY;
+  }
+}
+
+int main(void)
+{
+  int on;
+
+  for ( on = 0; on <= 1; on++ ) {
+    exclib_profile_enable(on);
+    bench_run("profile", "throw_catch", on, throw_catch, NULL);
+    bench_run("profile", "propagate", on, propagate, NULL);
+    bench_run("profile", "try_nothrow", on, try_nothrow, NULL);
+  }
+  exclib_profile_enable(0);
+  return 0;
+}
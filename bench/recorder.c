@@ -0,0 +1,92 @@
+#define _XOPEN_SOURCE 500
+#include "exclib.h"
+#include "bench.h"
+
+/*
+ * What this measures: what the flight recorder adds to the error path
+ * 1- throw_catch: a THROW caught in the same frame (two records when
+ *    recording: the throw and the catch), with the recorder off and on
+ * 2- propagate: the same thrown one frame further in and propagated out
+ *    of it (three records)
+ * 3- try_nothrow: a TRY/ETRY nothing is thrown into, which records nothing
+ *    and should cost the same either way
+ *
+ * param is 0 with the recorder off, 1 with it on.
+ */
+
+#define BENCH_EXC 3
+
+static void throw_catch(long iterations, void *arg)
+{
+  long i;
+  for ( i = 0; i < iterations; i++ ) {
+    TRY {
+      THROW(BENCH_EXC, "recorded");
+    } CLEANUP {
+    } EXCEPT {
+    } CATCH(BENCH_EXC) {
+      bench_sink++;
+    } FINALLY {
+    } ETRY;
+  }
+}
+
+static BENCH_NOINLINE void inner(void)
+{
+  TRY {
+    THROW(BENCH_EXC, "recorded");
+  } CLEANUP {
+  } EXCEPT {
+  } FINALLY {
+  } ETRY;
+}
+
+static void propagate(long iterations, void *arg)
+{
+  long i;
+  for ( i = 0; i < iterations; i++ ) {
+    TRY {
+      inner();
+    } CLEANUP {
+    } EXCEPT {
+    } CATCH(BENCH_EXC) {
+      bench_sink++;
+    } FINALLY {
+    } ETRY;
+  }
+}
+
+static void try_nothrow(long iterations, void *arg)
+{
+  long i;
+  for ( i = 0; i < iterations; i++ ) {
+    TRY {
+      bench_sink++;
+    } CLEANUP {
+    } EXCEPT {
+    } FINALLY {
+    } ETRY;
+  }
+}
+
+int main(void)
+{
+  char path[] = "/tmp/exclib-bench-XXXXXX";
+  int on;
+  int fd;
+
+  fd = mkstemp(path);
+  if ( fd < 0 )
+    return 1;
+  close(fd);
+  for ( on = 0; on <= 1; on++ ) {
+    if ( on && exclib_recorder_open(path, 0, 0) != 0 )
+      return 1;
+    bench_run("recorder", "throw_catch", on, throw_catch, NULL);
+    bench_run("recorder", "propagate", on, propagate, NULL);
+    bench_run("recorder", "try_nothrow", on, try_nothrow, NULL);
+  }
+  exclib_recorder_close();
+  unlink(path);
+  return 0;
+}
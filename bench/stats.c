@@ -0,0 +1,85 @@
+#include "exclib.h"
+#include "bench.h"
+
+/*
+ * What this measures: what the exception counters add to a throw. Each case
+ * runs with counting switched off (param 0) and on (param 1) in the same
+ * binary, so the difference is the cost of exclib_stats_record. Build with
+ * EXCLIB_STATS=0 to check the compiled-out library matches param 0.
+ * 1- THROW caught by the frame it was thrown in (one thrown + one caught)
+ * 2- The same, cycling through 64 codes so the per-thread code table is hit
+ *    all over rather than in one slot
+ * 3- An exception propagating through 4 frames
+ */
+
+#define BENCH_EXC 3
+
+static BENCH_NOINLINE void exc_chain(int depth)
+{
+  TRY {
+    if ( depth <= 1 )
+      THROW(BENCH_EXC, "propagated");
+    exc_chain(depth - 1);
+  } CLEANUP {
+  } EXCEPT {
+  } FINALLY {
+  } ETRY;
+}
+
+static void throw_catch(long iterations, void *arg)
+{
+  long i;
+  for ( i = 0; i < iterations; i++ ) {
+    TRY {
+      THROW(BENCH_EXC, "caught right here");
+    } CLEANUP {
+    } EXCEPT {
+    } CATCH(BENCH_EXC) {
+      bench_sink++;
+    } FINALLY {
+    } ETRY;
+  }
+}
+
+static void throw_catch_codes(long iterations, void *arg)
+{
+  long i;
+  for ( i = 0; i < iterations; i++ ) {
+    TRY {
+      THROW((int)(i & 63) + 1, "one of 64");
+    } CLEANUP {
+    } EXCEPT {
+    } DEFAULT {
+      bench_sink++;
+    } FINALLY {
+    } ETRY;
+  }
+}
+
+static void propagate(long iterations, void *arg)
+{
+  long i;
+  for ( i = 0; i < iterations; i++ ) {
+    TRY {
+      exc_chain(4);
+    } CLEANUP {
+    } EXCEPT {
+    } CATCH(BENCH_EXC) {
+      bench_sink++;
+    } FINALLY {
+    } ETRY;
+  }
+}
+
+int main(void)
+{
+  int on;
+
+  for ( on = 0; on <= 1; on++ ) {
+    exclib_stats_enable(on);
+    bench_run("stats", "throw_catch", on, throw_catch, NULL);
+    bench_run("stats", "throw_catch_codes", on, throw_catch_codes, NULL);
+    bench_run("stats", "propagate4", on, propagate, NULL);
+  }
+  return 0;
+}
@@ -0,0 +1,151 @@
+#include "exclib.h"
+#include "bench.h"
+
+/*
+ * What this measures:
+ * 1- An exception propagating through N TRY frames that don't handle it,
+ *    each one stopping it and throwing it on from its ETRY
+ * 2- The same through N TRY_FOR frames whose lists don't have it, which it
+ *    goes straight past
+ * 3- The same TRY_FORs each with an EXCLIB_ON_UNWIND action to run
+ * 4- Entering and leaving the same N TRY or TRY_FOR frames with nothing
+ *    thrown, which 1-3 pay for too; what they cost on top of this is the
+ *    error path
+ *
+ * for N from 1 to 256; all of them are caught by one more TRY on top.
+ */
+
+#define BENCH_EXC 3
+#define BENCH_OTHER 4
+
+static const int bench_other[] = { BENCH_OTHER, 0 };
+
+static void on_unwind(void *arg)
+{
+  bench_sink++;
+}
+
+static BENCH_NOINLINE void try_chain(int depth, int fail)
+{
+  TRY {
+    if ( depth <= 1 ) {
+      if ( fail )
+        THROW(BENCH_EXC, "propagated");
+      bench_sink++;
+    } else
+      try_chain(depth - 1, fail);
+  } CLEANUP {
+  } EXCEPT {
+  } CATCH(BENCH_OTHER) {
+  } FINALLY {
+  } ETRY;
+}
+
+static BENCH_NOINLINE void try_for_chain(int depth, int fail)
+{
+  TRY_FOR(bench_other) {
+    if ( depth <= 1 ) {
+      if ( fail )
+        THROW(BENCH_EXC, "skipped");
+      bench_sink++;
+    } else
+      try_for_chain(depth - 1, fail);
+  } CLEANUP {
+  } EXCEPT {
+  } CATCH(BENCH_OTHER) {
+  } FINALLY {
+  } ETRY;
+}
+
+static BENCH_NOINLINE void try_for_unwind_chain(int depth)
+{
+  TRY_FOR(bench_other) {
+    EXCLIB_ON_UNWIND(on_unwind, NULL);
+    if ( depth <= 1 )
+      THROW(BENCH_EXC, "skipped");
+    try_for_unwind_chain(depth - 1);
+  } CLEANUP {
+  } EXCEPT {
+  } CATCH(BENCH_OTHER) {
+  } FINALLY {
+  } ETRY;
+}
+
+static void propagate(long iterations, void *arg)
+{
+  int depth = *(int *)arg;
+  long i;
+  for ( i = 0; i < iterations; i++ ) {
+    TRY {
+      try_chain(depth, 1);
+    } CLEANUP {
+    } EXCEPT {
+    } CATCH(BENCH_EXC) {
+      bench_sink++;
+    } FINALLY {
+    } ETRY;
+  }
+}
+
+static void skip(long iterations, void *arg)
+{
+  int depth = *(int *)arg;
+  long i;
+  for ( i = 0; i < iterations; i++ ) {
+    TRY {
+      try_for_chain(depth, 1);
+    } CLEANUP {
+    } EXCEPT {
+    } CATCH(BENCH_EXC) {
+      bench_sink++;
+    } FINALLY {
+    } ETRY;
+  }
+}
+
+static void skip_unwind(long iterations, void *arg)
+{
+  int depth = *(int *)arg;
+  long i;
+  for ( i = 0; i < iterations; i++ ) {
+    TRY {
+      try_for_unwind_chain(depth);
+    } CLEANUP {
+    } EXCEPT {
+    } CATCH(BENCH_EXC) {
+      bench_sink++;
+    } FINALLY {
+    } ETRY;
+  }
+}
+
+static void enter_try(long iterations, void *arg)
+{
+  int depth = *(int *)arg;
+  long i;
+  for ( i = 0; i < iterations; i++ )
+    try_chain(depth, 0);
+}
+
+static void enter_try_for(long iterations, void *arg)
+{
+  int depth = *(int *)arg;
+  long i;
+  for ( i = 0; i < iterations; i++ )
+    try_for_chain(depth, 0);
+}
+
+int main(void)
+{
+  int depths[] = {1, 2, 4, 8, 16, 32, 64, 128, 256};
+  unsigned int i;
+
+  for ( i = 0; i < sizeof(depths) / sizeof(depths[0]); i++ ) {
+    bench_run("unwind", "propagate", depths[i], propagate, &depths[i]);
+    bench_run("unwind", "skip", depths[i], skip, &depths[i]);
+    bench_run("unwind", "skip_unwind", depths[i], skip_unwind, &depths[i]);
+    bench_run("unwind", "enter_try", depths[i], enter_try, &depths[i]);
+    bench_run("unwind", "enter_try_for", depths[i], enter_try_for, &depths[i]);
+  }
+  return 0;
+}
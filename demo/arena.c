@@ -0,0 +1,109 @@
+#include "exclib.h"
+
+/*
+ * What this demo shows:
+ * 1- exclib_arena_alloc memory lasts until the innermost TRY is done with:
+ *    its CATCH can still use what the TRY block allocated, and at ETRY it's
+ *    all given back at once, with no free and no CLEANUP
+ * 2- When an exception propagates out of an inner TRY, what that TRY
+ *    allocated goes back and the arena is where the outer TRY left it: its
+ *    next allocation gets the same memory
+ * 3- Round after round of the same TRY reuses the same memory, so a loop
+ *    that's done it once doesn't malloc again
+ * 4- Outside any TRY there's nothing to give it back, so it gives NULL
+ */
+
+#define EXC_PARSE  1
+
+struct request {
+  char *method;
+  char *path;
+};
+
+static char *copy(const char *s, size_t n)
+{
+  char *out = (char *)exclib_arena_alloc(n + 1);
+
+  memcpy(out, s, n);
+  out[n] = '\0';
+  return out;
+}
+
+/* parses "METHOD /path" into the arena; throws EXC_PARSE for anything else */
+static struct request *parse(const char *line)
+{
+  struct request *req = (struct request *)exclib_arena_alloc(sizeof(*req));
+  const char *space = strchr(line, ' ');
+
+  req->method = copy(line, space ? (size_t)(space - line) : strlen(line));
+  if ( !space || space[1] != '/' )
+    THROW(EXC_PARSE, req->method);
+  req->path = copy(space + 1, strlen(space + 1));
+  return req;
+}
+
+static int handle(const char *line, void **first)
+{
+  volatile int ok = 0;
+
+  TRY {
+    struct request *req = parse(line);
+
+    *first = req;
+    printf("  %s %s\n", req->method, req->path);
+    ok = 1;
+  } CLEANUP {
+  } EXCEPT {
+  } CATCH(EXC_PARSE) {
+    /* the description is the method parse copied into the arena, still there */
+    printf("  rejected \"%s\" (method %s)\n", line, EXCLIB_EXCEPTION_INFO->description);
+  } FINALLY {
+  } ETRY;
+  return ok;
+}
+
+int main(void)
+{
+  const char *lines[] = {"GET /index.html", "POST /form", "garbage", "GET /index.html"};
+  void *first[4];
+  void * volatile before;
+  void *after;
+  unsigned int i;
+  int failed = 0;
+
+  printf("Handling requests, each in a TRY of its own:\n");
+  for ( i = 0; i < 4; i++ )
+    failed |= handle(lines[i], &first[i]) != (i != 2);
+  printf("Every request's memory started at the same place: %s\n",
+         (first[0] == first[1] && first[1] == first[3]) ? "yes" : "no");
+  failed |= first[0] != first[1] || first[1] != first[3];
+
+  TRY {
+    before = exclib_arena_alloc(32);
+    TRY {
+      exclib_arena_alloc(1000);
+      parse("garbage");
+    } CLEANUP {
+    } EXCEPT {
+    } FINALLY {
+    } ETRY;
+  } CLEANUP {
+  } EXCEPT {
+  } CATCH(EXC_PARSE) {
+    after = exclib_arena_alloc(32);
+    printf("After the inner TRY's exception, the outer TRY's next allocation is %s\n",
+           after == (char *)before + 32 ? "right after its first" : "somewhere else");
+    failed |= after != (char *)before + 32;
+  } FINALLY {
+  } ETRY;
+
+  after = exclib_arena_alloc(32);
+  printf("Outside any TRY, exclib_arena_alloc gives %s\n", after ? "memory" : "NULL");
+  failed |= after != NULL;
+
+  if ( failed ) {
+    printf("FAILED\n");
+    return 1;
+  }
+  return 0;
+}
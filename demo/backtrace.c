@@ -0,0 +1,58 @@
+#include "exclib.h"
+
+/*
+ * What this demo shows:
+ * 1- THROW records the native call stack it was thrown from; TRY on its own
+ *    doesn't
+ * 2- exclib_print_backtrace resolves it in-process; the raw addresses and
+ *    exclib_dump_load_map are enough to resolve it offline with addr2line
+ */
+
+#define EXC_PARSE 3
+
+static int depth_seen = 0;
+
+static void parse_field(int n)
+{
+  if ( n == 3 )
+    THROW(EXC_PARSE, "bad field");
+}
+
+static void parse_record(void)
+{
+  int i;
+  for ( i = 0; i < 5; i++ )
+    parse_field(i);
+}
+
+int main(void)
+{
+  TRY {
+  } CLEANUP {
+  } EXCEPT {
+  } FINALLY {
+  } ETRY;
+  if ( __exclib_backtrace_len != 0 )
+    return 1;
+
+  TRY {
+    parse_record();
+  } CLEANUP {
+  } EXCEPT {
+  } CATCH(EXC_PARSE) {
+    depth_seen = __exclib_backtrace_len;
+    printf("Caught %d thrown from %d frames down:\n", EXCLIB_EXCEPTION->value, depth_seen);
+    exclib_print_backtrace(stdout);
+    fflush(stdout);
+    exclib_dump_load_map(1);
+  } FINALLY {
+  } ETRY;
+
+  /* parse_field, parse_record and main, unless the optimiser folded them together */
+  if ( EXCLIB_BACKTRACE != EXCLIB_BACKTRACE_NONE && depth_seen < 1 )
+    return 1;
+  /* handled, so it's gone */
+  if ( __exclib_backtrace_len != 0 )
+    return 1;
+  return 0;
+}
@@ -0,0 +1,76 @@
+#include "exclib.h"
+
+/*
+ * What this demo shows:
+ * 1- TRY_BATCH runs a block per item under one frame; an item that throws
+ *    gets its code and description in its result slot and the rest go on
+ * 2- exclib_try_batch does the same with a function per item, and returns
+ *    how many failed
+ * 3- An item can still catch its own exceptions with a nested TRY, and an
+ *    exception that propagates out of one is recorded the same way
+ */
+
+#define EXC_NEGATIVE  10
+#define EXC_TOO_BIG   11
+#define EXC_ODD       12
+
+#define ITEMS 8
+
+static void check(int value)
+{
+  if ( value < 0 )
+    THROW(EXC_NEGATIVE, "negative");
+  if ( value > 100 )
+    THROW(EXC_TOO_BIG, "too big");
+}
+
+static void check_item(void *items, int i)
+{
+  int value = ((int *)items)[i];
+
+  TRY {
+    check(value);
+    if ( value % 2 )
+      THROW(EXC_ODD, "odd");
+  } CLEANUP {
+  } EXCEPT {
+  } CATCH(EXC_ODD) {
+    /* odd is fine */
+  } FINALLY {
+  } ETRY;
+}
+
+int main(void)
+{
+  int items[ITEMS] = {4, -1, 7, 1000, 12, -5, 3, 8};
+  int want[ITEMS] = {0, EXC_NEGATIVE, 0, EXC_TOO_BIG, 0, EXC_NEGATIVE, 0, 0};
+  struct exclib_batch_result results[ITEMS];
+  volatile int i;
+  volatile int sum = 0;
+  int failed = 0;
+  int n;
+
+  TRY_BATCH(i, ITEMS, results) {
+    check(items[i]);
+    sum += items[i];
+  } ETRY_BATCH;
+  for ( i = 0; i < ITEMS; i++ ) {
+    printf("TRY_BATCH item %d (%d): %d %s\n", i, items[i], results[i].value,
+	   results[i].description ? results[i].description : "ok");
+    failed |= results[i].value != want[i];
+  }
+  printf("Sum of the good ones: %d\n", sum);
+  failed |= sum != 34;
+
+  n = exclib_try_batch(check_item, items, ITEMS, results);
+  printf("exclib_try_batch: %d of %d failed\n", n, ITEMS);
+  for ( i = 0; i < ITEMS; i++ )
+    failed |= results[i].value != want[i];
+  failed |= n != 3 || EXCLIB_EXCEPTION != NULL;
+
+  if ( failed ) {
+    printf("FAILED\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,128 @@
+#include "exclib.h"
+
+/*
+ * What this demo shows:
+ * 1- A range of codes (1000-1999 here) can be put under one class, and single
+ *    codes under another class, so the hierarchy can go several levels deep
+ * 2- CATCH_CLASS catches the class and everything under it, checked in the
+ *    order the handlers are written, with plain CATCH and DEFAULT still
+ *    working around it
+ * 3- A code inside a range can be given a more specific class of its own
+ * 4- Ranges work on their own, with no exclib_class_exception at all, and a
+ *    range can be nested in another under a class code the outer one covers
+ */
+
+#define EXC_ERROR        1
+#define EXC_IO_ERROR     2
+#define EXC_NET_ERROR    3
+#define EXC_IO_TIMEOUT   4
+#define EXC_DISK_FULL    1100
+#define EXC_CONN_RESET   2100
+#define EXC_DNS_TIMEOUT  2500
+#define EXC_UNRELATED    5000
+#define EXC_HTTP_ERROR   6
+#define EXC_HTTP_CLIENT  3400
+#define EXC_HTTP_GONE    3410
+#define EXC_HTTP_SERVER  3500
+
+static int handled_by(int code)
+{
+  int which = -1;
+
+  TRY {
+    THROW(code, "classified");
+  } CLEANUP {
+  } EXCEPT {
+  } CATCH(EXC_UNRELATED) {
+    which = 0;
+  } CATCH_CLASS(EXC_IO_TIMEOUT) {
+    which = 1;
+  } CATCH_CLASS(EXC_IO_ERROR) {
+    which = 2;
+  } CATCH_CLASS(EXC_ERROR) {
+    which = 3;
+  } DEFAULT {
+    which = 4;
+  } FINALLY {
+  } ETRY;
+  return which;
+}
+
+static int http_handled_by(int code)
+{
+  int which = -1;
+
+  TRY {
+    THROW(code, "classified by range");
+  } CLEANUP {
+  } EXCEPT {
+  } CATCH_CLASS(EXC_HTTP_CLIENT) {
+    which = 0;
+  } CATCH_CLASS(EXC_HTTP_ERROR) {
+    which = 1;
+  } DEFAULT {
+    which = 2;
+  } FINALLY {
+  } ETRY;
+  return which;
+}
+
+/* before any exclib_class_exception: ranges alone have to be enough */
+static int ranges_only(void)
+{
+  static const char *handlers[] = {"CATCH_CLASS(EXC_HTTP_CLIENT)", "CATCH_CLASS(EXC_HTTP_ERROR)", "DEFAULT"};
+  static const struct { int code; int want; } cases[] = {
+    {EXC_HTTP_GONE, 0}, {EXC_HTTP_CLIENT, 0}, {EXC_HTTP_SERVER, 1}, {4000, 2}
+  };
+  unsigned int i;
+  int which;
+  int failed = 0;
+
+  exclib_class_range(3000, 3999, EXC_HTTP_ERROR);
+  exclib_class_range(3400, 3499, EXC_HTTP_CLIENT);
+  for ( i = 0; i < sizeof(cases) / sizeof(cases[0]); i++ ) {
+    which = http_handled_by(cases[i].code);
+    printf("%d (under %d) went to %s\n", cases[i].code, exclib_exception_parent(cases[i].code),
+	   which >= 0 ? handlers[which] : "nothing");
+    failed |= which != cases[i].want;
+  }
+  /* EXC_HTTP_CLIENT is in the 3000-3999 range, so it and its own range are under EXC_HTTP_ERROR too */
+  failed |= !exclib_exception_is(EXC_HTTP_GONE, EXC_HTTP_ERROR) || !exclib_exception_is(EXC_HTTP_CLIENT, EXC_HTTP_ERROR);
+  failed |= exclib_exception_parent(EXC_HTTP_CLIENT) != EXC_HTTP_ERROR;
+  return failed;
+}
+
+int main(void)
+{
+  static const char *handlers[] = {"CATCH(EXC_UNRELATED)", "CATCH_CLASS(EXC_IO_TIMEOUT)",
+				    "CATCH_CLASS(EXC_IO_ERROR)", "CATCH_CLASS(EXC_ERROR)", "DEFAULT"};
+  static const struct { int code; int want; } cases[] = {
+    {EXC_DISK_FULL, 2}, {1999, 2}, {EXC_IO_TIMEOUT, 1}, {EXC_DNS_TIMEOUT, 1},
+    {EXC_CONN_RESET, 3}, {EXC_NET_ERROR, 3}, {EXC_ERROR, 3}, {EXC_UNRELATED, 0}, {999, 4}
+  };
+  unsigned int i;
+  int which;
+  int failed = 0;
+
+  failed |= ranges_only();
+  exclib_class_exception(EXC_IO_ERROR, EXC_ERROR);
+  exclib_class_exception(EXC_NET_ERROR, EXC_ERROR);
+  exclib_class_exception(EXC_IO_TIMEOUT, EXC_IO_ERROR);
+  exclib_class_range(1000, 1999, EXC_IO_ERROR);
+  exclib_class_range(2000, 2999, EXC_NET_ERROR);
+  /* a DNS timeout is a network error and a timeout; here the timeout wins */
+  exclib_class_exception(EXC_DNS_TIMEOUT, EXC_IO_TIMEOUT);
+
+  for ( i = 0; i < sizeof(cases) / sizeof(cases[0]); i++ ) {
+    which = handled_by(cases[i].code);
+    printf("%d (under %d) went to %s\n", cases[i].code, exclib_exception_parent(cases[i].code),
+	   which >= 0 ? handlers[which] : "nothing");
+    failed |= which != cases[i].want;
+  }
+
+  if ( failed ) {
+    printf("FAILED\n");
+    return 1;
+  }
+  return 0;
+}
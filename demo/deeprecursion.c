@@ -0,0 +1,68 @@
+#include "exclib.h"
+
+/*
+ * What this demo shows:
+ * 1- TRY nests far deeper than the frames built into each thread; the frame
+ *    stack grows as the recursion does
+ * 2- An exception thrown at the bottom propagates back up through all of it
+ * 3- Going past EXC_MAX_FRAMES throws EXC_OUTOFFRAMES from the TRY that didn't
+ *    fit, which can be caught like any other exception
+ */
+
+#define DEMO_DEPTH  300
+#define EXC_BOTTOM  3
+
+static int deepest = 0;
+
+static void recurse(int depth, int limit)
+{
+  TRY {
+    deepest = depth;
+    if ( limit > 0 && depth >= limit )
+      THROW(EXC_BOTTOM, "hit the bottom");
+    recurse(depth + 1, limit);
+  } CLEANUP {
+  } EXCEPT {
+  } FINALLY {
+  } ETRY;
+}
+
+int main(void)
+{
+  int caught = 0;
+  int i;
+
+  TRY {
+    recurse(1, DEMO_DEPTH);
+  } CLEANUP {
+  } EXCEPT {
+  } CATCH(EXC_BOTTOM) {
+    caught = EXCLIB_EXCEPTION->value;
+  } FINALLY {
+  } ETRY;
+  if ( caught != EXC_BOTTOM || deepest != DEMO_DEPTH ) {
+    EXCLIB_TRACE("exception from the bottom of the recursion was lost");
+    return 1;
+  }
+
+  /* twice, so the second run goes through segments kept from the first */
+  for ( i = 0; i < 2; i++ ) {
+    deepest = 0;
+    TRY {
+      recurse(1, 0);
+    } CLEANUP {
+    } EXCEPT {
+    } CATCH(EXC_OUTOFFRAMES) {
+      printf("Caught %s after %d nested TRY blocks\n", EXCLIB_EXCEPTION_INFO->name, deepest + 1);
+    } DEFAULT {
+      EXCLIB_TRACE("unexpected exception");
+      return 1;
+    } FINALLY {
+    } ETRY;
+    if ( deepest + 1 != EXC_MAX_FRAMES )
+      return 1;
+  }
+  if ( EXCLIB_EXCEPTION != NULL )
+    return 1;
+  return 0;
+}
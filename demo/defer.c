@@ -0,0 +1,141 @@
+#include "exclib.h"
+
+/*
+ * What this demo shows:
+ * 1- Functions with no TRY of their own can EXCLIB_DEFER releasing what
+ *    they took; the caller's TRY runs the actions at its ETRY, last in first
+ *    out, whether or not anything was thrown
+ * 2- When something is thrown they run after the handlers, so a CATCH can
+ *    still use what they release
+ * 3- They also run as an exception leaves their frame: propagating out of a
+ *    TRY that doesn't catch it, or going straight past a TRY_FOR
+ * 4- Outside any TRY nothing is deferred, and past EXC_MAX_DEFERS waiting
+ *    actions EXCLIB_DEFER throws EXC_OUTOFDEFERS
+ */
+
+#define EXC_IO_ERROR  1
+#define EXC_PARSE     2
+
+static const int parse_errors[] = { EXC_PARSE, 0 };
+
+static char released[128];
+static int nreleased = 0;
+
+static void release(void *arg)
+{
+  strcat(released, (const char *)arg);
+  nreleased++;
+}
+
+static void count_release(void *arg)
+{
+  (void)arg;
+  nreleased++;
+}
+
+static void open_input(void)
+{
+  EXCLIB_DEFER(release, "input ");
+}
+
+static void read_header(int fail)
+{
+  EXCLIB_DEFER(release, "buffer ");
+  if ( fail )
+    THROW(EXC_IO_ERROR, "short read");
+}
+
+static void load(int fail)
+{
+  released[0] = '\0';
+  TRY {
+    open_input();
+    read_header(fail);
+  } CLEANUP {
+  } EXCEPT {
+  } CATCH(EXC_IO_ERROR) {
+    strcat(released, "(handler) ");
+  } FINALLY {
+  } ETRY;
+}
+
+static void parse_uncaught(void)
+{
+  TRY {
+    EXCLIB_DEFER(release, "propagated ");
+    THROW(EXC_IO_ERROR, "not ours");
+  } CLEANUP {
+  } EXCEPT {
+  } CATCH(EXC_PARSE) {
+  } FINALLY {
+  } ETRY;
+}
+
+static void parse_skipped(void)
+{
+  TRY_FOR (parse_errors) {
+    EXCLIB_DEFER(release, "skipped ");
+    THROW(EXC_IO_ERROR, "not ours either");
+  } CLEANUP {
+  } EXCEPT {
+  } CATCH(EXC_PARSE) {
+  } FINALLY {
+  } ETRY;
+}
+
+static int passes_through(void (*fn)(void))
+{
+  int caught = 0;
+
+  released[0] = '\0';
+  TRY {
+    fn();
+  } CLEANUP {
+  } EXCEPT {
+  } CATCH(EXC_IO_ERROR) {
+    caught = strcmp(released, "propagated ") == 0 || strcmp(released, "skipped ") == 0;
+  } FINALLY {
+  } ETRY;
+  return caught;
+}
+
+int main(void)
+{
+  volatile int out_of_room = 0;
+  int i;
+  int failed = 0;
+
+  load(0);
+  printf("Nothing thrown, released: %s\n", released);
+  failed |= strcmp(released, "buffer input ") != 0;
+
+  load(1);
+  printf("EXC_IO_ERROR thrown, released: %s\n", released);
+  failed |= strcmp(released, "(handler) buffer input ") != 0;
+
+  failed |= !passes_through(parse_uncaught);
+  printf("Out of a TRY that didn't catch it, released: %s\n", released);
+  failed |= !passes_through(parse_skipped);
+  printf("Past a TRY_FOR, released: %s\n", released);
+
+  printf("Outside any TRY, EXCLIB_DEFER gives %d\n", EXCLIB_DEFER(release, "never "));
+
+  nreleased = 0;
+  TRY {
+    for ( i = 0; i <= EXC_MAX_DEFERS; i++ )
+      EXCLIB_DEFER(count_release, NULL);
+  } CLEANUP {
+  } EXCEPT {
+  } CATCH(EXC_OUTOFDEFERS) {
+    out_of_room = 1;
+  } FINALLY {
+  } ETRY;
+  printf("Deferring %d: %s, %d released\n", EXC_MAX_DEFERS + 1, out_of_room ? "EXC_OUTOFDEFERS" : "no exception", nreleased);
+  failed |= !out_of_room || nreleased != EXC_MAX_DEFERS;
+
+  if ( failed ) {
+    printf("FAILED\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,165 @@
+#define _GNU_SOURCE
+#include "exclib.h"
+#include <pthread.h>
+#include <sys/wait.h>
+
+/*
+ * What this demo shows:
+ * 1- With exclib_translate_faults on, dereferencing NULL inside a TRY is
+ *    caught as EXC_NULLPOINTER, and a divide by zero as EXC_ARITHMETIC
+ * 2- The faulting address comes along as the exception's payload
+ * 3- It keeps working fault after fault (the signal isn't left blocked)
+ * 4- Running out of stack, on the main thread or one that called
+ *    exclib_fault_thread_init, is caught as EXC_STACKOVERFLOW
+ * 5- A fault outside any TRY still kills the process with the signal
+ * 6- Each thread's faults are counted in the stats from the first one on:
+ *    exclib_fault_thread_init readies the counters, since the handler can't
+ *    take their lock or allocate
+ */
+
+static int *volatile nowhere = NULL;
+static int *volatile low = (int *)24;
+static volatile int zero = 0;
+/* always 1; read each time so the compiler can't see the recursion never ends */
+static volatile int bottomless = 1;
+
+static int deref(int *p)
+{
+  return *(volatile int *)p;
+}
+
+static int recurse(int depth)
+{
+  volatile char pad[512];
+
+  pad[0] = (char)depth;
+  return bottomless ? recurse(depth + 1) + pad[0] : 0;
+}
+
+static int caught_overflow(void)
+{
+  int caught = 0;
+
+  TRY {
+    recurse(0);
+  } CLEANUP {
+  } EXCEPT {
+  } CATCH(EXC_STACKOVERFLOW) {
+    caught = 1;
+  } FINALLY {
+  } ETRY;
+  return caught;
+}
+
+static unsigned long thrown(int code)
+{
+  struct exclib_stats *stats = exclib_stats_snapshot();
+  unsigned long n = 0;
+  unsigned int i;
+
+  for ( i = 0; i < stats->ncodes; i++ ) {
+    if ( stats->codes[i].code == code )
+      n = stats->codes[i].n[EXCLIB_STAT_THROWN];
+  }
+  exclib_stats_free(stats);
+  return n;
+}
+
+static void *overflow_thread(void *arg)
+{
+  exclib_fault_thread_init();
+  *(int *)arg = caught_overflow();
+  return NULL;
+}
+
+int main(void)
+{
+  pthread_attr_t attr;
+  pthread_t thread;
+  volatile int caught = 0;
+  int status;
+  int thread_caught = 0;
+  volatile int failed = 0;
+  int i;
+  pid_t pid;
+
+  if ( exclib_translate_faults() != 0 ) {
+    printf("Couldn't install the fault translator\n");
+    return 1;
+  }
+
+  TRY {
+    deref(nowhere);
+    failed = 1;
+  } CLEANUP {
+  } EXCEPT {
+  } CATCH(EXC_NULLPOINTER) {
+    printf("Caught %s at address %lu\n", EXCLIB_EXCEPTION_INFO->name, EXCLIB_PAYLOAD->value);
+    failed |= EXCLIB_PAYLOAD->type != EXCLIB_PAYLOAD_PTR || EXCLIB_PAYLOAD->value != 0;
+  } FINALLY {
+  } ETRY;
+
+  TRY {
+    deref(low);
+    failed = 1;
+  } CLEANUP {
+  } EXCEPT {
+  } CATCH(EXC_NULLPOINTER) {
+    printf("Caught %s at address %lu\n", EXCLIB_EXCEPTION_INFO->name, EXCLIB_PAYLOAD->value);
+    failed |= EXCLIB_PAYLOAD->value != 24;
+  } FINALLY {
+  } ETRY;
+
+  TRY {
+    printf("%d\n", 1000 / zero);
+    failed = 1;
+  } CLEANUP {
+  } EXCEPT {
+  } CATCH(EXC_ARITHMETIC) {
+    /* the payload is the address of the division; only the name and description are the same every run */
+    printf("Caught %s: %s\n", EXCLIB_EXCEPTION_INFO->name, EXCLIB_EXCEPTION_INFO->description);
+  } FINALLY {
+  } ETRY;
+
+  for ( i = 0; i < 1000; i++ ) {
+    TRY {
+      deref(nowhere);
+    } CLEANUP {
+    } EXCEPT {
+    } CATCH(EXC_NULLPOINTER) {
+      caught++;
+    } FINALLY {
+    } ETRY;
+  }
+  printf("Caught %d of 1000 faults in a row\n", caught);
+  failed |= caught != 1000;
+
+  caught = caught_overflow();
+  printf("Main thread stack overflow %s\n", caught ? "caught" : "missed");
+  failed |= !caught;
+
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, 256 * 1024);
+  pthread_create(&thread, &attr, overflow_thread, &thread_caught);
+  pthread_join(thread, NULL);
+  printf("Worker thread stack overflow %s\n", thread_caught ? "caught" : "missed");
+  failed |= !thread_caught;
+  printf("Stack overflows counted: %lu\n", thrown(EXC_STACKOVERFLOW));
+  failed |= EXCLIB_STATS && thrown(EXC_STACKOVERFLOW) != 2;
+
+  fflush(stdout);
+  pid = fork();
+  if ( pid == 0 ) {
+    deref(nowhere);
+    _exit(0);
+  }
+  waitpid(pid, &status, 0);
+  printf("A fault outside TRY still ends in signal %d\n", WIFSIGNALED(status) ? WTERMSIG(status) : 0);
+  failed |= !WIFSIGNALED(status) || WTERMSIG(status) != SIGSEGV;
+
+  if ( failed ) {
+    printf("FAILED\n");
+    return 1;
+  }
+  return 0;
+}
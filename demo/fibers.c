@@ -0,0 +1,121 @@
+#define _GNU_SOURCE
+#include "exclib.h"
+#include <ucontext.h>
+
+/*
+ * What this demo shows:
+ * 1- Thousands of ucontext fibers on one thread, each yielding back to the
+ *    scheduler in the middle of nested TRY blocks, inside a handler, and
+ *    between a THROW and the CATCH that gets it
+ * 2- Each fiber owns an exclib_context, and the scheduler switches to it
+ *    around every resume, so no fiber ever sees another's frames
+ * 3- A rethrow from the inner handler reaches its own fiber's outer TRY,
+ *    with the right cause, however the fibers were interleaved
+ */
+
+#define EXC_INNER    100
+#define EXC_WRAPPED  2
+
+#define FIBERS      2000
+#define ROUNDS      3
+#define STACK_SIZE  (64 * 1024)
+
+struct fiber {
+  ucontext_t uc;
+  struct exclib_context *ctx;
+  void *stack;
+  int done;
+  int caught;
+  int wrong;
+};
+
+static struct fiber fibers[FIBERS];
+static ucontext_t scheduler;
+static int current;
+
+static void yield(void)
+{
+  swapcontext(&fibers[current].uc, &scheduler);
+}
+
+static void fiber_main(int id)
+{
+  struct fiber *f = &fibers[id];
+  volatile int round;
+
+  for ( round = 0; round < ROUNDS; round++ ) {
+    TRY {
+      yield();
+      TRY {
+        yield();
+        THROW(EXC_INNER + id, "inner");
+      } CLEANUP {
+      } EXCEPT {
+      } DEFAULT {
+        yield();
+        f->wrong += EXCLIB_EXCEPTION->value != EXC_INNER + id;
+        THROW(EXC_WRAPPED, "wrapped");
+      } FINALLY {
+      } ETRY;
+      f->wrong++;
+    } CLEANUP {
+    } EXCEPT {
+    } CATCH(EXC_WRAPPED) {
+      yield();
+      f->wrong += EXCLIB_EXCEPTION_INFO->ncauses != 1 || EXCLIB_EXCEPTION_INFO->causes[0].value != EXC_INNER + id;
+      f->caught++;
+    } FINALLY {
+    } ETRY;
+  }
+  f->wrong += EXCLIB_EXCEPTION != NULL;
+  f->done = 1;
+}
+
+int main(void)
+{
+  int live = FIBERS;
+  int caught = 0;
+  int wrong = 0;
+  int i;
+
+  for ( i = 0; i < FIBERS; i++ ) {
+    fibers[i].ctx = exclib_context_create();
+    fibers[i].stack = malloc(STACK_SIZE);
+    if ( !fibers[i].ctx || !fibers[i].stack ) {
+      printf("Out of memory at fiber %d\n", i);
+      return 1;
+    }
+    getcontext(&fibers[i].uc);
+    fibers[i].uc.uc_stack.ss_sp = fibers[i].stack;
+    fibers[i].uc.uc_stack.ss_size = STACK_SIZE;
+    fibers[i].uc.uc_link = &scheduler;
+    makecontext(&fibers[i].uc, (void (*)(void))fiber_main, 1, i);
+  }
+
+  /* round robin, so every fiber is parked inside a TRY while all the others run */
+  while ( live > 0 ) {
+    for ( i = 0; i < FIBERS; i++ ) {
+      if ( fibers[i].done )
+        continue;
+      current = i;
+      exclib_context_switch(fibers[i].ctx);
+      swapcontext(&scheduler, &fibers[i].uc);
+      exclib_context_switch(NULL);
+      if ( fibers[i].done )
+        live--;
+    }
+  }
+
+  for ( i = 0; i < FIBERS; i++ ) {
+    caught += fibers[i].caught;
+    wrong += fibers[i].wrong;
+    exclib_context_destroy(fibers[i].ctx);
+    free(fibers[i].stack);
+  }
+  printf("%d fibers caught %d of %d rethrows, %d went wrong\n", FIBERS, caught, FIBERS * ROUNDS, wrong);
+  if ( wrong || caught != FIBERS * ROUNDS || EXCLIB_EXCEPTION != NULL ) {
+    printf("FAILED\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,127 @@
+#define EXCLIB_CXX 1
+#include "exclib.h"
+
+/*
+ * What this demo shows: TRY/CATCH/ETRY in C++ built with EXCLIB_CXX, where
+ * they're a native try/catch, mixed with C code (demo/interop_c.c) using the
+ * setjmp ones.
+ * 1- A THROW from C++ into a C++ TRY unwinds like any C++ exception, running
+ *    destructors on the way
+ * 2- A THROW from C into a C++ TRY does too, through the C frames
+ * 3- A THROW from C++ into a C TRY is a longjmp, as it always was
+ * 4- An exception a C TRY doesn't catch goes on up into the C++ TRY around it
+ * 5- A plain throw exclib::exception(...) is caught like a THROW
+ * 6- A THROW from a C++ CATCH goes to the enclosing TRY, with its cause
+ * 7- Returning out of a C++ TRY block pops its frame
+ */
+
+extern "C" {
+void interop_c_throw(int code);
+int interop_c_catch(void (*fn)(void));
+void interop_c_pass(void (*fn)(void));
+}
+
+#define EXC_CXX    20
+#define EXC_FROM_C 21
+#define EXC_DIRECT 22
+#define EXC_OUTER  23
+
+static int destroyed = 0;
+static int failed = 0;
+
+struct guard {
+  ~guard() { destroyed++; }
+};
+
+static void check(bool ok, const char *what)
+{
+  printf("%s: %s\n", ok ? "ok" : "FAILED", what);
+  failed |= !ok;
+}
+
+static void cxx_throw()
+{
+  guard g;
+  THROW(EXC_CXX, "thrown from C++");
+}
+
+static void cxx_calls_c()
+{
+  guard g;
+  interop_c_throw(EXC_FROM_C);
+}
+
+static int caught_in(void (*fn)())
+{
+  int caught = 0;
+
+  TRY {
+    fn();
+  } CLEANUP {
+  } EXCEPT {
+  } DEFAULT {
+    caught = EXCLIB_EXCEPTION->value;
+  } FINALLY {
+  } ETRY;
+  return caught;
+}
+
+static void cxx_pass_through_c()
+{
+  interop_c_pass(cxx_throw);
+}
+
+static void direct()
+{
+  guard g;
+  throw exclib::exception(EXC_DIRECT, "plain C++ throw");
+}
+
+static int returns_early()
+{
+  TRY {
+    return 1;
+  } CLEANUP {
+  } EXCEPT {
+  } FINALLY {
+  } ETRY;
+  return 0;
+}
+
+int main(void)
+{
+  int depth = __exclib_curidx;
+
+  exclib_name_exception(EXC_CXX, "C++ Exception");
+  exclib_name_exception(EXC_FROM_C, "C Exception");
+
+  destroyed = 0;
+  check(caught_in(cxx_throw) == EXC_CXX && destroyed == 1, "C++ THROW caught by C++ TRY, destructor ran");
+  destroyed = 0;
+  check(caught_in(cxx_calls_c) == EXC_FROM_C && destroyed == 1, "C THROW caught by C++ TRY, through C, destructor ran");
+  check(interop_c_catch(cxx_throw) == EXC_CXX, "C++ THROW caught by C TRY");
+  check(caught_in(cxx_pass_through_c) == EXC_CXX, "C++ THROW passed on by a C TRY to the C++ TRY around it");
+  destroyed = 0;
+  check(caught_in(direct) == EXC_DIRECT && destroyed == 1, "throw exclib::exception caught by C++ TRY");
+
+  TRY {
+    TRY {
+      cxx_throw();
+    } CLEANUP {
+    } EXCEPT {
+    } CATCH(EXC_CXX) {
+      THROW(EXC_OUTER, "rethrown from a C++ CATCH");
+    } FINALLY {
+    } ETRY;
+  } CLEANUP {
+  } EXCEPT {
+  } CATCH(EXC_OUTER) {
+    check(EXCLIB_EXCEPTION_INFO->ncauses == 1 && EXCLIB_EXCEPTION_INFO->causes[0].value == EXC_CXX,
+	  "THROW from a C++ CATCH reaches the outer TRY with its cause");
+  } FINALLY {
+  } ETRY;
+
+  check(returns_early() == 1 && __exclib_curidx == depth, "return from a C++ TRY pops its frame");
+  check(__exclib_curidx == depth, "every frame popped");
+  return failed;
+}
@@ -0,0 +1,39 @@
+#include "exclib.h"
+
+/*
+ * The C half of demo/interop.cpp: plain setjmp TRY/THROW, built as C, called
+ * from C++ and calling back into it.
+ */
+
+void interop_c_throw(int code)
+{
+  THROW(code, "thrown from C");
+}
+
+/* Runs fn in a C TRY; returns what it caught, or 0 */
+int interop_c_catch(void (*fn)(void))
+{
+  volatile int caught = 0;
+
+  TRY {
+    fn();
+  } CLEANUP {
+  } EXCEPT {
+  } DEFAULT {
+    caught = EXCLIB_EXCEPTION->value;
+  } FINALLY {
+  } ETRY;
+  return caught;
+}
+
+/* Runs fn in a C TRY that catches something else, so whatever fn throws goes on up */
+void interop_c_pass(void (*fn)(void))
+{
+  TRY {
+    fn();
+  } CLEANUP {
+  } EXCEPT {
+  } CATCH(EXC_OUTOFBOUNDS) {
+  } FINALLY {
+  } ETRY;
+}
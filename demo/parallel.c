@@ -0,0 +1,137 @@
+#define _POSIX_C_SOURCE 200112L
+#include "exclib.h"
+#include <pthread.h>
+#include <sched.h>
+
+/*
+ * What this demo shows:
+ * 1- exclib_exception_capture copies an exception out of a handler on one
+ *    thread, and EXCLIB_RETHROW throws it on another with its code, THROWF
+ *    message, payload and causes intact
+ * 2- exclib_parallel_for spreads a loop over several threads and returns
+ *    quietly when nothing throws
+ * 3- When one iteration throws, it comes out of exclib_parallel_for into the
+ *    caller's TRY as itself
+ * 4- When several do, the caller gets EXC_PARALLEL, with the failures (lowest
+ *    iteration first) as its causes and their count as its payload
+ */
+
+#define EXC_BAD_RECORD  20
+#define EXC_WRAPPED     21
+
+#define WORKERS  4
+#define ITEMS    4000
+
+static struct exclib_captured handed_over;
+static long total = 0;
+static int arrived = 0;
+
+static void *capture_thread(void *arg)
+{
+  TRY {
+    TRY {
+      THROW(EXC_BAD_RECORD, "bad record");
+    } CLEANUP {
+    } EXCEPT {
+    } CATCH(EXC_BAD_RECORD) {
+      THROWF(EXC_WRAPPED, "record %d of %s", 42, "batch-7");
+    } FINALLY {
+    } ETRY;
+  } CLEANUP {
+  } EXCEPT {
+  } DEFAULT {
+    exclib_exception_capture(&handed_over);
+  } FINALLY {
+  } ETRY;
+  return arg;
+}
+
+static void add(long i, void *arg)
+{
+  (void)arg;
+  __atomic_add_fetch(&total, i, __ATOMIC_RELAXED);
+}
+
+static void one_fails(long i, void *arg)
+{
+  (void)arg;
+  if ( i == 777 )
+    THROWF(EXC_BAD_RECORD, "record %ld", i);
+}
+
+/* the first iteration of every worker's slice throws, once all of them have got there */
+static void first_of_each_fails(long i, void *arg)
+{
+  (void)arg;
+  if ( i % (ITEMS / WORKERS) != 0 )
+    return;
+  __atomic_add_fetch(&arrived, 1, __ATOMIC_RELAXED);
+  while ( __atomic_load_n(&arrived, __ATOMIC_RELAXED) < WORKERS )
+    sched_yield();
+  THROWF(EXC_BAD_RECORD, "record %ld", i);
+}
+
+int main(void)
+{
+  pthread_t thread;
+  char buf[64];
+  volatile int failed = 0;
+  int i;
+
+  exclib_name_exception(EXC_BAD_RECORD, "Bad Record");
+  exclib_name_exception(EXC_WRAPPED, "Wrapped");
+
+  pthread_create(&thread, NULL, capture_thread, NULL);
+  pthread_join(thread, NULL);
+  TRY {
+    EXCLIB_RETHROW(handed_over);
+  } CLEANUP {
+  } EXCEPT {
+  } CATCH(EXC_WRAPPED) {
+    EXCLIB_MESSAGE(buf, sizeof(buf));
+    printf("Rethrown from another thread: %s: %s, caused by %s\n", EXCLIB_EXCEPTION_INFO->name, buf,
+	   EXCLIB_EXCEPTION_INFO->causes[0].name);
+    failed |= strcmp(buf, "record 42 of batch-7") != 0 || EXCLIB_EXCEPTION_INFO->ncauses != 1 ||
+      EXCLIB_EXCEPTION_INFO->causes[0].value != EXC_BAD_RECORD;
+  } FINALLY {
+  } ETRY;
+
+  exclib_parallel_for(ITEMS, add, NULL, WORKERS);
+  printf("Sum of 0..%d on %d threads: %ld\n", ITEMS - 1, WORKERS, total);
+  failed |= total != (long)ITEMS * (ITEMS - 1) / 2;
+
+  TRY {
+    exclib_parallel_for(ITEMS, one_fails, NULL, WORKERS);
+    failed = 1;
+  } CLEANUP {
+  } EXCEPT {
+  } CATCH(EXC_BAD_RECORD) {
+    EXCLIB_MESSAGE(buf, sizeof(buf));
+    printf("One failure comes back as itself: %s: %s\n", EXCLIB_EXCEPTION_INFO->name, buf);
+    failed |= strcmp(buf, "record 777") != 0;
+  } FINALLY {
+  } ETRY;
+
+  TRY {
+    exclib_parallel_for(ITEMS, first_of_each_fails, NULL, WORKERS);
+    failed = 1;
+  } CLEANUP {
+  } EXCEPT {
+  } CATCH(EXC_PARALLEL) {
+    printf("Several come back as %s, %lu of them:\n", EXCLIB_EXCEPTION_INFO->name, EXCLIB_PAYLOAD->value);
+    for ( i = 0; i < EXCLIB_EXCEPTION_INFO->ncauses; i++ ) {
+      exclib_format_message(&EXCLIB_EXCEPTION_INFO->causes[i].msg, EXCLIB_EXCEPTION_INFO->causes[i].description, buf, sizeof(buf));
+      printf("  %s: %s\n", EXCLIB_EXCEPTION_INFO->causes[i].name, buf);
+    }
+    failed |= EXCLIB_PAYLOAD->value != WORKERS || EXCLIB_EXCEPTION_INFO->ncauses != (WORKERS < EXC_MAX_CAUSES ? WORKERS : EXC_MAX_CAUSES);
+    exclib_format_message(&EXCLIB_EXCEPTION_INFO->causes[1].msg, EXCLIB_EXCEPTION_INFO->causes[1].description, buf, sizeof(buf));
+    failed |= strcmp(buf, "record 1000") != 0;
+  } FINALLY {
+  } ETRY;
+
+  if ( failed ) {
+    printf("FAILED\n");
+    return 1;
+  }
+  return 0;
+}
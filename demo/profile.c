@@ -0,0 +1,97 @@
+#include "exclib.h"
+
+/*
+ * What this demo shows:
+ * 1- With the profiler on, every exception is timed from its THROW to the
+ *    CATCH that takes it, in a histogram for the TRY that caught it
+ * 2- Each TRY it propagates out of on the way gets the time of that hop
+ * 3- exclib_profile_percentile reads a latency budget straight off a
+ *    snapshot, and the snapshot has the deepest the TRYs went
+ * 4- exclib_profile_dump prints the same for a log (here to a scratch file,
+ *    since the numbers change from run to run); exclib_profile_dump_every
+ *    or EXCLIB_PROFILE=<seconds> print one every so often
+ */
+
+#define EXC_TIMEOUT  1
+
+static void call(int depth)
+{
+  if ( depth == 0 )
+    THROW(EXC_TIMEOUT, "timed out");
+  TRY {
+    call(depth - 1);
+  } CLEANUP {
+  } EXCEPT {
+  } FINALLY {
+  } ETRY;
+}
+
+static void request(int depth)
+{
+  TRY {
+    call(depth);
+  } CLEANUP {
+  } EXCEPT {
+  } CATCH(EXC_TIMEOUT) {
+  } FINALLY {
+  } ETRY;
+}
+
+static unsigned long site_count(const struct exclib_profile *profile, const char *function, int caught)
+{
+  unsigned int i;
+
+  for ( i = 0; i < profile->nsites; i++ ) {
+    if ( profile->sites[i].site && strcmp(profile->sites[i].site->function, function) == 0 )
+      return caught ? profile->sites[i].caught.n : profile->sites[i].hop.n;
+  }
+  return 0;
+}
+
+int main(void)
+{
+  struct exclib_profile *profile;
+  unsigned long p50;
+  unsigned long p99;
+  FILE *out;
+  char line[512];
+  int lines = 0;
+  int i;
+  int failed = 0;
+
+  request(0);
+  exclib_profile_enable(1);
+  for ( i = 0; i < 1000; i++ )
+    request(i % 4);
+  exclib_profile_enable(0);
+  request(3);
+
+  profile = exclib_profile_snapshot();
+  printf("Profiled %lu exceptions, %lu propagation hops, at most %d TRYs deep\n",
+         profile->caught.n, profile->hop.n, profile->max_depth);
+  failed |= profile->caught.n != 1000 || profile->hop.n != 1500 || profile->max_depth != 4;
+  printf("Caught in request(): %lu; propagated out of call(): %lu\n",
+         site_count(profile, "request", 1), site_count(profile, "call", 0));
+  failed |= site_count(profile, "request", 1) != 1000 || site_count(profile, "call", 0) != 1500;
+
+  p50 = exclib_profile_percentile(&profile->caught, 50.0);
+  p99 = exclib_profile_percentile(&profile->caught, 99.0);
+  printf("THROW to CATCH: p50 <= p99 <= max: %s\n", (p50 <= p99 && p99 <= profile->caught.max) ? "yes" : "no");
+  failed |= p50 > p99 || p99 > profile->caught.max || p50 == 0;
+
+  out = tmpfile();
+  exclib_profile_dump(out, profile, EXCLIB_STATS_TEXT);
+  rewind(out);
+  while ( fgets(line, sizeof(line), out) )
+    lines++;
+  fclose(out);
+  printf("exclib_profile_dump wrote %d lines: a header, the totals and one per TRY site\n", lines);
+  failed |= lines != 4;
+  exclib_profile_free(profile);
+
+  if ( failed ) {
+    printf("FAILED\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,117 @@
+#define _XOPEN_SOURCE 500
+#include "exclib.h"
+#include <sys/wait.h>
+
+/*
+ * What this demo shows:
+ * 1- A child process records into a flight recorder file, throws and catches
+ *    a few exceptions, and then dies of an uncaught one
+ * 2- The file is still there, with everything it recorded, after the child
+ *    is gone: the parent reads back the throws, the catch, the propagation
+ *    and the uncaught exception that ended it
+ * 3- The file's layout is the structs in exclib.h, which is all the parent
+ *    (or tools/exclib-dump) needs to read it
+ */
+
+#define EXC_RETRY   10
+#define EXC_FATAL   11
+
+static void attempt(void)
+{
+  THROW(EXC_RETRY, "try again later");
+}
+
+static void give_up(void)
+{
+  TRY {
+    THROW(EXC_FATAL, "giving up");
+  } CLEANUP {
+  } EXCEPT {
+  } CATCH(EXC_RETRY) {
+  } FINALLY {
+  } ETRY;
+}
+
+static void child(const char *path)
+{
+  int i;
+
+  if ( exclib_recorder_open(path, 4, 64) != 0 ) {
+    perror(path);
+    exit(100);
+  }
+  for ( i = 0; i < 3; i++ ) {
+    TRY {
+      attempt();
+    } CLEANUP {
+    } EXCEPT {
+    } CATCH(EXC_RETRY) {
+    } FINALLY {
+    } ETRY;
+  }
+  TRY {
+    give_up();
+  } CLEANUP {
+  } EXCEPT {
+  } FINALLY {
+  } ETRY;
+}
+
+int main(void)
+{
+  static const char *events[EXCLIB_STAT_EVENTS] = {"thrown", "caught", "propagated", "uncaught"};
+  char path[] = "/tmp/exclib-recorder-XXXXXX";
+  struct exclib_flight_header h;
+  struct exclib_flight_ring ring;
+  struct exclib_flight_record r;
+  int counts[EXCLIB_STAT_EVENTS] = {0, 0, 0, 0};
+  unsigned int i;
+  int status;
+  int fd;
+  pid_t pid;
+  FILE *in;
+
+  fd = mkstemp(path);
+  if ( fd < 0 ) {
+    perror("mkstemp");
+    return 1;
+  }
+  close(fd);
+  fflush(NULL);
+  pid = fork();
+  if ( pid == 0 ) {
+    child(path);
+    _exit(0);
+  }
+  waitpid(pid, &status, 0);
+  printf("Child exited with %d\n", WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+
+  in = fopen(path, "rb");
+  if ( !in || fread(&h, sizeof(h), 1, in) != 1 || memcmp(h.magic, EXCLIB_FLIGHT_MAGIC, sizeof(EXCLIB_FLIGHT_MAGIC)) != 0 ) {
+    printf("FAILED: no flight recorder file\n");
+    return 1;
+  }
+  /* the child only had the one thread, so everything is in the first ring */
+  fseek(in, h.rings_offset, SEEK_SET);
+  if ( fread(&ring, sizeof(ring), 1, in) != 1 ) {
+    printf("FAILED: no ring\n");
+    return 1;
+  }
+  printf("The dead child's ring has %lu records:\n", ring.head);
+  for ( i = 0; i < ring.head && i < h.nrecords; i++ ) {
+    if ( fread(&r, sizeof(r), 1, in) != 1 || r.seq != i + 1 )
+      break;
+    counts[r.event]++;
+    printf("  depth %d %-10s code %d line %d%s%s\n", r.depth, events[r.event], r.code, r.line, r.text[0] ? " " : "", r.text);
+  }
+  fclose(in);
+  printf("Run tools/exclib-dump on such a file for the rest; this one goes now\n");
+  unlink(path);
+
+  if ( !WIFEXITED(status) || WEXITSTATUS(status) != EXC_FATAL || counts[EXCLIB_STAT_THROWN] != 4 ||
+       counts[EXCLIB_STAT_CAUGHT] != 3 || counts[EXCLIB_STAT_PROPAGATED] != 1 || counts[EXCLIB_STAT_UNCAUGHT] != 1 ) {
+    printf("FAILED\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,63 @@
+#include "exclib.h"
+
+/*
+ * What this demo shows:
+ * 1- Any int can be an exception code, including negative errno-style codes
+ *    and codes far past the old 4096 limit
+ * 2- exclib_bulk_name_exceptions registers a large table in one call
+ * 3- Names registered at startup show up on the exception frame
+ */
+
+#define EXC_VENDOR_BASE   1000000
+#define EXC_VENDOR_COUNT  5000
+
+static char *vendor_name = "Vendor Failure";
+
+int main(void)
+{
+  static struct exclib_name_data vendor[EXC_VENDOR_COUNT];
+  char *name = NULL;
+  int i;
+
+  for ( i = 0; i < EXC_VENDOR_COUNT; i++ ) {
+    vendor[i].exc = EXC_VENDOR_BASE + i;
+    vendor[i].name = vendor_name;
+    vendor[i].signal = 0;
+  }
+  exclib_bulk_name_exceptions(vendor, EXC_VENDOR_COUNT);
+  exclib_name_exception(-5, "EIO");
+
+  TRY {
+    THROW(-5, "negative codes are fine");
+  } CLEANUP {
+  } EXCEPT {
+  } CATCH(-5) {
+    name = EXCLIB_EXCEPTION_INFO->name;
+  } FINALLY {
+  } ETRY;
+  if ( name == NULL || strcmp(name, "EIO") != 0 ) {
+    EXCLIB_TRACE("-5 was not named EIO");
+    return 1;
+  }
+
+  TRY {
+    THROW(EXC_VENDOR_BASE + 4321, "so are big ones");
+  } CLEANUP {
+  } EXCEPT {
+  } DEFAULT {
+    EXCLIB_TRACE("Caught a vendor exception");
+    name = EXCLIB_EXCEPTION_INFO->name;
+  } FINALLY {
+  } ETRY;
+  if ( name != vendor_name ) {
+    EXCLIB_TRACE("vendor code was not named");
+    return 1;
+  }
+
+  if ( strcmp(exclib_exception_name(EXC_NULLPOINTER), "Null Pointer") != 0 ||
+       exclib_exception_signal(EXC_NULLPOINTER) != SIGSEGV ) {
+    EXCLIB_TRACE("predefined exceptions went missing");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,39 @@
+#include "exclib.h"
+
+/*
+ * What this demo shows:
+ * 1- The same report in the default and the compact one-line form
+ * 2- A report printed from inside a signal handler
+ * 3- Reports can go to any file descriptor, here stdout
+ */
+
+static void on_usr1(int sig)
+{
+  (void)sig;
+  EXCLIB_TRACE("Report from a signal handler");
+}
+
+int main(void)
+{
+  exclib_set_report_fd(1);
+  TRY {
+    TRY {
+      THROW(3, "description with\na newline in it");
+    } CLEANUP {
+    } EXCEPT {
+    } CATCH(3) {
+      EXCLIB_TRACE("Default report");
+      exclib_set_report_format(EXCLIB_REPORT_COMPACT);
+      EXCLIB_TRACE("Compact report");
+      exclib_set_report_format(EXCLIB_REPORT_LINES);
+    } FINALLY {
+    } ETRY;
+
+    signal(SIGUSR1, on_usr1);
+    raise(SIGUSR1);
+  } CLEANUP {
+  } EXCEPT {
+  } FINALLY {
+  } ETRY;
+  return 0;
+}
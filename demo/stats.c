@@ -0,0 +1,76 @@
+#define _POSIX_C_SOURCE 200112L
+#include "exclib.h"
+#include <pthread.h>
+
+/*
+ * What this demo shows:
+ * 1- Every thread counts its own exceptions; a snapshot adds them all up,
+ *    including threads that have already exited
+ * 2- Counts per code and per TRY/THROW site, as text and as JSON
+ *
+ * With the library built EXCLIB_STATS=0 the snapshot is empty.
+ */
+
+#define DEMO_THREADS     4
+#define DEMO_ITERATIONS  1000
+#define EXC_BADINPUT     3
+#define EXC_TIMEOUT      4
+
+static void parse(int i)
+{
+  TRY {
+    if ( i % 10 == 0 )
+      THROW(EXC_TIMEOUT, "took too long");
+    if ( i % 2 == 0 )
+      THROW(EXC_BADINPUT, "malformed input");
+  } CLEANUP {
+  } EXCEPT {
+  } CATCH(EXC_BADINPUT) {
+  } FINALLY {
+  } ETRY;
+}
+
+static void *worker(void *arg)
+{
+  int i;
+
+  (void)arg;
+  for ( i = 0; i < DEMO_ITERATIONS; i++ ) {
+    TRY {
+      parse(i);
+    } CLEANUP {
+    } EXCEPT {
+    } CATCH(EXC_TIMEOUT) {
+    } FINALLY {
+    } ETRY;
+  }
+  return NULL;
+}
+
+int main(void)
+{
+  pthread_t threads[DEMO_THREADS];
+  struct exclib_stats *stats;
+  unsigned long thrown;
+  int i;
+
+  exclib_name_exception(EXC_BADINPUT, "Bad Input");
+  exclib_name_exception(EXC_TIMEOUT, "Timeout");
+  for ( i = 0; i < DEMO_THREADS; i++ )
+    pthread_create(&threads[i], NULL, worker, NULL);
+  for ( i = 0; i < DEMO_THREADS; i++ )
+    pthread_join(threads[i], NULL);
+  worker(NULL);
+
+  stats = exclib_stats_snapshot();
+  if ( !stats )
+    return 1;
+  exclib_stats_dump(stdout, stats, EXCLIB_STATS_TEXT);
+  exclib_stats_dump(stdout, stats, EXCLIB_STATS_JSON);
+  thrown = stats->total[EXCLIB_STAT_THROWN];
+  exclib_stats_free(stats);
+  /* every other iteration throws, on each thread and once more on main */
+  if ( EXCLIB_STATS && thrown != (DEMO_THREADS + 1) * DEMO_ITERATIONS / 2 )
+    return 1;
+  return 0;
+}
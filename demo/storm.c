@@ -0,0 +1,43 @@
+#include "exclib.h"
+
+/*
+ * What this demo shows: an exception storm. The same exception is thrown and
+ * traced 200000 times, but with a reporting policy set only a handful of
+ * reports are printed, and the rest are summed up in one "suppressed" line.
+ * 1- The first report from a (code, site) always prints
+ * 2- After that only every 100000th does, and no more than 2 a second overall
+ * 3- exclib_report_flush_suppressed prints what was held back
+ */
+
+#define DEMO_STORM 200000
+#define EXC_UPSTREAM 3
+
+int main(void)
+{
+  struct exclib_report_policy policy;
+  long i;
+
+  memset(&policy, 0, sizeof(policy));
+  policy.window_ms = 60000;
+  policy.sample_every = 100000;
+  policy.rate = 1;
+  policy.burst = 2;
+  exclib_set_report_policy(&policy);
+  exclib_name_exception(EXC_UPSTREAM, "Upstream Unavailable");
+
+  for ( i = 0; i < DEMO_STORM; i++ ) {
+    TRY {
+      THROW(EXC_UPSTREAM, "connection refused");
+    } CLEANUP {
+    } EXCEPT {
+    } CATCH(EXC_UPSTREAM) {
+      EXCLIB_TRACE("Upstream call failed");
+    } FINALLY {
+    } ETRY;
+  }
+  exclib_report_flush_suppressed();
+
+  exclib_set_report_policy(NULL);
+  EXCLIB_TRACE("Policy off, this one always prints");
+  return 0;
+}
@@ -0,0 +1,110 @@
+#define _POSIX_C_SOURCE 200112L
+#include "exclib.h"
+#include <pthread.h>
+#include <time.h>
+
+/*
+ * What this demo shows:
+ * 1- Every thread has its own exception frame stack, so TRY/THROW/ETRY can run
+ *    on many threads at once with no lock around them
+ * 2- A thread never sees another thread's exception value or frame depth
+ * 3- Throughput grows with the number of threads (up to the number of cores)
+ *
+ * Usage: threads.exe [max threads] [iterations per thread]
+ */
+
+#define DEMO_MAX_THREADS 64
+
+struct worker {
+  pthread_t thread;
+  int id;
+  long iterations;
+  long errors;
+};
+
+static void *worker_main(void *arg)
+{
+  struct worker *w = (struct worker *)arg;
+  long i;
+  int expected;
+
+  for ( i = 0; i < w->iterations; i++ ) {
+    /* unique per thread, so a frame shared with another thread shows up as a mismatch */
+    expected = (w->id + 1) * 10 + (int)(i % 7) + 1;
+    TRY {
+      if ( __exclib_curidx != 1 )
+	w->errors++;
+      TRY {
+	if ( __exclib_curidx != 2 )
+	  w->errors++;
+	THROW(expected, "thrown from the inner frame");
+      } CLEANUP {
+      } EXCEPT {
+      } DEFAULT {
+	if ( EXCLIB_EXCEPTION->value != expected || __exclib_curidx != 2 )
+	  w->errors++;
+      } FINALLY {
+      } ETRY;
+      if ( __exclib_curidx != 1 )
+	w->errors++;
+    } CLEANUP {
+    } EXCEPT {
+    } DEFAULT {
+      /* the inner frame handled everything, nothing may reach us */
+      w->errors++;
+    } FINALLY {
+    } ETRY;
+  }
+  return NULL;
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+  struct worker workers[DEMO_MAX_THREADS];
+  int maxthreads = 8;
+  long iterations = 100000;
+  double base = 0.0;
+  double start, elapsed, rate;
+  long errors = 0;
+  int nthreads, i;
+
+  if ( argc > 1 )
+    maxthreads = atoi(argv[1]);
+  if ( argc > 2 )
+    iterations = atol(argv[2]);
+  if ( maxthreads < 1 || maxthreads > DEMO_MAX_THREADS )
+    maxthreads = DEMO_MAX_THREADS;
+
+  printf("threads,ops_per_sec,scaling\n");
+  for ( nthreads = 1; nthreads <= maxthreads; nthreads *= 2 ) {
+    start = now();
+    for ( i = 0; i < nthreads; i++ ) {
+      workers[i].id = i;
+      workers[i].iterations = iterations;
+      workers[i].errors = 0;
+      pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+    }
+    for ( i = 0; i < nthreads; i++ ) {
+      pthread_join(workers[i].thread, NULL);
+      errors += workers[i].errors;
+    }
+    elapsed = now() - start;
+    rate = (double)(iterations * nthreads) / elapsed;
+    if ( nthreads == 1 )
+      base = rate;
+    printf("%d,%.0f,%.2f\n", nthreads, rate, rate / base);
+  }
+
+  if ( errors != 0 ) {
+    fprintf(stderr, "%ld corrupted frames seen\n", errors);
+    return 1;
+  }
+  return 0;
+}
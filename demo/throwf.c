@@ -0,0 +1,97 @@
+#include "exclib.h"
+#include <errno.h>
+
+/*
+ * What this demo shows:
+ * 1- THROWF keeps a printf-style message that's only formatted when something
+ *    asks for it, here EXCLIB_MESSAGE in the handler
+ * 2- %s arguments are copied at the THROW, so a buffer on the thrower's stack
+ *    can go away before the message is printed
+ * 3- THROW_PAYLOAD attaches a typed value (an errno here) that the handler
+ *    reads back through EXCLIB_PAYLOAD
+ * 4- A THROW from a CATCH goes on to the enclosing TRY, and keeps what it
+ *    replaced as a "caused by" chain; a report prints the whole chain
+ * 5- A * width or precision is kept as an argument of its own, so a
+ *    length-limited %.*s prints just what it would have from printf
+ */
+
+#define EXC_OPEN   10
+#define EXC_CONFIG 11
+#define EXC_START  12
+#define EXC_SHORT  13
+
+static void open_config(const char *path)
+{
+  if ( access(path, R_OK) != 0 )
+    THROW_PAYLOAD(EXC_OPEN, "open failed", EXCLIB_PAYLOAD_ERRNO, errno);
+}
+
+static void load_config(int attempt)
+{
+  char name[16];
+
+  strcpy(name, "app.conf");
+  TRY {
+    open_config("/nonexistent/app.conf");
+  } CLEANUP {
+  } EXCEPT {
+  } CATCH(EXC_OPEN) {
+    THROWF(EXC_CONFIG, "can't load %s (attempt %d of %d, errno %ld)", name, attempt, 3, (long)EXCLIB_PAYLOAD->value);
+  } FINALLY {
+  } ETRY;
+}
+
+int main(void)
+{
+  char buf[128];
+  int failed = 0;
+
+  exclib_name_exception(EXC_OPEN, "Open Failed");
+  exclib_name_exception(EXC_CONFIG, "Bad Configuration");
+  exclib_name_exception(EXC_START, "Startup Failed");
+
+  TRY {
+    THROWF(EXC_START, "%s: %d%% of workers, 0x%06x, %f", "pool", 50, 0xbeefu, 0.25);
+  } CLEANUP {
+  } EXCEPT {
+  } CATCH(EXC_START) {
+    EXCLIB_MESSAGE(buf, sizeof(buf));
+    printf("Formatted on demand: %s\n", buf);
+    failed |= strcmp(buf, "pool: 50% of workers, 0x00beef, 0.250000") != 0;
+  } FINALLY {
+  } ETRY;
+
+  TRY {
+    char header[] = "HDR\x01\x02garbage";
+
+    THROWF(EXC_SHORT, "short read: %.*s (%*d bytes)", 3, header, 4, 99);
+  } CLEANUP {
+  } EXCEPT {
+  } CATCH(EXC_SHORT) {
+    EXCLIB_MESSAGE(buf, sizeof(buf));
+    printf("With * arguments: %s\n", buf);
+    failed |= strcmp(buf, "short read: HDR (  99 bytes)") != 0;
+  } FINALLY {
+  } ETRY;
+
+  TRY {
+    load_config(2);
+  } CLEANUP {
+  } EXCEPT {
+  } CATCH(EXC_CONFIG) {
+    EXCLIB_MESSAGE(buf, sizeof(buf));
+    printf("Caught %s: %s\n", EXCLIB_EXCEPTION_INFO->name, buf);
+    printf("Caused by %d %s: %s, errno %lu\n", EXCLIB_EXCEPTION_INFO->causes[0].value,
+	   EXCLIB_EXCEPTION_INFO->causes[0].name, EXCLIB_EXCEPTION_INFO->causes[0].description,
+	   EXCLIB_EXCEPTION_INFO->causes[0].payload.value);
+    failed |= EXCLIB_EXCEPTION_INFO->ncauses != 1 || strcmp(buf, "can't load app.conf (attempt 2 of 3, errno 2)") != 0;
+    EXCLIB_TRACE("The report prints the chain too");
+  } FINALLY {
+  } ETRY;
+
+  if ( failed ) {
+    printf("FAILED\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,130 @@
+#include "exclib.h"
+
+/*
+ * What this demo shows:
+ * 1- An exception goes straight past TRY_FOR frames whose lists don't have
+ *    it, to the first TRY that can take it; their CATCH, CLEANUP and FINALLY
+ *    blocks never see it
+ * 2- What a skipped frame does get to run is its EXCLIB_ON_UNWIND action,
+ *    innermost first
+ * 3- A TRY_FOR whose list does have the code, or a class above it, stops the
+ *    exception like any TRY, and the frames above it go on normally
+ * 4- A THROW from a CATCH goes past skipped frames the same way
+ */
+
+#define EXC_IO_ERROR  1
+#define EXC_TIMEOUT   2
+#define EXC_PARSE     3
+#define EXC_REJECTED  4
+
+static const int io_errors[] = { EXC_IO_ERROR, 0 };
+static const int parse_errors[] = { EXC_PARSE, 0 };
+
+static char unwound[64];
+static volatile int cleaned = 0;
+
+static void note_unwind(void *arg)
+{
+  strcat(unwound, (const char *)arg);
+}
+
+static void read_record(int code)
+{
+  TRY_FOR (io_errors) {
+    EXCLIB_ON_UNWIND(note_unwind, "read ");
+    THROW(code, "record failed");
+  } CLEANUP {
+    cleaned++;
+  } EXCEPT {
+  } CATCH_CLASS(EXC_IO_ERROR) {
+    strcat(unwound, "caught-in-read ");
+  } FINALLY {
+  } ETRY;
+}
+
+static void parse_file(int code)
+{
+  TRY_FOR (parse_errors) {
+    EXCLIB_ON_UNWIND(note_unwind, "parse ");
+    read_record(code);
+  } CLEANUP {
+    cleaned++;
+  } EXCEPT {
+  } CATCH(EXC_PARSE) {
+  } FINALLY {
+  } ETRY;
+}
+
+static void validate(void)
+{
+  TRY {
+    THROW(EXC_PARSE, "bad field");
+  } CLEANUP {
+  } EXCEPT {
+  } CATCH(EXC_PARSE) {
+    THROW(EXC_REJECTED, "record rejected");
+  } FINALLY {
+  } ETRY;
+}
+
+static void load(void)
+{
+  TRY_FOR (io_errors) {
+    EXCLIB_ON_UNWIND(note_unwind, "load ");
+    validate();
+  } CLEANUP {
+    cleaned++;
+  } EXCEPT {
+  } CATCH(EXC_IO_ERROR) {
+  } FINALLY {
+  } ETRY;
+}
+
+static int run(void (*fn)(int), int code)
+{
+  int caught = 0;
+
+  unwound[0] = '\0';
+  cleaned = 0;
+  TRY {
+    fn(code);
+  } CLEANUP {
+  } EXCEPT {
+  } DEFAULT {
+    caught = EXCLIB_EXCEPTION->value;
+  } FINALLY {
+  } ETRY;
+  return caught;
+}
+
+static void load_wrapper(int code)
+{
+  (void)code;
+  load();
+}
+
+int main(void)
+{
+  int failed = 0;
+  int caught;
+
+  exclib_class_exception(EXC_TIMEOUT, EXC_IO_ERROR);
+
+  caught = run(parse_file, EXC_REJECTED);
+  printf("EXC_REJECTED: caught %d on top, unwound: %s(%d CLEANUPs ran)\n", caught, unwound, cleaned);
+  failed |= caught != EXC_REJECTED || strcmp(unwound, "read parse ") != 0 || cleaned != 0;
+
+  caught = run(parse_file, EXC_TIMEOUT);
+  printf("EXC_TIMEOUT: caught %d on top, unwound: %s(%d CLEANUPs ran)\n", caught, unwound, cleaned);
+  failed |= caught != 0 || strcmp(unwound, "caught-in-read ") != 0 || cleaned != 2;
+
+  caught = run(load_wrapper, 0);
+  printf("Rethrown EXC_REJECTED: caught %d on top, unwound: %s(%d CLEANUPs ran)\n", caught, unwound, cleaned);
+  failed |= caught != EXC_REJECTED || strcmp(unwound, "load ") != 0 || cleaned != 0;
+
+  if ( failed ) {
+    printf("FAILED\n");
+    return 1;
+  }
+  return 0;
+}
@@ -13,20 +13,30 @@
  * These defines create a primitive sort of exception handling for bare C. Some things of note:
  *
  * 1- There is no dynamic memory allocation, ever, unless we print backtrace (in which case it's not our code doing it, it's execinfo)
- * 2- We work in our own sort of exception context stack (__exclib_statuses) to do this; we can only ever have EXC_MAX_FRAMES number of frames tracked at any given time. This must be defined at compile time.
+ * 2- We work in our own sort of exception context stack (__exclib_frames) to do this. It starts as EXC_INLINE_FRAMES frames built into each thread and grows EXC_FRAME_CHUNK frames at a time, up to EXC_MAX_FRAMES; a TRY past that throws EXC_OUTOFFRAMES into the innermost frame. Chunks never move and are kept for reuse until the thread exits, so only the first TRY to reach a new depth allocates.
+ *    Each thread gets its own stack (and its own EXCLIB_EXCEPTION and scratch buffer) through thread-local storage, so TRY/THROW/ETRY never take a lock and threads never share frames. Only the exception name table is process-wide; fill it in before starting threads.
+ *    To hand an exception to another thread, copy it out of the handler with exclib_exception_capture and throw it there with EXCLIB_RETHROW. exclib_parallel_for does this for its workers: once they've all finished, the first iteration that threw is rethrown in the caller's TRY, or an EXC_PARALLEL with every failure (up to EXC_MAX_CAUSES) as its causes if there was more than one.
+ *    Fibers or coroutines that switch stacks inside a TRY need a frame stack each: give each one an exclib_context_create() and call exclib_context_switch() with it whenever that fiber is resumed (NULL goes back to the thread's own). A switch only moves a few pointers, so it's cheap enough to go in every yield; the native backtrace stays with the thread and is dropped on a switch.
  * 3- The benefit of the 2nd point is that we don't do malloc/free in our exception handling, and we can also keep from overwriting the current context within multiple nested TRY/ETRY blocks (and yes I've already tried, just scoping the operators {} does not help)
  * 4- THROW() is smart enough to know when it is being used outside the context of a TRY block, and it will raise its own exception/traceback
  * 5- Uncaught exceptions print a stacktrace; will have file names if debug is compiled and symbols aren't mangled, otherwise addr2line is your friend
+ *    Each report is formatted without malloc or stdio and goes out in one write(2), so it's safe from a signal handler and reports from different threads don't interleave. exclib_set_report_format(EXCLIB_REPORT_COMPACT) puts a whole report on one line for log collectors; exclib_set_report_fd sends reports somewhere other than stderr.
+ *    When the same exception is thrown and traced over and over, exclib_set_report_policy (struct exclib_report_policy) deduplicates, samples and rate limits those reports without taking a lock.
  * 6- Uncaught exceptions generate SIGKILL on the current process to help w/ graceful shutdown
- * 7- The current exception frame is always available as EXCLIB_EXCEPTION, and is of type (struct exc_status)
- * 8- All exceptions store a stacktrace at the time their TRY block is encountered, though it is not necessarily printed
- * 9- Each member of the exception stack is currently ~700 bytes, so beware of making EXC_MAX_FRAMES too large (the default, 50, is already unimaginably deep and adds ~35kB to your memory usage automatically). Don't be afraid to make EXC_MAX_FRAMES smaller; most programs won't need more than 10 or 15, because this only tracks where TRY/THROW have been used, and each TRY/THROW pair use only one entry. Stacktraces aren't stored here, so this doesn't limit the possible size of a stacktrace.
- * 10- Because this library allows you to name your exceptions, you will automatically use an additional (1 * EXC_MAX_EXCEPTIONS) bytes of memory for the array of character pointers to store linkage to your exception strings, not counting whatever memory is used up by the actual string table for your strings. By default, EXC_MAX_EXCEPTIONS is set to 65535. You should probably leave it there, since you have no way of knowing how many exceptions a dependent library might use (and remember, compiler array bounds checking may not always save you here)... The 64k memory hit is, in this day and age, a pretty small price to pay for the verbosity provided.
- * 11- You get an additional (sizeof(int) * EXC_MAX_EXCEPTIONS) in memory usage from the table of signals to match exceptions. When an uncaught exception rises to the top, it generates a signal action. By default, that signal is SIGKILL, but you can override it in the call to exclib_name_exception.
+ * 7- The current exception frame is always available as EXCLIB_EXCEPTION, and is of type (struct exclib_status); its file/line/name/description are in EXCLIB_EXCEPTION_INFO (struct exclib_frame_info)
+ *    THROWF and THROW_PAYLOAD add a lazily formatted message (EXCLIB_MESSAGE) or a typed value (EXCLIB_PAYLOAD), and a THROW from a handler goes to the enclosing TRY with the exception it replaced kept as its cause (up to EXC_MAX_CAUSES deep).
+ * 8- THROW stores the native stacktrace it was thrown from (raw return addresses, up to exclib_set_backtrace_depth of them, see EXCLIB_BACKTRACE), and reports print it until the exception is handled. A TRY that nothing is thrown into never takes one.
+ * 9- Each member of the exception stack is the size of the context (see EXCLIB_CONTEXT) plus 16 bytes hot and ~512 bytes cold, most of that room for a THROWF message and a rethrow's causes (EXC_MESSAGE_ARGS, EXC_MESSAGE_TEXT, EXC_MAX_CAUSES). Only the EXC_INLINE_FRAMES inline frames (8 by default, ~6kB with the setjmp context) are paid for up front on every thread; most programs won't need more, because this only tracks where TRY/THROW have been used, and each TRY/THROW pair use only one entry. Stacktraces aren't stored here, so this doesn't limit the possible size of a stacktrace.
+ * 10- Exception names live in a registry that maps any int (negative errno-style codes and large vendor codes included) to a name and a signal. It's a hash table sized to the codes you actually register, ~2 pointers per code, and a lookup on THROW is O(1) with no lock. Register your codes at startup, before threads start throwing; exclib_bulk_name_exceptions does a whole table in one pass. The same registry holds the class hierarchy for CATCH_CLASS, with each class's ancestors worked out into a bitmask as it's registered, so matching is a couple of lookups and a bit test at any depth (up to EXC_MAX_CLASSES parent codes).
+ *    Every throw, catch, propagation to a parent frame and uncaught exception is also counted per code and per TRY/THROW site (see exclib_stats_snapshot). Counters are per-thread, so counting takes no lock and no atomic instruction; exclib_stats_enable(0) turns them off at run time and -DEXCLIB_STATS=0 compiles them out of the library.
+ *    The same events are static tracepoints too (see EXCLIB_USDT), for bpftrace or perf to count and time in a running program; each is a nop until something attaches.
+ * 11- When an uncaught exception rises to the top, the signal registered for its code is raised (see exclib_name_exception_signal and the signal field of struct exclib_name_data). Codes with no signal, or whose signal handler returns, exit() with the exception value.
+ *    Hardware faults aren't exceptions unless you ask: exclib_translate_faults() turns SIGSEGV, SIGBUS and SIGFPE inside a TRY into EXC_NULLPOINTER, EXC_BUSERROR and EXC_ARITHMETIC (and running off the end of the stack into EXC_STACKOVERFLOW), with the faulting address as the payload, so hot loops can drop their THROW_ZERO pointer checks. Faults outside any TRY still crash the way they always did. The handler runs on a signal stack of EXC_FAULT_STACK_SIZE that every thread but the one that turned translation on has to set up with exclib_fault_thread_init(); a thread without one still gets everything but stack overflow. The handler takes no lock and allocates nothing: exclib_fault_thread_init() also makes the thread's counters, profiler histograms and flight recorder ring ready for its faults, so call it after exclib_translate_fault and exclib_recorder_open; whatever a fault would need that isn't ready yet (a code translated later, or a hop out of a TRY the profiler hasn't timed before) goes unrecorded. Only translate faults in your own code: one inside malloc or anything else holding a lock can't be recovered from.
  * 12- The underlying mechanism behind this is setjmp / longjmp, two "arcane and slightly dangerous" functions. Essentially this is used to treat your *entire* codebase as something we can GOTO between when there's an exception. I don't think it will, but if this does funny things to your code, I'm sorry.
+ *    Which setjmp/longjmp pair is used is picked at compile time with EXCLIB_CONTEXT (see below); the library and everything that includes this header must agree on it.
  * 13- You should limit your involvement with this library to the all-capital #defines. The functions themselves are undocumented and may change without warning, and they were never meant for human consumption anyways.
  * 14- There are exceptions to every rule, and the exception to #11 is that you can safely call "exclib_print_stacktrace", and that you MUST call "exclib_name_exception" if you want your exceptions to have pretty names in tracebacks, and not just numbers.
- * 15- I haven't tried it, but this should be safe for C++ as well. Beware of mangled symbols in tracebacks. (C++ already has exception handling, you shouldn't need this there, I'm just saying it should work.)
+ * 15- This works from C++ too, but a longjmp skips destructors. Define EXCLIB_CXX to 1 in C++ code and TRY becomes a native try/catch instead, free when nothing is thrown, with exceptions still crossing between C and C++ frames in either direction (see EXCLIB_CXX below). Beware of mangled symbols in tracebacks.
  * 16- It is impossible to THROW(0). A compile time error will occur complaining about duplicate case value. If by some miracle you do get it to compile, you will enter an infinite loop, as there is no exit path for this.
  * 17- These are done as defines for a reason; at the time of TRY/THROW, a lot of stack information is saved to show the user (via traceback) where the exception handling occured. And besides, setjmp/longjmp won't work if we use functions for this instead of defines, because the call stack will be different.
  *
@@ -62,7 +72,8 @@
  * without actually handling/modifying it, or to execute some generic action on exception, regardless of what type, but only after
  * specific exceptions have been handled. Beware, however, that FINALLY is executed AFTER CATCH blocks, therefore one of the CATCH blocks
  * may have transferred control outside of the TRY {} statement, meaning that the FINALLY {} clause never actually gets executed.
- * Cleaning up resources should be done in CLEANUP, not FINALLY.
+ * Cleaning up resources should be done in CLEANUP, not FINALLY. A function whose TRY is only there for its CLEANUP can
+ * use EXCLIB_DEFER instead, and leave it to the caller's TRY (see below).
  *
  * THROW_ZERO is a convenience function to replace blocks like this:
  *
@@ -99,6 +110,26 @@
  * does not provide a break in the flow between the previous case and the current one, so fallthrough is achieved. Just make
  * sure to use a CATCH on any proceeding exceptions that don't need to fall through (like the EXC_NULLPOINTER above).
  *
+ * Codes can also be grouped into classes, and caught a whole class at a time with CATCH_CLASS:
+ *
+ * exclib_class_range(1000, 1999, EXC_IO_ERROR);
+ * exclib_class_exception(EXC_IO_TIMEOUT, EXC_IO_ERROR);
+ *
+ * TRY {
+ *    ...
+ * } EXCEPT {
+ * } CATCH (EXC_NULLPOINTER) {
+ *    ...
+ * } CATCH_CLASS (EXC_IO_ERROR) {
+ *    ... anything from 1000 to 1999, EXC_IO_TIMEOUT, anything under EXC_IO_TIMEOUT, and EXC_IO_ERROR itself
+ * } DEFAULT {
+ * } FINALLY {
+ * } ETRY;
+ *
+ * A CATCH_CLASS matches its class and everything under it, however deep, in the same time; the first handler that
+ * matches wins, in the order they're written, so list narrower classes before wider ones. A CATCH written after
+ * a CATCH_CLASS only sees exceptions that none of the handlers before it took, and DEFAULT has to come last.
+ *
  * You MUST use TRY / EXCEPT / FINALLY / ETRY. This is the minimal form:
  *
  * TRY {
@@ -113,74 +144,613 @@
 #define EXC_STRBUF_SIZE    256
 #endif 
 
+/* size of the on-stack buffer an exception report is built in; bigger reports take more than one write */
+#ifndef EXC_REPORT_BUFSIZE
+#define EXC_REPORT_BUFSIZE  4096
+#endif /* EXC_REPORT_BUFSIZE */
+
+/* how many distinct (code, site) pairs the reporting policy tells apart; a power of 2 */
+#ifndef EXC_REPORT_KEYS
+#define EXC_REPORT_KEYS     256
+#endif /* EXC_REPORT_KEYS */
+
+/* the flight recorder's defaults (see exclib_recorder_open): rings, one per thread, and records in each */
+#ifndef EXC_RECORDER_RINGS
+#define EXC_RECORDER_RINGS  64
+#endif /* EXC_RECORDER_RINGS */
+
+#ifndef EXC_RECORDER_RECORDS
+#define EXC_RECORDER_RECORDS 1024
+#endif /* EXC_RECORDER_RECORDS */
+
+/* per-thread exception counters (see exclib_stats_snapshot); build the library with -DEXCLIB_STATS=0 to compile them out */
+#ifndef EXCLIB_STATS
+#define EXCLIB_STATS        1
+#endif /* EXCLIB_STATS */
+
 #ifndef EXC_MAX_FRAMES
-#define EXC_MAX_FRAMES      50
+#define EXC_MAX_FRAMES      1024
 #endif /* EXC_MAX_FRAMES */
 
-#ifndef EXC_MAX_EXCEPTIONS
-#define EXC_MAX_EXCEPTIONS  4096
-#endif /* EXC_MAX_EXCEPTIONS */
+#ifndef EXC_INLINE_FRAMES
+#define EXC_INLINE_FRAMES   8
+#endif /* EXC_INLINE_FRAMES */
+
+#ifndef EXC_FRAME_CHUNK
+#define EXC_FRAME_CHUNK     32
+#endif /* EXC_FRAME_CHUNK */
+
+/* how many arguments a THROWF message keeps, and room for copies of its %s strings */
+#ifndef EXC_MESSAGE_ARGS
+#define EXC_MESSAGE_ARGS    4
+#endif /* EXC_MESSAGE_ARGS */
+
+#ifndef EXC_MESSAGE_TEXT
+#define EXC_MESSAGE_TEXT    32
+#endif /* EXC_MESSAGE_TEXT */
+
+/* how many earlier exceptions a rethrow keeps as its "caused by" chain */
+#ifndef EXC_MAX_CAUSES
+#define EXC_MAX_CAUSES      3
+#endif /* EXC_MAX_CAUSES */
+
+/* how many EXCLIB_DEFER actions each thread (and each exclib_context) can have waiting */
+#ifndef EXC_MAX_DEFERS
+#define EXC_MAX_DEFERS      64
+#endif /* EXC_MAX_DEFERS */
+
+/* the size of the chunks exclib_arena_alloc hands memory out of (bigger requests get a chunk their size) */
+#ifndef EXC_ARENA_CHUNK
+#define EXC_ARENA_CHUNK     65536
+#endif /* EXC_ARENA_CHUNK */
+
+/* how many codes can be the parent of another (see exclib_class_exception) */
+#ifndef EXC_MAX_CLASSES
+#define EXC_MAX_CLASSES     64
+#endif /* EXC_MAX_CLASSES */
+
+/* the signal stack exclib_fault_thread_init gives each thread, for translating faults (stack overflow included) */
+#ifndef EXC_FAULT_STACK_SIZE
+#define EXC_FAULT_STACK_SIZE (64 * 1024)
+#endif /* EXC_FAULT_STACK_SIZE */
+
+/*
+ * EXCLIB_CONTEXT picks how TRY saves its context and how THROW gets back to it:
+ *
+ * EXCLIB_CONTEXT_SETJMP    - setjmp/longjmp from libc. Portable, and the default.
+ * EXCLIB_CONTEXT_SIGSETJMP - sigsetjmp(buf, 0)/siglongjmp. Never touches the signal mask. Needs _POSIX_C_SOURCE.
+ * EXCLIB_CONTEXT_BUILTIN   - __builtin_setjmp/__builtin_longjmp (gcc, clang). 5 words; the compiler spills the
+ *                            callee-saved registers itself, but only in functions that contain a TRY.
+ * EXCLIB_CONTEXT_ASM       - exclib's own save/restore (x86-64 SysV, aarch64). Saves only the callee-saved
+ *                            registers, SP and PC: 8 words on x86-64, 21 on aarch64, against ~25 for glibc's jmp_buf.
+ *
+ * BUILTIN and ASM fall back to SETJMP on compilers/architectures they don't support.
+ */
+#define EXCLIB_CONTEXT_SETJMP     0
+#define EXCLIB_CONTEXT_SIGSETJMP  1
+#define EXCLIB_CONTEXT_BUILTIN    2
+#define EXCLIB_CONTEXT_ASM        3
+
+#ifndef EXCLIB_CONTEXT
+#define EXCLIB_CONTEXT EXCLIB_CONTEXT_SETJMP
+#endif /* EXCLIB_CONTEXT */
+
+#if EXCLIB_CONTEXT == EXCLIB_CONTEXT_BUILTIN && !defined(__GNUC__)
+#undef EXCLIB_CONTEXT
+#define EXCLIB_CONTEXT EXCLIB_CONTEXT_SETJMP
+#endif
+#if EXCLIB_CONTEXT == EXCLIB_CONTEXT_ASM && !(defined(__GNUC__) && ((defined(__x86_64__) && !defined(_WIN32)) || defined(__aarch64__)))
+#undef EXCLIB_CONTEXT
+#define EXCLIB_CONTEXT EXCLIB_CONTEXT_SETJMP
+#endif
+
+#if EXCLIB_CONTEXT == EXCLIB_CONTEXT_SIGSETJMP
+typedef sigjmp_buf exclib_jmp_buf;
+#define EXCLIB_SETJMP(b)     sigsetjmp(b, 0)
+#define EXCLIB_LONGJMP(b, v) siglongjmp(b, v)
+#elif EXCLIB_CONTEXT == EXCLIB_CONTEXT_BUILTIN
+/* __builtin_longjmp may not be used in the function that did the __builtin_setjmp, so it goes through exclib_longjmp */
+typedef void *exclib_jmp_buf[5];
+#define EXCLIB_SETJMP(b)     __builtin_setjmp(b)
+#define EXCLIB_LONGJMP(b, v) exclib_longjmp(b, v)
+extern void exclib_longjmp(exclib_jmp_buf buf, int value) __attribute__((noreturn));
+#elif EXCLIB_CONTEXT == EXCLIB_CONTEXT_ASM
+#if defined(__x86_64__)
+typedef unsigned long exclib_jmp_buf[8];
+#else
+typedef unsigned long exclib_jmp_buf[21];
+#endif
+#define EXCLIB_SETJMP(b)     exclib_setjmp(b)
+#define EXCLIB_LONGJMP(b, v) exclib_longjmp(b, v)
+extern int exclib_setjmp(exclib_jmp_buf buf) __attribute__((returns_twice));
+extern void exclib_longjmp(exclib_jmp_buf buf, int value) __attribute__((noreturn));
+#else
+typedef jmp_buf exclib_jmp_buf;
+#define EXCLIB_SETJMP(b)     setjmp(b)
+#define EXCLIB_LONGJMP(b, v) longjmp(b, v)
+#endif
+
+#ifndef EXCLIB_TLS
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define EXCLIB_TLS _Thread_local
+#elif defined(__GNUC__)
+#define EXCLIB_TLS __thread
+#elif defined(_MSC_VER)
+#define EXCLIB_TLS __declspec(thread)
+#else
+#error "exclib needs thread-local storage; define EXCLIB_TLS for your compiler"
+#endif
+#endif /* EXCLIB_TLS */
+
+/*
+ * EXCLIB_BACKTRACE picks how THROW records the native call stack it was thrown
+ * from. Only THROW does this; a TRY that nothing is thrown into never pays for it.
+ *
+ * EXCLIB_BACKTRACE_NONE    - don't.
+ * EXCLIB_BACKTRACE_FP      - walk the frame pointer chain, a couple of ns a frame. The default with gcc/clang,
+ *                            and the Makefile builds with -fno-omit-frame-pointer to match; the walk stops at
+ *                            the first frame of code built without them (or at the top of the thread's stack).
+ * EXCLIB_BACKTRACE_UNWIND  - _Unwind_Backtrace from libgcc, driven by .eh_frame. Sees through any code, but costs
+ *                            microseconds a throw; for when exceptions really are exceptional.
+ *
+ * Either way the return addresses go into a per-thread buffer of EXC_BACKTRACE_MAX entries (nothing is
+ * malloc'd), exclib_set_backtrace_depth limits how many are taken (0 turns capture off), and nothing is
+ * symbolized until the trace is printed; see exclib_print_backtrace and exclib_dump_load_map. This is the
+ * library's choice, like EXCLIB_CONTEXT; build it with the one you want.
+ */
+#define EXCLIB_BACKTRACE_NONE     0
+#define EXCLIB_BACKTRACE_FP       1
+#define EXCLIB_BACKTRACE_UNWIND   2
+
+#ifndef EXCLIB_BACKTRACE
+#if defined(__GNUC__)
+#define EXCLIB_BACKTRACE EXCLIB_BACKTRACE_FP
+#else
+#define EXCLIB_BACKTRACE EXCLIB_BACKTRACE_NONE
+#endif
+#endif /* EXCLIB_BACKTRACE */
+
+#ifndef EXC_BACKTRACE_MAX
+#define EXC_BACKTRACE_MAX   128
+#endif /* EXC_BACKTRACE_MAX */
+
+/* how many frames a THROW captures until exclib_set_backtrace_depth says otherwise */
+#ifndef EXC_BACKTRACE_DEPTH
+#define EXC_BACKTRACE_DEPTH 32
+#endif /* EXC_BACKTRACE_DEPTH */
+
+/*
+ * EXCLIB_INLINE: define it to 1 and the frame push in TRY and the pop in ETRY
+ * are inlined from this header (exclib_push_frame, exclib_pop_frame) instead
+ * of being calls into the library. Pushing a frame is then a bounds check and
+ * four stores, and popping one that nothing was thrown into a flags test and
+ * two stores, for the compiler to schedule around the context save. Anything
+ * else (a frame past the EXC_INLINE_FRAMES built into each thread, an
+ * exception to propagate or report, EXCLIB_DEFER actions to run) still goes
+ * to the library. EXCLIB_DEFER is inlined the same way. Frames look
+ * the same either way, so this can differ from one file to the next.
+ */
+#ifndef EXCLIB_INLINE
+#define EXCLIB_INLINE 0
+#endif /* EXCLIB_INLINE */
+
+#if EXCLIB_INLINE
+#define EXCLIB_PUSH_FRAME(site) exclib_push_frame(site)
+#define EXCLIB_POP_FRAME()      exclib_pop_frame()
+#else
+#define EXCLIB_PUSH_FRAME(site) exclib_new_exc_frame(site)
+#define EXCLIB_POP_FRAME()      exclib_clear_exc_frame()
+#endif /* EXCLIB_INLINE */
+
+/*
+ * EXCLIB_USDT: static tracepoints (USDT, as sys/sdt.h makes them) for
+ * tracers to attach to without a rebuild, under the provider "exclib":
+ *
+ * exclib:try        site, depth                     a TRY (any kind) pushed frame depth
+ * exclib:throw      code, site, depth, description  an exception was thrown from site, in frame depth
+ * exclib:catch      code, site, depth               a CATCH, CATCH_CLASS or DEFAULT of the TRY at site took it
+ * exclib:propagate  code, site, depth               it left frame depth, the TRY at site, for the frame above
+ * exclib:uncaught   code, site, depth, description  nothing took it, and the process is about to go down
+ *
+ * code and depth are ints, description a char * that can be NULL, and site a
+ * struct exclib_site * (file and function names at +0 and +8, line at +16, on
+ * 64-bit). Each probe is one nop where it fires and a note in .note.stapsdt
+ * saying where its arguments are; nothing else runs until a tracer attaches.
+ * See tools/ for bpftrace and perf examples and make check-probes. On by
+ * default with GCC or clang on x86_64 Linux; define it to 0 for none.
+ */
+#ifndef EXCLIB_USDT
+#if defined(__GNUC__) && defined(__linux__) && defined(__x86_64__)
+#define EXCLIB_USDT 1
+#else
+#define EXCLIB_USDT 0
+#endif
+#endif /* EXCLIB_USDT */
+
+#if EXCLIB_USDT
+/* the note sys/sdt.h writes (version 3): the nop's address, then provider, name and argument formats */
+#define EXCLIB_PROBE_ASM(name, args) \
+  "990: nop\n" \
+  ".pushsection .note.stapsdt,\"?\",\"note\"\n" \
+  ".balign 4\n" \
+  ".4byte 992f-991f, 994f-993f, 3\n" \
+  "991: .asciz \"stapsdt\"\n" \
+  "992: .balign 4\n" \
+  "993: .8byte 990b\n" \
+  ".8byte _.stapsdt.base\n" \
+  ".8byte 0\n" \
+  ".asciz \"exclib\"\n" \
+  ".asciz \"" #name "\"\n" \
+  ".asciz \"" args "\"\n" \
+  "994: .balign 4\n" \
+  ".popsection\n" \
+  ".ifndef _.stapsdt.base\n" \
+  ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+  ".weak _.stapsdt.base\n" \
+  ".hidden _.stapsdt.base\n" \
+  "_.stapsdt.base: .space 1\n" \
+  ".size _.stapsdt.base, 1\n" \
+  ".popsection\n" \
+  ".endif\n"
+#define EXCLIB_PROBE_TRY(site, depth) \
+  __asm__ __volatile__ (EXCLIB_PROBE_ASM(try, "8@%0 -4@%1") : : "nor" (site), "nor" (depth))
+#define EXCLIB_PROBE_EXC(name, code, site, depth) \
+  __asm__ __volatile__ (EXCLIB_PROBE_ASM(name, "-4@%0 8@%1 -4@%2") : : "nor" (code), "nor" (site), "nor" (depth))
+#define EXCLIB_PROBE_EXC_DESC(name, code, site, depth, desc) \
+  __asm__ __volatile__ (EXCLIB_PROBE_ASM(name, "-4@%0 8@%1 -4@%2 8@%3") : : "nor" (code), "nor" (site), "nor" (depth), "nor" (desc))
+/* once per exception: a CATCH_GROUP falls through into the handlers after it */
+#define EXCLIB_PROBE_CATCH() \
+  do { \
+    if ( !(EXCLIB_EXCEPTION->flags & EXCLIB_F_CAUGHT) ) \
+      EXCLIB_PROBE_EXC(catch, EXCLIB_EXCEPTION->value, EXCLIB_EXCEPTION->site, __exclib_curidx - 1); \
+  } while (0)
+#else
+#define EXCLIB_PROBE_TRY(site, depth)
+#define EXCLIB_PROBE_EXC(name, code, site, depth)
+#define EXCLIB_PROBE_EXC_DESC(name, code, site, depth, desc)
+#define EXCLIB_PROBE_CATCH() do { } while (0)
+#endif /* EXCLIB_USDT */
+
+/*
+ * EXCLIB_CXX, for C++ translation units only: define it to 1 before including
+ * this header and TRY/CLEANUP/EXCEPT become a native try/catch of an
+ * exclib::exception (see the end of this file) instead of a setjmp. A TRY
+ * that nothing is thrown into then costs pushing and popping its frame and
+ * nothing else, destructors run as the exception unwinds, and a return out of
+ * the TRY block pops the frame. CATCH, CATCH_GROUP, DEFAULT, FINALLY, ETRY and
+ * EXCLIB_EXCEPTION work exactly as they do in C.
+ *
+ * The frames still go on the same per-thread stack as C's, so exceptions
+ * cross between the two either way: a THROW (from C or C++) into a C++ TRY is
+ * thrown as an exclib::exception, and one into a C TRY is a longjmp as always.
+ * That longjmp skips the destructors of any C++ frames between the two, so
+ * put a C++ TRY at the edge of C++ code that C calls into. A plain
+ * throw exclib::exception(code, description) is caught by the innermost C++
+ * TRY like a THROW would be. The library itself is C either way; it's built
+ * with -fexceptions so C++ exceptions unwind through it. Don't break or
+ * continue out of a C++ TRY block; it's a loop.
+ */
+#ifndef EXCLIB_CXX
+#define EXCLIB_CXX 0
+#endif /* EXCLIB_CXX */
+
+#if defined(__cplusplus) && EXCLIB_CXX
 
 #define TRY \
-if (__exclib_curidx >= EXC_MAX_FRAMES) \
-    exclib_print_exception_stack("No available exception stack context", __FILE__, (char *)__func__, __LINE__); \
-if ( exclib_new_exc_frame(&__exclib_statuses[__exclib_curidx++], __FILE__, (char *)__func__, __LINE__) != 0) \
-    exclib_print_exception_stack("Tried to TRY but couldn't create new exception frame", __FILE__, (char *)__func__, __LINE__); \
- EXCLIB_EXCEPTION->setjmpstatus = setjmp(EXCLIB_EXCEPTION->buf);	\
-EXCLIB_EXCEPTION->tried = 1; \
+{ \
+EXCLIB_SITE(__exclib_try_site, EXCLIB_SITE_TRY); \
+exclib::frame __exclib_frame(&__exclib_try_site); \
+for ( ; __exclib_frame.pass < 2; __exclib_frame.pass++ ) \
+  try { \
+    if ( __exclib_frame.pass == 0 )
+
+/* a C++ TRY costs nothing until something is thrown, so there's nothing for TRY_FOR to skip */
+#define TRY_FOR(handles) TRY
+
+#define CLEANUP else
 
-#define CLEANUP 
-  
 #define EXCEPT \
-  if ( EXCLIB_EXCEPTION && EXCLIB_EXCEPTION->setjmpstatus != 0 ) {	\
+  } catch ( exclib::exception &__exclib_e ) { \
+    if ( !__exclib_frame.take(__exclib_e) ) \
+      throw; \
+  } \
+  EXCLIB_EXCEPT
+
+#else
+
+#define TRY \
+{ \
+EXCLIB_SITE(__exclib_try_site, EXCLIB_SITE_TRY); \
+EXCLIB_PUSH_FRAME(&__exclib_try_site); \
+if ( EXCLIB_SETJMP(EXCLIB_EXCEPTION->buf) == 0 )
+
+#define TRY_FOR(handles) \
+{ \
+static const struct exclib_site __exclib_try_site EXCLIB_SITE_SECTION = { __FILE__, __func__, __LINE__, EXCLIB_SITE_TRY, handles }; \
+EXCLIB_PUSH_FRAME(&__exclib_try_site); \
+EXCLIB_EXCEPTION->flags |= EXCLIB_F_FILTERED; \
+if ( EXCLIB_SETJMP(EXCLIB_EXCEPTION->buf) == 0 )
+
+#define CLEANUP 
+
+#define EXCEPT EXCLIB_EXCEPT
+
+#endif /* EXCLIB_CXX */
+
+#define EXCLIB_EXCEPT \
+  if ( EXCLIB_EXCEPTION && (EXCLIB_EXCEPTION->flags & EXCLIB_F_UNWOUND) ) {	\
     switch( EXCLIB_EXCEPTION->value ) { \
         case 0:
 
 #define CATCH(x) \
             break; \
         case x: \
-            EXCLIB_EXCEPTION->caught = 1; \
-	    EXCLIB_EXCEPTION->catching = 1;
+            EXCLIB_PROBE_CATCH(); \
+            EXCLIB_PROFILE_CATCH(); \
+            EXCLIB_EXCEPTION->flags |= EXCLIB_F_CAUGHT | EXCLIB_F_CATCHING;
 
 #define CATCH_GROUP(x) \
         case x: \
-            EXCLIB_EXCEPTION->caught = 1; \
-	    EXCLIB_EXCEPTION->catching = 1;
+            EXCLIB_PROBE_CATCH(); \
+            EXCLIB_PROFILE_CATCH(); \
+            EXCLIB_EXCEPTION->flags |= EXCLIB_F_CAUGHT | EXCLIB_F_CATCHING;
+
+/* 0 is never thrown, so case 0 of a switch on (is it in the class ? 0 : the code) is the match */
+#define CATCH_CLASS(x) \
+            break; \
+    } \
+    if ( !(EXCLIB_EXCEPTION->flags & EXCLIB_F_CAUGHT) ) \
+    switch ( exclib_exception_is(EXCLIB_EXCEPTION->value, x) ? 0 : EXCLIB_EXCEPTION->value ) { \
+        case 0: \
+            EXCLIB_PROBE_CATCH(); \
+            EXCLIB_PROFILE_CATCH(); \
+            EXCLIB_EXCEPTION->flags |= EXCLIB_F_CAUGHT | EXCLIB_F_CATCHING;
 
 #define DEFAULT \
             break; \
         default: \
-            EXCLIB_EXCEPTION->caught = 1; \
-            EXCLIB_EXCEPTION->catching = 1;
+            EXCLIB_PROBE_CATCH(); \
+            EXCLIB_PROFILE_CATCH(); \
+            EXCLIB_EXCEPTION->flags |= EXCLIB_F_CAUGHT | EXCLIB_F_CATCHING;
 
 #define FINALLY \
     }; \
 
 #define ETRY \
 }; \
-exclib_clear_exc_frame(); \
-__exclib_curidx--;
+EXCLIB_POP_FRAME(); \
+}
+
+
+/*
+ * TRY_BATCH runs its block once for each i from 0 to n-1 under a single
+ * frame, armed once for the whole batch rather than once per item. An item
+ * that throws (and doesn't catch it itself) gets the exception's code and
+ * description in results[i]; the frame is re-armed and the batch goes on
+ * with item i+1. Items that finish get a value of 0.
+ *
+ * volatile int i;
+ * struct exclib_batch_result results[100];
+ *
+ * TRY_BATCH (i, 100, results) {
+ *    ingest(&records[i]);
+ * } ETRY_BATCH;
+ *
+ * i is changed between the setjmp and a THROW, so it has to be a volatile
+ * int, and n is evaluated more than once. Like TRY, don't break, goto or
+ * return out of the block. exclib_try_batch does the same for a function.
+ */
+#define TRY_BATCH(i, n, results) \
+{ \
+EXCLIB_SITE(__exclib_try_site, EXCLIB_SITE_TRY); \
+volatile int *__exclib_batch_i = &(i); \
+struct exclib_batch_result *__exclib_batch_results = (results); \
+EXCLIB_PUSH_FRAME(&__exclib_try_site); \
+for ( (i) = 0; (i) < (n); ) { \
+    if ( EXCLIB_SETJMP(EXCLIB_EXCEPTION->buf) == 0 ) { \
+        for ( ; (i) < (n); (i)++ ) { \
+            (results)[i].value = 0; \
+            (results)[i].description = NULL;
+
+#define ETRY_BATCH \
+        } \
+    } else { \
+        exclib_batch_failed(&__exclib_batch_results[*__exclib_batch_i]); \
+        (*__exclib_batch_i)++; \
+    } \
+} \
+EXCLIB_POP_FRAME(); \
+}
+
+/*
+ * TRY_FOR is a TRY that says up front which codes (or classes, see
+ * CATCH_CLASS) its handlers take, as a static array ending in 0:
+ *
+ * static const int io_errors[] = { EXC_IO_ERROR, EXC_TIMEOUT, 0 };
+ *
+ * TRY_FOR (io_errors) {
+ *    EXCLIB_ON_UNWIND(close_file, fp);
+ *    ...
+ * } EXCEPT {
+ * } CATCH_CLASS (EXC_IO_ERROR) {
+ * } CATCH (EXC_TIMEOUT) {
+ * } FINALLY {
+ * } ETRY;
+ *
+ * Anything else thrown from inside it goes straight to the nearest enclosing
+ * TRY that might want it, in one longjmp, instead of stopping here to find
+ * out there's no CATCH for it and being thrown again from ETRY. So for those
+ * exceptions this frame's CLEANUP, EXCEPT and FINALLY blocks don't run; what
+ * does is the one EXCLIB_ON_UNWIND action given inside its block, if any.
+ * The outermost TRY is always stopped at, so an uncaught exception is still
+ * reported from there.
+ */
+#define EXCLIB_ON_UNWIND(fn, arg) exclib_on_unwind(fn, arg)
 
+/*
+ * EXCLIB_DEFER(fn, arg) leaves fn(arg) for the innermost TRY to run when it's
+ * done with: at its ETRY, after its handlers, or when an exception leaves it
+ * some other way (goes past a TRY_FOR, or is thrown from a CATCH). Actions
+ * run last in, first out, so a function can defer freeing what it allocates
+ * and need no TRY of its own:
+ *
+ * static void parse(const char *path)
+ * {
+ *    FILE *fp = fopen(path, "r");
+ *
+ *    THROW_ZERO(fp, EXC_IO_ERROR, "can't open");
+ *    EXCLIB_DEFER(close_file, fp);
+ *    ...
+ * }
+ *
+ * The actions go on a stack of EXC_MAX_DEFERS built into each thread (and
+ * each exclib_context), so deferring one is a few stores and never allocates;
+ * with EXCLIB_INLINE it doesn't even make a call. Past EXC_MAX_DEFERS it
+ * throws EXC_OUTOFDEFERS, with fn not deferred. Outside any TRY there's
+ * nothing to run it, so it's not deferred either and EXCLIB_DEFER gives -1;
+ * otherwise 0. An action must return normally: don't THROW out of one.
+ */
+#if EXCLIB_INLINE
+#define EXCLIB_DEFER(fn, arg) exclib_push_defer(fn, arg)
+#else
+#define EXCLIB_DEFER(fn, arg) exclib_defer(fn, arg)
+#endif /* EXCLIB_INLINE */
 
+/*
+ * exclib_arena_alloc(size) is malloc for memory that only needs to last as
+ * long as the innermost TRY: it's all given back at once at that TRY's ETRY,
+ * after its handlers, or as an exception leaves it, so nothing a THROW jumps
+ * past leaks and nothing needs a CLEANUP to free it:
+ *
+ * static struct request *parse(const char *line)
+ * {
+ *    struct request *req = exclib_arena_alloc(sizeof(*req));
+ *
+ *    req->path = exclib_arena_alloc(strlen(line) + 1);
+ *    THROW_ZERO(sscanf(line, "GET %s", req->path), EXC_PARSE, "not a GET");
+ *    ...
+ * }
+ *
+ * It's a bump pointer into EXC_ARENA_CHUNK chunks, one arena to each thread
+ * (and each exclib_context). A frame's first allocation marks where the
+ * arena was and defers going back there with EXCLIB_DEFER, so it takes one
+ * of the EXC_MAX_DEFERS and throws EXC_OUTOFDEFERS when there are none; the
+ * rest are only the bump. Chunks are kept, not freed, so once a thread has
+ * been as deep as it goes it doesn't malloc again; they're freed when it
+ * exits (or with exclib_context_destroy). Memory is aligned for any type.
+ * Outside any TRY, or out of memory, it gives NULL.
+ */
 #define THROW_NONZERO(x, y, z) if ( (x) != 0 ) { THROW(y, z); }
 #define THROW_ZERO(x, y, z) if ( (x) == 0 ) { THROW(y, z); }
 
 #define THROW(x, y) \
-  THROW_EXPLICIT(x, y, __FILE__, (char *)__func__, __LINE__, 1)
+  do { \
+    EXCLIB_SITE(__exclib_throw_site, EXCLIB_SITE_THROW); \
+    THROW_EXPLICIT(x, y, &__exclib_throw_site, 1) \
+  } while (0)
 
-#define THROW_EXPLICIT(x, y, file, func, line, setflag)	\
-  if ( EXCLIB_EXCEPTION && EXCLIB_EXCEPTION->setjmpstatus == 0 ) { \
-      exclib_prep_throw(x, y, file, func, line, setflag);			\
-      if ( EXCLIB_EXCEPTION->thrown > 0 ) {				\
-        longjmp(EXCLIB_EXCEPTION->buf, x);					\
+/* A THROW from a frame that's already handling an exception (its CLEANUP, CATCH or FINALLY) goes to the frame above, see exclib_throw */
+#if defined(__cplusplus) && EXCLIB_CXX
+/* the frame it lands in may be C's or C++'s, so it's always up to the library */
+#define THROW_EXPLICIT(x, y, site, setflag) \
+  exclib_throw(x, (char *)(y), site);
+#else
+#define THROW_EXPLICIT(x, y, site, setflag)	\
+  if ( !EXCLIB_EXCEPTION || !(EXCLIB_EXCEPTION->flags & (EXCLIB_F_UNWOUND | EXCLIB_F_FILTERED)) ) { \
+      exclib_prep_throw(x, y, site, setflag);				\
+      if ( EXCLIB_EXCEPTION->flags & EXCLIB_F_THROWN ) {			\
+        EXCLIB_LONGJMP(EXCLIB_EXCEPTION->buf, x);			\
       } else {								\
         sprintf((char *)&__exclib_strbuf, "Uncaught exception %d", x);	\
-        exclib_print_exception_stack((char *)&__exclib_strbuf, file, func, line); \
-        exit(x);								\
+        exclib_print_exception_stack((char *)&__exclib_strbuf, (char *)(site)->file, (char *)(site)->function, (site)->line); \
+        exclib_raise_uncaught(x);						\
       } \
-  }
+  } else \
+      exclib_throw(x, y, site);
+#endif /* EXCLIB_CXX */
+
+/*
+ * THROWF(x, fmt, ...) throws x with a printf-style message that isn't
+ * formatted until something prints it (a report, or EXCLIB_MESSAGE). THROW
+ * keeps the format and up to EXC_MESSAGE_ARGS arguments in the frame, a *
+ * width or precision counting as one; %s strings are copied (truncated to
+ * fit EXC_MESSAGE_TEXT between them), every other argument is kept by value.
+ * It understands this much of printf:
+ *   conversions  d i u x X o c s p, %%, and f F e E g G a A, which all print
+ *                as %f would; %n takes its pointer and prints nothing
+ *   flags        - and 0 (+, space and # are taken and ignored)
+ *   width        a number, or *
+ *   precision    .number or .*: the most of a %s to print, the fewest digits
+ *                of an integer, the decimals of a floating conversion (at
+ *                most 9)
+ *   length       hh h l ll z j t, and L for a long double; h and hh print
+ *                cut down to a short or a char, as printf does
+ * Anything else (%ls and %lc too) is reported where exclib_set_report_fd
+ * sends reports when it's thrown, and
+ * from it on the arguments aren't kept and print as "?". GCC checks the
+ * arguments against fmt as it would for printf.
+ *
+ * THROW_PAYLOAD(x, y, type, value) throws x with the usual description and one
+ * typed value, one of the EXCLIB_PAYLOAD_* below: an errno, a pointer, a size
+ * or an int. The handler reads it back from EXCLIB_PAYLOAD; reports print it.
+ */
+#define THROWF(x, ...) \
+  do { \
+    EXCLIB_SITE(__exclib_throw_site, EXCLIB_SITE_THROW); \
+    exclib_throwf(x, &__exclib_throw_site, __VA_ARGS__); \
+  } while (0)
+
+#define THROW_PAYLOAD(x, y, type, value) \
+  do { \
+    EXCLIB_SITE(__exclib_throw_site, EXCLIB_SITE_THROW); \
+    exclib_throw_payload(x, y, type, (unsigned long)(value), &__exclib_throw_site); \
+  } while (0)
+
+/* The current exception's message formatted into buf (its description if it has no THROWF message); returns its length */
+#define EXCLIB_MESSAGE(buf, size) \
+  exclib_format_message(&EXCLIB_EXCEPTION_INFO->msg, EXCLIB_EXCEPTION_INFO->description, buf, size)
+
+#define EXCLIB_PAYLOAD (&EXCLIB_EXCEPTION_INFO->payload)
+
+#define EXCLIB_TRACE(x) \
+  do { \
+    EXCLIB_SITE(__exclib_trace_site, EXCLIB_SITE_TRACE); \
+    exclib_trace(x, &__exclib_trace_site); \
+  } while (0)
+
+/*
+ * Every TRY and THROW emits one static const struct exclib_site describing
+ * itself, and the runtime only ever passes and stores a pointer to it. On ELF
+ * targets with gcc/clang the records are gathered into the exclib_sites
+ * section, which gives each one a dense ID that is stable for a given build
+ * (exclib_site_id; 0 means unknown), for per-site stats and tracing to key on.
+ */
+#define EXCLIB_SITE_TRY    1
+#define EXCLIB_SITE_THROW  2
+#define EXCLIB_SITE_TRACE  3
+
+struct exclib_site {
+  const char *file;
+  const char *function;
+  int line;
+  int kind;
+  const int *handles;       /* TRY_FOR's list of what the frame catches, else NULL */
+};
+
+#if defined(__GNUC__) && defined(__ELF__)
+#define EXCLIB_SITE_SECTION __attribute__((section("exclib_sites"), aligned(sizeof(void *)), used))
+#else
+#define EXCLIB_SITE_SECTION
+#endif
 
-#define EXCLIB_TRACE(x) exclib_print_exception_stack(x, __FILE__, (char *)__func__, __LINE__)
+#if defined(__GNUC__)
+#define EXCLIB_PRINTF(fmt, args) __attribute__((format(printf, fmt, args)))
+#else
+#define EXCLIB_PRINTF(fmt, args)
+#endif
+
+#define EXCLIB_SITE(name, kind) \
+  static const struct exclib_site name EXCLIB_SITE_SECTION = { __FILE__, __func__, __LINE__, kind, 0 }
 
 struct exclib_name_data {
     int exc;
@@ -191,39 +761,594 @@ struct exclib_name_data {
 #define EXC_NULLPOINTER             1
 #define EXC_OUTOFBOUNDS             2
 
-#define EXC_PREDEFINED_EXCEPTIONS   2
+/* Codes exclib throws itself live well away from anything a program is likely to pick */
+#define EXC_LIBRARY_BASE            0x45580000
+#define EXC_OUTOFFRAMES             (EXC_LIBRARY_BASE + 1)
+/* exclib_parallel_for: more than one iteration threw; they're its causes */
+#define EXC_PARALLEL                (EXC_LIBRARY_BASE + 2)
+/* faults exclib_translate_faults turns into exceptions, with the address as an EXCLIB_PAYLOAD_PTR */
+#define EXC_BUSERROR                (EXC_LIBRARY_BASE + 3)
+#define EXC_ARITHMETIC              (EXC_LIBRARY_BASE + 4)
+#define EXC_STACKOVERFLOW           (EXC_LIBRARY_BASE + 5)
+/* EXCLIB_DEFER with EXC_MAX_DEFERS actions already waiting */
+#define EXC_OUTOFDEFERS             (EXC_LIBRARY_BASE + 6)
+
+#define EXC_PREDEFINED_EXCEPTIONS   8
+
+/*
+ * A frame is split in two. struct exclib_status is the hot part that every TRY
+ * writes: the saved context, the exception value and a flags word. Its parent
+ * is simply the frame below it (exclib_frame_at(idx - 1)). struct exclib_frame_info
+ * is the cold part, kept alongside it (exclib_frame_info_at; EXCLIB_EXCEPTION_INFO is the
+ * current frame's), and is only written by THROW: where it was thrown from,
+ * and the name and description of what was thrown. exclib_frame_site gives
+ * the THROW site if the frame raised the exception itself, else its TRY site.
+ */
+#define EXCLIB_F_TRIED     0x01  /* the frame is set up and its TRY block was entered */
+#define EXCLIB_F_THROWN    0x02  /* an exception was thrown into this frame */
+#define EXCLIB_F_CAUGHT    0x04  /* a CATCH/CATCH_GROUP/DEFAULT matched it */
+#define EXCLIB_F_CATCHING  0x08  /* and that handler is running */
+#define EXCLIB_F_UNWOUND   0x10  /* control came back through the saved context; a THROW from here on goes to the parent */
+#define EXCLIB_F_RAISED    0x20  /* the THROW happened in this frame (not propagated into it) */
+#define EXCLIB_F_NATIVE    0x40  /* a C++ TRY (EXCLIB_CXX): exceptions get here by C++ throw, not longjmp */
+#define EXCLIB_F_FILTERED  0x80  /* a TRY_FOR: exceptions its site's handles don't match go straight past it */
+#define EXCLIB_F_ONUNWIND  0x100 /* and EXCLIB_ON_UNWIND gave it something to run when they do */
+#define EXCLIB_F_DEFERRED  0x200 /* EXCLIB_DEFER left actions for this frame to run as it's popped */
+
+#if defined(__GNUC__) && EXCLIB_CONTEXT == EXCLIB_CONTEXT_BUILTIN
+/* this is the backend whose hot frame fits a cache line, so make sure it never straddles two */
+#define EXCLIB_FRAME_ALIGN __attribute__((aligned(64)))
+#else
+#define EXCLIB_FRAME_ALIGN
+#endif
 
 struct exclib_status {
-  struct exclib_status *next;
-  struct exclib_status *prev;
-  jmp_buf buf;
-  int setjmpstatus;
+  exclib_jmp_buf buf;
   int value;
-  int caught;
-  int tried;
-  int catching;
-  int thrown;
-  char *file;
-  char *function;
-  int line;
+  unsigned int flags;
+  const struct exclib_site *site;
+} EXCLIB_FRAME_ALIGN;
+
+/* A THROWF message, formatted only when it's printed; see exclib_format_message */
+struct exclib_message {
+  const char *fmt;                  /* NULL when there's no message, just the description */
+  int nargs;
+  union {
+    long l;
+    unsigned long u;                /* for %s, where in text the copy starts */
+    double d;
+    const void *p;
+  } args[EXC_MESSAGE_ARGS];
+  char text[EXC_MESSAGE_TEXT];
+};
+
+#define EXCLIB_PAYLOAD_NONE   0
+#define EXCLIB_PAYLOAD_ERRNO  1
+#define EXCLIB_PAYLOAD_PTR    2
+#define EXCLIB_PAYLOAD_SIZE   3
+#define EXCLIB_PAYLOAD_INT    4
+
+struct exclib_payload {
+  int type;
+  unsigned long value;              /* cast back to what type says it is */
+};
+
+/* An exception a rethrow replaced; the newest cause comes first */
+struct exclib_cause {
+  int value;
+  const struct exclib_site *site;
   char *name;
   char *description;
+  struct exclib_message msg;
+  struct exclib_payload payload;
+};
+
+struct exclib_frame_info {
+  const struct exclib_site *site;
+  char *name;
+  char *description;
+  struct exclib_message msg;
+  struct exclib_payload payload;
+  int ncauses;
+  struct exclib_cause causes[EXC_MAX_CAUSES];
+  void (*unwind)(void *arg);        /* EXCLIB_ON_UNWIND's, when EXCLIB_F_ONUNWIND is set */
+  void *unwind_arg;
+};
+
+#define EXCLIB_EXCEPTION_INFO exclib_frame_info_at(__exclib_curidx - 1)
+
+/* An EXCLIB_DEFER action, waiting for frame idx to be popped */
+struct exclib_defer {
+  void (*fn)(void *arg);
+  void *arg;
+  int idx;
+};
+
+/* An exclib_context's exclib_arena_alloc memory; see src/arena.c */
+struct exclib_arena_chunk;
+
+struct exclib_arena {
+  struct exclib_arena_chunk *chunks;  /* every chunk it has, in the order they're used */
+  struct exclib_arena_chunk *cur;     /* the one being allocated from, NULL before the first */
+  size_t used;                        /* bytes of cur taken */
+  int depth;                          /* __exclib_curidx when the newest mark was made, 0 for none */
+  int context;                        /* 1 in an exclib_context_create's, whose chunks go with it */
+};
+
+/*
+ * An exception copied out of the frame that caught it, by
+ * exclib_exception_capture, to be thrown again with EXCLIB_RETHROW, from
+ * another thread if need be. It's plain data: copy it around as you like.
+ */
+struct exclib_captured {
+  struct exclib_cause exception;
+  int ncauses;
+  struct exclib_cause causes[EXC_MAX_CAUSES];
+};
+
+#define EXCLIB_RETHROW(captured) exclib_rethrow(&(captured))
+
+typedef void (*exclib_for_fn)(long i, void *arg);
+
+/* How one item of a TRY_BATCH or exclib_try_batch went: value is 0, or the code it threw */
+struct exclib_batch_result {
+  int value;
+  char *description;
+};
+
+typedef void (*exclib_batch_fn)(void *items, int i);
+
+/* A frame stack of its own, for a fiber; see exclib_context_switch */
+struct exclib_context;
+
+/*
+ * Telemetry. Every exception is counted by code and by site as it's thrown
+ * (at its THROW site), and again when a frame catches it, propagates it to
+ * its parent or lets it go uncaught (at that frame's TRY site).
+ * exclib_stats_snapshot sums every thread's counters into a struct exclib_stats
+ * the caller frees with exclib_stats_free; exclib_stats_dump prints one.
+ */
+#define EXCLIB_STAT_THROWN      0
+#define EXCLIB_STAT_CAUGHT      1
+#define EXCLIB_STAT_PROPAGATED  2
+#define EXCLIB_STAT_UNCAUGHT    3
+#define EXCLIB_STAT_EVENTS      4
+
+#define EXCLIB_STATS_TEXT       0
+#define EXCLIB_STATS_JSON       1
+
+struct exclib_code_stats {
+  int code;
+  unsigned long n[EXCLIB_STAT_EVENTS];
+};
+
+struct exclib_site_stats {
+  const struct exclib_site *site;
+  unsigned long n[EXCLIB_STAT_EVENTS];
+};
+
+struct exclib_stats {
+  unsigned long total[EXCLIB_STAT_EVENTS];
+  unsigned int ncodes;
+  struct exclib_code_stats *codes;    /* sorted by code */
+  unsigned int nsites;
+  struct exclib_site_stats *sites;    /* only sites with a nonzero count */
+};
+
+#if EXCLIB_STATS
+#define EXCLIB_STAT(event, code, site) exclib_stats_record(event, code, site)
+#else
+#define EXCLIB_STAT(event, code, site)
+#endif
+
+/*
+ * The flight recorder, for finding out afterwards what a process that died
+ * of an uncaught exception (or anything else) was throwing. Once
+ * exclib_recorder_open has made the file, or the EXCLIB_RECORDER environment
+ * variable named one at startup, every throw, catch, propagation and
+ * uncaught exception is written to it as a struct exclib_flight_record, into
+ * a ring of its thread's own. The file is mapped shared, so whatever was
+ * written is in it however the process ends; tools/exclib-dump prints it.
+ *
+ * The file is a struct exclib_flight_header, the TRY/THROW sites the program
+ * had (their file and function names and lines, for records' site IDs), and
+ * then the rings. A record costs a clock read and a few stores into memory
+ * only its thread writes: no lock and no system call. The clock is
+ * exclib_ticks (the TSC on x86); the header has what turns its ticks into
+ * time, and the first open in a process takes the 10ms exclib_ticks_hz
+ * spends measuring them. A thread takes a ring
+ * on its first record and gives it back when it exits; with none free, its
+ * records are only counted, in the header's dropped.
+ */
+#define EXCLIB_FLIGHT_MAGIC    "EXCLFLT"
+#define EXCLIB_FLIGHT_VERSION  1
+#define EXCLIB_FLIGHT_TEXT     16
+
+struct exclib_flight_header {
+  char magic[8];
+  unsigned int version;
+  unsigned int record_size;          /* sizeof(struct exclib_flight_record) */
+  unsigned int nrings;
+  unsigned int nrecords;             /* in each ring */
+  unsigned int nsites;
+  unsigned int sites_offset;         /* nsites of struct exclib_flight_site */
+  unsigned int strings_offset;       /* their names, NUL-terminated */
+  unsigned int rings_offset;         /* nrings of struct exclib_flight_ring, each followed by its records */
+  int pid;
+  unsigned int dropped;
+  unsigned long started;             /* CLOCK_REALTIME ns when the file was made */
+  unsigned long clock_base;          /* the records' clock then; a record was made at */
+  unsigned long clock_hz;            /* started + (clock - clock_base) / clock_hz seconds */
+};
+
+struct exclib_flight_site {
+  unsigned int file;                 /* offsets into the strings */
+  unsigned int function;
+  int line;
+  int kind;
+};
+
+struct exclib_flight_ring {
+  int owner;                         /* 1 while a thread has it */
+  int tid;                           /* the thread that has it, or last had it */
+  unsigned long head;                /* records ever written; the next goes in head % nrecords */
+  char pad[48];
 };
 
+struct exclib_flight_record {
+  unsigned long seq;                 /* head + 1 when written, 0 while being written */
+  unsigned long clock;               /* when it was made; see the header's clock_base */
+  unsigned long description;         /* the description's address in the process */
+  int tid;
+  int code;
+  int depth;                         /* the frame it happened in */
+  unsigned int site;                 /* site ID (exclib_site_id), 0 if unknown */
+  int line;                          /* the site's line, for when the ID is unknown */
+  unsigned char event;               /* EXCLIB_STAT_THROWN and so on */
+  unsigned char pad[3];
+  char text[EXCLIB_FLIGHT_TEXT];     /* the start of the description, on a throw */
+};
+
+extern int __exclib_recorder_on;
+
+#define EXCLIB_RECORD(event, code, site, depth, description) \
+  do { \
+    if ( __exclib_recorder_on ) \
+      exclib_record(event, code, site, depth, description); \
+  } while (0)
+
+/*
+ * The profiler: how long the error path takes, for setting latency budgets
+ * on it. Once exclib_profile_enable(1) has turned it on (or the
+ * EXCLIB_PROFILE environment variable did at startup), each thread times,
+ * with exclib_ticks, every exception from its THROW to the CATCH that takes
+ * it, and every hop it makes propagating out of a TRY, from the throw or the
+ * hop before. The times go into log-linear histograms (EXCLIB_PROFILE_SUB
+ * buckets to each power of two ns, so within 1/EXCLIB_PROFILE_SUB of the
+ * real value) kept per thread and per TRY site: the catching TRY for
+ * "caught", the one propagated out of for "hop". It also keeps the most
+ * frames deep any thread has been.
+ *
+ * exclib_profile_snapshot sums every thread's histograms into a struct
+ * exclib_profile the caller frees with exclib_profile_free;
+ * exclib_profile_percentile reads one, exclib_profile_dump prints one and
+ * exclib_profile_dump_every prints one every so many seconds. Turned off,
+ * it's a load and a branch in TRY and nothing else.
+ */
+#define EXCLIB_PROFILE_SUB_BITS 3
+#define EXCLIB_PROFILE_SUB      (1 << EXCLIB_PROFILE_SUB_BITS)
+/* up to 2^40 ns (18 minutes); anything longer goes in the last bucket */
+#define EXCLIB_PROFILE_BUCKETS  ((40 - EXCLIB_PROFILE_SUB_BITS + 2) * EXCLIB_PROFILE_SUB)
+
+struct exclib_latency {
+  unsigned long n;
+  unsigned long max;                  /* ns */
+  unsigned long bucket[EXCLIB_PROFILE_BUCKETS];
+};
+
+struct exclib_site_profile {
+  const struct exclib_site *site;     /* a TRY */
+  struct exclib_latency caught;       /* throw to this TRY's CATCH */
+  struct exclib_latency hop;          /* propagating out of this TRY */
+};
+
+struct exclib_profile {
+  int max_depth;                      /* the most frames a thread has had at once */
+  struct exclib_latency caught;       /* every site's together */
+  struct exclib_latency hop;
+  unsigned int nsites;
+  struct exclib_site_profile *sites;  /* only sites with something in them */
+};
+
+extern int __exclib_profile_on;
+extern EXCLIB_TLS int __exclib_profile_depth;
+
+#define EXCLIB_PROFILE_TRY() \
+  do { \
+    if ( __exclib_profile_on && __exclib_curidx > __exclib_profile_depth ) \
+      exclib_profile_try(); \
+  } while (0)
+#define EXCLIB_PROFILE_THROW() \
+  do { \
+    if ( __exclib_profile_on ) \
+      exclib_profile_throw(); \
+  } while (0)
+#define EXCLIB_PROFILE_HOP(site) \
+  do { \
+    if ( __exclib_profile_on ) \
+      exclib_profile_hop(site); \
+  } while (0)
+/* like EXCLIB_PROBE_CATCH, once per exception */
+#define EXCLIB_PROFILE_CATCH() \
+  do { \
+    if ( __exclib_profile_on && !(EXCLIB_EXCEPTION->flags & EXCLIB_F_CAUGHT) ) \
+      exclib_profile_catch(EXCLIB_EXCEPTION->site); \
+  } while (0)
+
+/*
+ * A reporting policy for exception storms; see src/policy.c. Once one is set
+ * with exclib_set_report_policy, EXCLIB_TRACE and the uncaught reports are
+ * deduplicated per (code, site), sampled and rate limited, and what's held
+ * back is summed up in "suppressed N similar" lines. Any field left 0 turns
+ * that part off. NULL goes back to printing everything, the default.
+ */
+struct exclib_report_policy {
+  unsigned int window_ms;      /* per (code, site): after one report, hold the rest back this long... */
+  unsigned int sample_every;   /* ...except every Nth */
+  unsigned int rate;           /* reports a second, all keys together */
+  unsigned int burst;          /* and how many of those can go at once */
+  unsigned int summary_ms;     /* how often to print the suppressed counts */
+};
+
+/* exclib_set_report_format: one line per frame (the default), or the whole report on one line */
+#define EXCLIB_REPORT_LINES    0
+#define EXCLIB_REPORT_COMPACT  1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 extern struct exclib_name_data __exclib_exc_names[EXC_PREDEFINED_EXCEPTIONS];
-extern char *__exclib_names[EXC_MAX_EXCEPTIONS];
-extern int __exclib_curidx;
-extern struct exclib_status __exclib_statuses[EXC_MAX_FRAMES];
-extern int __exclib_rc;
-extern struct exclib_status *EXCLIB_EXCEPTION;
-extern char __exclib_strbuf[EXC_STRBUF_SIZE];
+extern EXCLIB_TLS int __exclib_curidx;
+extern EXCLIB_TLS struct exclib_status *__exclib_frames;
+extern EXCLIB_TLS struct exclib_frame_info *__exclib_frame_infos;
+extern EXCLIB_TLS int __exclib_throwidx;
+extern EXCLIB_TLS int __exclib_rc;
+extern EXCLIB_TLS struct exclib_status *EXCLIB_EXCEPTION;
+extern EXCLIB_TLS char __exclib_strbuf[EXC_STRBUF_SIZE];
+extern EXCLIB_TLS void *__exclib_backtrace[EXC_BACKTRACE_MAX];
+extern EXCLIB_TLS int __exclib_backtrace_len;
+extern EXCLIB_TLS struct exclib_defer *__exclib_defers;
+extern EXCLIB_TLS int __exclib_ndefers;
+extern EXCLIB_TLS struct exclib_arena *__exclib_arena;
+extern EXCLIB_TLS int __exclib_faulting;
 
 extern void exclib_init();
-extern void exclib_prep_throw(int value, char *msg, char *file, char *func, int line, int setflag);
-extern void exclib_name_exception(int value, char *name);
+extern void exclib_exception_capture(struct exclib_captured *out);
+extern void exclib_rethrow(const struct exclib_captured *captured);
+extern int exclib_translate_fault(int signal, int code);
+extern int exclib_translate_faults();
+extern int exclib_fault_thread_init();
+extern void exclib_parallel_for(long n, exclib_for_fn fn, void *arg, int nthreads);
+extern void exclib_on_unwind(void (*fn)(void *arg), void *arg);
+extern int exclib_defer(void (*fn)(void *arg), void *arg);
+extern void *exclib_arena_alloc(size_t size);
+extern void exclib_arena_destroy(struct exclib_arena *arena);
+extern int exclib_try_batch(exclib_batch_fn fn, void *items, int n, struct exclib_batch_result *results);
+extern void exclib_batch_failed(struct exclib_batch_result *result);
+extern struct exclib_context *exclib_context_create();
+extern void exclib_context_destroy(struct exclib_context *ctx);
+extern struct exclib_context *exclib_context_switch(struct exclib_context *ctx);
+extern void exclib_prep_throw(int value, char *msg, const struct exclib_site *site, int setflag);
+extern void exclib_init_registry();
+extern unsigned int exclib_code_hash(int code);
+extern void exclib_name_exception(int value, const char *name);
+extern void exclib_name_exception_signal(int value, const char *name, int signal);
 extern void exclib_bulk_name_exceptions(struct exclib_name_data *exclib_exc_names, int size);
+extern char *exclib_exception_name(int value);
+extern void exclib_class_exception(int value, int parent);
+extern void exclib_class_range(int lo, int hi, int parent);
+extern int exclib_exception_is(int value, int cls);
+extern int exclib_exception_parent(int value);
+extern int exclib_exception_signal(int value);
+extern void exclib_raise_uncaught(int value);
 extern void exclib_print_exception_stack(char *mbuf, char *file, char *func, int line);
-extern int exclib_new_exc_frame(struct exclib_status *es, char *file, char *function, int line);
+extern void exclib_set_report_format(int format);
+extern void exclib_set_report_fd(int fd);
+extern void exclib_set_report_policy(const struct exclib_report_policy *policy);
+extern int exclib_report_allowed(int code, const struct exclib_site *site);
+extern void exclib_report_flush_suppressed();
+extern void exclib_print_suppressed(int code, const struct exclib_site *site, unsigned long count);
+extern void exclib_print_bad_format(const struct exclib_site *site, const char *spec, int len, const char *fmt);
+extern void exclib_trace(char *msg, const struct exclib_site *site);
+extern void exclib_init_backtrace();
+extern void exclib_capture_backtrace(int skip);
+extern void exclib_set_backtrace_depth(int depth);
+extern void exclib_print_backtrace(FILE *out);
+extern void exclib_dump_load_map(int fd);
+extern void exclib_new_exc_frame(const struct exclib_site *site);
+extern struct exclib_status *exclib_frame_at(int idx);
+extern struct exclib_frame_info *exclib_frame_info_at(int idx);
+extern const struct exclib_site *exclib_frame_site(int idx);
+extern void exclib_throw(int value, char *msg, const struct exclib_site *site);
+extern void exclib_throwf(int value, const struct exclib_site *site, const char *fmt, ...) EXCLIB_PRINTF(3, 4);
+extern void exclib_throw_payload(int value, char *msg, int type, unsigned long data, const struct exclib_site *site);
+extern int exclib_format_message(const struct exclib_message *msg, const char *description, char *buf, int size);
+extern void exclib_stats_record(int event, int code, const struct exclib_site *site);
+extern void exclib_stats_prepare(int code);
+extern int exclib_recorder_open(const char *path, unsigned int nrings, unsigned int nrecords);
+extern void exclib_recorder_close();
+extern void exclib_record(int event, int code, const struct exclib_site *site, int depth, const char *description);
+extern void exclib_recorder_prepare();
+extern unsigned long exclib_ticks();
+extern unsigned long exclib_ticks_hz();
+extern unsigned long exclib_wall_ns();
+extern void exclib_profile_enable(int on);
+extern void exclib_profile_prepare();
+extern void exclib_profile_try();
+extern void exclib_profile_throw();
+extern void exclib_profile_hop(const struct exclib_site *site);
+extern void exclib_profile_catch(const struct exclib_site *site);
+extern struct exclib_profile *exclib_profile_snapshot();
+extern void exclib_profile_free(struct exclib_profile *profile);
+extern unsigned long exclib_profile_percentile(const struct exclib_latency *latency, double percent);
+extern void exclib_profile_dump(FILE *out, const struct exclib_profile *profile, int format);
+extern int exclib_profile_dump_every(FILE *out, unsigned int seconds, int format);
+extern void exclib_stats_enable(int on);
+extern struct exclib_stats *exclib_stats_snapshot();
+extern void exclib_stats_free(struct exclib_stats *stats);
+extern void exclib_stats_dump(FILE *out, const struct exclib_stats *stats, int format);
+extern void exclib_stats_json_str(FILE *out, const char *s);
+extern unsigned int exclib_site_id(const struct exclib_site *site);
+extern unsigned int exclib_site_count();
+extern const struct exclib_site *exclib_site_by_id(unsigned int id);
 extern int exclib_clear_exc_frame();
+extern void (*__exclib_native_throw)(int idx);
+extern void exclib_native_catch(int idx, int value, char *description);
+extern void exclib_native_pop(int idx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#if EXCLIB_INLINE
+
+#if defined(__cplusplus)
+#define EXCLIB_INLINE_FN static inline
+#elif defined(__GNUC__)
+#define EXCLIB_INLINE_FN static __inline__
+#else
+#define EXCLIB_INLINE_FN static
+#endif
+
+/* exclib_new_exc_frame for the frames built into the thread; see EXCLIB_INLINE */
+EXCLIB_INLINE_FN void exclib_push_frame(const struct exclib_site *site)
+{
+  struct exclib_status *es;
+
+  es = __exclib_frames;
+  if ( !es || __exclib_curidx >= EXC_INLINE_FRAMES ) {
+    exclib_new_exc_frame(site);
+    return;
+  }
+  es += __exclib_curidx++;
+  es->value = 0;
+  es->flags = EXCLIB_F_TRIED;
+  es->site = site;
+  EXCLIB_EXCEPTION = es;
+  EXCLIB_PROBE_TRY(site, __exclib_curidx - 1);
+  EXCLIB_PROFILE_TRY();
+}
+
+/* exclib_clear_exc_frame for a frame nothing was thrown into; the rest is left to it */
+EXCLIB_INLINE_FN void exclib_pop_frame(void)
+{
+  int idx = __exclib_curidx - 1;
+
+  if ( !EXCLIB_EXCEPTION || (EXCLIB_EXCEPTION->flags & (EXCLIB_F_THROWN | EXCLIB_F_DEFERRED)) || idx > EXC_INLINE_FRAMES ) {
+    exclib_clear_exc_frame();
+    return;
+  }
+  __exclib_curidx = idx;
+  EXCLIB_EXCEPTION = idx > 0 ? &__exclib_frames[idx - 1] : NULL;
+}
+
+/* exclib_defer while there's room; the rest (no TRY, a full stack) is left to it */
+EXCLIB_INLINE_FN int exclib_push_defer(void (*fn)(void *arg), void *arg)
+{
+  struct exclib_defer *d;
+
+  if ( !EXCLIB_EXCEPTION || __exclib_ndefers >= EXC_MAX_DEFERS )
+    return exclib_defer(fn, arg);
+  d = &__exclib_defers[__exclib_ndefers++];
+  d->fn = fn;
+  d->arg = arg;
+  d->idx = __exclib_curidx - 1;
+  EXCLIB_EXCEPTION->flags |= EXCLIB_F_DEFERRED;
+  return 0;
+}
+
+#endif /* EXCLIB_INLINE */
+
+#if defined(__cplusplus) && EXCLIB_CXX
+#include <exception>
+
+namespace exclib {
+
+/* What a C++ TRY catches; a THROW into one is thrown as this */
+class exception : public std::exception {
+public:
+  explicit exception(int value, const char *description = 0)
+    : value_(value), name_(exclib_exception_name(value)), description_(description), frame_(-1) {}
+  exception(int value, const char *name, const char *description, int frame)
+    : value_(value), name_(name), description_(description), frame_(frame) {}
+
+  int value() const { return value_; }
+  const char *name() const { return name_; }
+  const char *description() const { return description_; }
+  /* the frame it was thrown into, or -1 for whichever C++ TRY it reaches first */
+  int frame() const { return frame_; }
+
+  virtual const char *what() const throw()
+  {
+    return description_ ? description_ : (name_ ? name_ : "exclib::exception");
+  }
+
+private:
+  int value_;
+  const char *name_;
+  const char *description_;
+  int frame_;
+};
+
+/* The frame a C++ TRY pushes; popped by ETRY, or by the destructor if something else leaves the block */
+class frame {
+public:
+  int pass;      /* 0 runs the TRY block, 1 the CLEANUP block */
+
+  explicit frame(const struct exclib_site *site) : pass(0), idx_(__exclib_curidx)
+  {
+    EXCLIB_PUSH_FRAME(site);
+    EXCLIB_EXCEPTION->flags |= EXCLIB_F_NATIVE;
+  }
+
+  ~frame()
+  {
+    if ( __exclib_curidx > idx_ )
+      exclib_native_pop(idx_);
+  }
+
+  /* false sends it on to the TRY it was thrown into, or up from one that's already handling something */
+  bool take(const exception &e)
+  {
+    if ( e.frame() != idx_ && (e.frame() >= 0 || (exclib_frame_at(idx_)->flags & EXCLIB_F_UNWOUND)) )
+      return false;
+    exclib_native_catch(idx_, e.value(), (char *)e.description());
+    return true;
+  }
+
+private:
+  int idx_;
+
+  frame(const frame &);
+  frame &operator=(const frame &);
+};
+
+inline void throw_native(int idx)
+{
+  throw exception(exclib_frame_at(idx)->value, exclib_frame_info_at(idx)->name,
+                  exclib_frame_info_at(idx)->description, idx);
+}
+
+/* the library is C; this is how it throws into a C++ TRY */
+struct native_hook {
+  native_hook() { __exclib_native_throw = throw_native; }
+};
+
+static native_hook __exclib_native_hook;
+
+} /* namespace exclib */
+
+#endif /* EXCLIB_CXX */
 
 #endif /* __EXCLIB_H__ */
@@ -0,0 +1,128 @@
+#include "exclib.h"
+#include <pthread.h>
+
+/*
+ * exclib_arena_alloc; see exclib.h. The arena is a list of chunks and a
+ * position in it. The first allocation in a frame puts a mark (where the
+ * arena was, and which frame had the mark before) at that position and
+ * EXCLIB_DEFERs going back to it, so frames give back what they took in the
+ * same last in, first out order the defers run in. Going back only moves the
+ * position: the chunks past it stay on the list for the next frame to bump
+ * through. A chunk too small for a request is stepped over, not split.
+ */
+
+#define EXCLIB_ARENA_ALIGN 16
+
+struct exclib_arena_chunk {
+    struct exclib_arena_chunk *next;
+    size_t size;                        /* bytes after the header */
+};
+
+struct exclib_arena_mark {
+    struct exclib_arena_chunk *cur;
+    size_t used;
+    int depth;
+};
+
+#define EXCLIB_ARENA_ROUND(n) (((n) + EXCLIB_ARENA_ALIGN - 1) & ~(size_t)(EXCLIB_ARENA_ALIGN - 1))
+#define EXCLIB_ARENA_HEADER EXCLIB_ARENA_ROUND(sizeof(struct exclib_arena_chunk))
+
+static pthread_key_t __exclib_arena_key;
+static pthread_once_t __exclib_arena_once = PTHREAD_ONCE_INIT;
+
+static void exclib_arena_thread_exit(void *arg)
+{
+    exclib_arena_destroy((struct exclib_arena *)arg);
+}
+
+static void exclib_arena_key_init(void)
+{
+    pthread_key_create(&__exclib_arena_key, exclib_arena_thread_exit);
+}
+
+/* Frees every chunk; the arena is left empty, ready to be used again */
+void exclib_arena_destroy(struct exclib_arena *arena)
+{
+    struct exclib_arena_chunk *chunk;
+
+    while ( (chunk = arena->chunks) != NULL ) {
+	arena->chunks = chunk->next;
+	free(chunk);
+    }
+    arena->cur = NULL;
+    arena->used = 0;
+    arena->depth = 0;
+}
+
+/* size bytes (already rounded) from the arena's position on, moving to a later chunk, or a new one, if need be */
+static void *exclib_arena_bump(struct exclib_arena *arena, size_t size)
+{
+    struct exclib_arena_chunk *chunk = arena->cur;
+    struct exclib_arena_chunk *prev;
+    size_t want;
+
+    if ( chunk && chunk->size - arena->used >= size ) {
+	arena->used += size;
+	return (char *)chunk + EXCLIB_ARENA_HEADER + arena->used - size;
+    }
+    prev = chunk;
+    for ( chunk = chunk ? chunk->next : arena->chunks; chunk && chunk->size < size; chunk = chunk->next )
+	prev = chunk;
+    if ( !chunk ) {
+	want = size > EXC_ARENA_CHUNK ? size : EXC_ARENA_CHUNK;
+	chunk = (struct exclib_arena_chunk *)malloc(EXCLIB_ARENA_HEADER + want);
+	if ( !chunk )
+	    return NULL;
+	/* the thread's own arena is freed when it exits */
+	if ( !arena->chunks && !arena->context ) {
+	    pthread_once(&__exclib_arena_once, exclib_arena_key_init);
+	    pthread_setspecific(__exclib_arena_key, arena);
+	}
+	chunk->size = want;
+	chunk->next = NULL;
+	if ( prev )
+	    prev->next = chunk;
+	else
+	    arena->chunks = chunk;
+    }
+    arena->cur = chunk;
+    arena->used = size;
+    return (char *)chunk + EXCLIB_ARENA_HEADER;
+}
+
+/* EXCLIB_DEFERred by a frame's first allocation: puts the arena back where it was before it */
+static void exclib_arena_release(void *arg)
+{
+    struct exclib_arena_mark *mark = (struct exclib_arena_mark *)arg;
+
+    __exclib_arena->cur = mark->cur;
+    __exclib_arena->used = mark->used;
+    __exclib_arena->depth = mark->depth;
+}
+
+void *exclib_arena_alloc(size_t size)
+{
+    struct exclib_arena *arena = __exclib_arena;
+    struct exclib_arena_chunk *cur;
+    struct exclib_arena_mark *mark;
+    size_t used;
+
+    if ( !EXCLIB_EXCEPTION || size > (size_t)-1 - EXCLIB_ARENA_HEADER - EXC_ARENA_CHUNK )
+	return NULL;
+    if ( arena->depth != __exclib_curidx ) {
+	/* with no room to defer the release, throw EXC_OUTOFDEFERS before the mark takes any memory */
+	if ( __exclib_ndefers >= EXC_MAX_DEFERS )
+	    exclib_defer(exclib_arena_release, NULL);
+	cur = arena->cur;
+	used = arena->used;
+	mark = (struct exclib_arena_mark *)exclib_arena_bump(arena, EXCLIB_ARENA_ROUND(sizeof(*mark)));
+	if ( !mark )
+	    return NULL;
+	mark->cur = cur;
+	mark->used = used;
+	mark->depth = arena->depth;
+	EXCLIB_DEFER(exclib_arena_release, mark);
+	arena->depth = __exclib_curidx;
+    }
+    return exclib_arena_bump(arena, EXCLIB_ARENA_ROUND(size ? size : 1));
+}
@@ -0,0 +1,221 @@
+#define _GNU_SOURCE
+#include "exclib.h"
+#include <fcntl.h>
+#include <errno.h>
+#if EXCLIB_BACKTRACE == EXCLIB_BACKTRACE_UNWIND
+#include <unwind.h>
+#endif
+#if defined(__GNUC__) && (defined(__linux__) || defined(__APPLE__))
+#include <dlfcn.h>
+#define EXCLIB_HAVE_DLADDR 1
+#endif
+#if EXCLIB_BACKTRACE == EXCLIB_BACKTRACE_FP && defined(__GLIBC__)
+#include <pthread.h>
+#define EXCLIB_HAVE_STACK_BOUNDS 1
+#endif
+
+/*
+ * Native backtraces, taken by THROW (exclib_prep_throw) and nowhere else.
+ * Capture only stores return addresses, into this thread's __exclib_backtrace;
+ * turning them into names is left to whoever prints them: the exception
+ * report prints the raw addresses (it has to stay async-signal-safe),
+ * exclib_print_backtrace resolves them with dladdr, and exclib_dump_load_map
+ * writes out where everything was loaded so addr2line can do it offline.
+ */
+
+EXCLIB_TLS void *__exclib_backtrace[EXC_BACKTRACE_MAX];
+EXCLIB_TLS int __exclib_backtrace_len = 0;
+static int __exclib_backtrace_depth = EXC_BACKTRACE_DEPTH;
+#ifdef EXCLIB_HAVE_STACK_BOUNDS
+/* top of this thread's stack, so a bogus frame pointer can't walk us off the end of it */
+static EXCLIB_TLS char *__exclib_stack_top = NULL;
+static EXCLIB_TLS int __exclib_stack_checked = 0;
+#endif
+
+/*
+ * Looks up this thread's stack. Done by the first THROW on each thread (or
+ * ahead of time by exclib_init), since it can allocate and, on the main
+ * thread, read /proc; TRY never pays for it.
+ */
+void exclib_init_backtrace()
+{
+#ifdef EXCLIB_HAVE_STACK_BOUNDS
+    pthread_attr_t attr;
+    void *addr;
+    size_t size;
+
+    if ( __exclib_stack_checked )
+	return;
+    __exclib_stack_checked = 1;
+    if ( pthread_getattr_np(pthread_self(), &attr) != 0 )
+	return;
+    if ( pthread_attr_getstack(&attr, &addr, &size) == 0 )
+	__exclib_stack_top = (char *)addr + size;
+    pthread_attr_destroy(&attr);
+#endif
+}
+
+void exclib_set_backtrace_depth(int depth)
+{
+    if ( depth < 0 )
+	depth = 0;
+    if ( depth > EXC_BACKTRACE_MAX )
+	depth = EXC_BACKTRACE_MAX;
+    __exclib_backtrace_depth = depth;
+}
+
+#if EXCLIB_BACKTRACE == EXCLIB_BACKTRACE_UNWIND
+
+struct exclib_unwind_state {
+    int skip;
+    int max;
+};
+
+static _Unwind_Reason_Code exclib_unwind_frame(struct _Unwind_Context *ctx, void *arg)
+{
+    struct exclib_unwind_state *st = (struct exclib_unwind_state *)arg;
+    void *ip = (void *)_Unwind_GetIP(ctx);
+
+    if ( !ip )
+	return _URC_END_OF_STACK;
+    if ( st->skip > 0 ) {
+	st->skip--;
+	return _URC_NO_REASON;
+    }
+    __exclib_backtrace[__exclib_backtrace_len++] = ip;
+    return __exclib_backtrace_len >= st->max ? _URC_END_OF_STACK : _URC_NO_REASON;
+}
+
+/* skip: how many of our callers to leave out, so the trace starts at the THROW */
+__attribute__((noinline)) void exclib_capture_backtrace(int skip)
+{
+    struct exclib_unwind_state st;
+
+    __exclib_backtrace_len = 0;
+    if ( __exclib_backtrace_depth == 0 )
+	return;
+    st.skip = skip + 1;    /* and this function's own frame */
+    st.max = __exclib_backtrace_depth;
+    _Unwind_Backtrace(exclib_unwind_frame, &st);
+}
+
+#elif EXCLIB_BACKTRACE == EXCLIB_BACKTRACE_FP
+
+/* frames are never this big; a saved frame pointer that jumps further isn't one */
+#define EXCLIB_FP_MAX_GAP (8UL * 1024 * 1024)
+
+__attribute__((noinline)) void exclib_capture_backtrace(int skip)
+{
+    void **fp = (void **)__builtin_frame_address(0);
+    void **next;
+    char *top = NULL;
+    int max = __exclib_backtrace_depth;
+
+    __exclib_backtrace_len = 0;
+    if ( max == 0 )
+	return;
+#ifdef EXCLIB_HAVE_STACK_BOUNDS
+    if ( !__exclib_stack_checked )
+	exclib_init_backtrace();
+    top = __exclib_stack_top;
+#endif
+    while ( fp && __exclib_backtrace_len < max ) {
+	if ( !fp[1] )
+	    break;
+	if ( skip > 0 )
+	    skip--;
+	else
+	    __exclib_backtrace[__exclib_backtrace_len++] = fp[1];
+	next = (void **)fp[0];
+	if ( next <= fp || ((unsigned long)next & (sizeof(void *) - 1)) != 0 ||
+	     (unsigned long)((char *)next - (char *)fp) > EXCLIB_FP_MAX_GAP ||
+	     (top && (char *)(next + 2) > top) )
+	    break;
+	fp = next;
+    }
+}
+
+#else
+
+void exclib_capture_backtrace(int skip)
+{
+    (void)skip;
+    __exclib_backtrace_len = 0;
+}
+
+#endif /* EXCLIB_BACKTRACE */
+
+void exclib_print_backtrace(FILE *out)
+{
+    int i;
+#ifdef EXCLIB_HAVE_DLADDR
+    Dl_info info;
+    char *addr;
+#endif
+
+    for ( i = 0; i < __exclib_backtrace_len; i++ ) {
+#ifdef EXCLIB_HAVE_DLADDR
+	/* a return address can be the first byte of the next function; look up the call instead */
+	addr = (char *)__exclib_backtrace[i];
+	if ( dladdr(addr - 1, &info) && info.dli_fname ) {
+	    if ( info.dli_sname )
+		fprintf(out, "EXCLIB: @%d %s(%s+0x%lx) [%p]\n", i, info.dli_fname, info.dli_sname,
+			(unsigned long)(addr - (char *)info.dli_saddr), (void *)addr);
+	    else
+		fprintf(out, "EXCLIB: @%d %s(+0x%lx) [%p]\n", i, info.dli_fname,
+			(unsigned long)(addr - (char *)info.dli_fbase), (void *)addr);
+	    continue;
+	}
+#endif
+	fprintf(out, "EXCLIB: @%d [%p]\n", i, __exclib_backtrace[i]);
+    }
+}
+
+/*
+ * Copies the executable mappings out of /proc/self/maps, for symbolizing
+ * report addresses offline (addr2line -e <file> <address - start + offset>).
+ * Only open/read/write, so it's as safe in a signal handler as the report.
+ */
+void exclib_dump_load_map(int fd)
+{
+#if defined(__linux__)
+    char buf[4096];
+    ssize_t n;
+    int len = 0;
+    int start = 0;
+    int in;
+    int i;
+    int saved = errno;
+
+    in = open("/proc/self/maps", O_RDONLY);
+    if ( in < 0 )
+	return;
+    for ( ;; ) {
+	n = read(in, buf + len, sizeof(buf) - len);
+	if ( n < 0 && errno == EINTR )
+	    continue;
+	if ( n <= 0 )
+	    break;
+	len += (int)n;
+	start = 0;
+	for ( i = 0; i < len; i++ ) {
+	    if ( buf[i] != '\n' )
+		continue;
+	    /* "start-end perms offset dev inode path"; the x is the fourth perms character */
+	    for ( n = start; n < i && buf[n] != ' '; n++ )
+		;
+	    if ( n + 3 < i && buf[n + 3] == 'x' )
+		(void)write(fd, buf + start, i - start + 1);
+	    start = i + 1;
+	}
+	if ( start == 0 && len == (int)sizeof(buf) )
+	    start = len;    /* a line longer than the buffer; drop it */
+	memmove(buf, buf + start, len - start);
+	len -= start;
+    }
+    close(in);
+    errno = saved;
+#else
+    (void)fd;
+#endif
+}
@@ -0,0 +1,77 @@
+#define _GNU_SOURCE
+#include "exclib.h"
+#include <time.h>
+#include <pthread.h>
+
+/*
+ * The clock behind the flight recorder's and the profiler's timestamps: the
+ * TSC on x86, which reads in a fraction of what clock_gettime takes, and
+ * CLOCK_MONOTONIC_RAW ns anywhere else. exclib_ticks_hz says how many ticks
+ * make a second; for the TSC that's measured against CLOCK_MONOTONIC, so a
+ * clock step can't skew it, over the first EXCLIB_TICKS_CALIBRATE_NS after
+ * it's first asked for.
+ */
+
+#define EXCLIB_TICKS_CALIBRATE_NS 10000000UL
+
+static unsigned long __exclib_ticks_hz = 0;
+static pthread_once_t __exclib_ticks_once = PTHREAD_ONCE_INIT;
+
+static unsigned long exclib_clock_ns(clockid_t id)
+{
+    struct timespec ts;
+
+    clock_gettime(id, &ts);
+    return (unsigned long)ts.tv_sec * 1000000000UL + (unsigned long)ts.tv_nsec;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+unsigned long exclib_ticks()
+{
+    unsigned int lo;
+    unsigned int hi;
+
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((unsigned long)hi << 32) | lo;
+}
+
+static void exclib_ticks_calibrate(void)
+{
+    unsigned long ns0 = exclib_clock_ns(CLOCK_MONOTONIC);
+    unsigned long t0 = exclib_ticks();
+    unsigned long ns1;
+    unsigned long t1;
+
+    do {
+	t1 = exclib_ticks();
+	ns1 = exclib_clock_ns(CLOCK_MONOTONIC);
+    } while ( ns1 - ns0 < EXCLIB_TICKS_CALIBRATE_NS );
+    __exclib_ticks_hz = (unsigned long)((double)(t1 - t0) * 1e9 / (double)(ns1 - ns0));
+}
+#else
+unsigned long exclib_ticks()
+{
+#ifdef CLOCK_MONOTONIC_RAW
+    return exclib_clock_ns(CLOCK_MONOTONIC_RAW);
+#else
+    return exclib_clock_ns(CLOCK_MONOTONIC);
+#endif
+}
+
+static void exclib_ticks_calibrate(void)
+{
+    __exclib_ticks_hz = 1000000000UL;
+}
+#endif
+
+unsigned long exclib_ticks_hz()
+{
+    pthread_once(&__exclib_ticks_once, exclib_ticks_calibrate);
+    return __exclib_ticks_hz;
+}
+
+/* CLOCK_REALTIME ns, for stamping what the ticks are relative to */
+unsigned long exclib_wall_ns()
+{
+    return exclib_clock_ns(CLOCK_REALTIME);
+}
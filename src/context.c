@@ -0,0 +1,119 @@
+#include "exclib.h"
+
+/*
+ * Out-of-line halves of the EXCLIB_CONTEXT backends. SETJMP and SIGSETJMP are
+ * plain libc and need nothing here.
+ */
+
+#if EXCLIB_CONTEXT == EXCLIB_CONTEXT_BUILTIN
+
+__attribute__((noinline)) void exclib_longjmp(exclib_jmp_buf buf, int value)
+{
+    /* __builtin_setjmp always comes back with 1; the thrown value lives in the frame */
+    (void)value;
+    __builtin_longjmp(buf, 1);
+}
+
+#elif EXCLIB_CONTEXT == EXCLIB_CONTEXT_ASM
+
+#if defined(__APPLE__)
+#define EXCLIB_ASM_SYM(x) "_" #x
+#define EXCLIB_ASM_TYPE(x)
+#else
+#define EXCLIB_ASM_SYM(x) #x
+#define EXCLIB_ASM_TYPE(x) ".type " #x ", %function\n"
+#endif
+
+#if defined(__x86_64__)
+
+/*
+ * exclib_jmp_buf: rbx, rbp, r12, r13, r14, r15, rsp (as seen by the caller), rip.
+ * The red zone below rsp belongs to the caller and is left alone.
+ */
+__asm__(
+    ".text\n"
+    ".globl " EXCLIB_ASM_SYM(exclib_setjmp) "\n"
+    EXCLIB_ASM_TYPE(exclib_setjmp)
+    ".p2align 4\n"
+    EXCLIB_ASM_SYM(exclib_setjmp) ":\n"
+    "    movq %rbx, 0(%rdi)\n"
+    "    movq %rbp, 8(%rdi)\n"
+    "    movq %r12, 16(%rdi)\n"
+    "    movq %r13, 24(%rdi)\n"
+    "    movq %r14, 32(%rdi)\n"
+    "    movq %r15, 40(%rdi)\n"
+    "    leaq 8(%rsp), %rdx\n"
+    "    movq %rdx, 48(%rdi)\n"
+    "    movq (%rsp), %rdx\n"
+    "    movq %rdx, 56(%rdi)\n"
+    "    xorl %eax, %eax\n"
+    "    ret\n"
+    ".globl " EXCLIB_ASM_SYM(exclib_longjmp) "\n"
+    EXCLIB_ASM_TYPE(exclib_longjmp)
+    ".p2align 4\n"
+    EXCLIB_ASM_SYM(exclib_longjmp) ":\n"
+    "    movl %esi, %eax\n"
+    "    testl %eax, %eax\n"
+    "    jnz 1f\n"
+    "    incl %eax\n"
+    "1:\n"
+    "    movq 0(%rdi), %rbx\n"
+    "    movq 8(%rdi), %rbp\n"
+    "    movq 16(%rdi), %r12\n"
+    "    movq 24(%rdi), %r13\n"
+    "    movq 32(%rdi), %r14\n"
+    "    movq 40(%rdi), %r15\n"
+    "    movq 48(%rdi), %rsp\n"
+    "    jmp *56(%rdi)\n"
+);
+
+#elif defined(__aarch64__)
+
+/*
+ * exclib_jmp_buf: x19-x28, x29 (fp), x30 (lr), sp, d8-d15. The low halves of
+ * v8-v15 are callee-saved under AAPCS64, so they have to come along.
+ */
+__asm__(
+    ".text\n"
+    ".globl " EXCLIB_ASM_SYM(exclib_setjmp) "\n"
+    EXCLIB_ASM_TYPE(exclib_setjmp)
+    ".p2align 4\n"
+    EXCLIB_ASM_SYM(exclib_setjmp) ":\n"
+    "    stp x19, x20, [x0, #0]\n"
+    "    stp x21, x22, [x0, #16]\n"
+    "    stp x23, x24, [x0, #32]\n"
+    "    stp x25, x26, [x0, #48]\n"
+    "    stp x27, x28, [x0, #64]\n"
+    "    stp x29, x30, [x0, #80]\n"
+    "    mov x2, sp\n"
+    "    str x2, [x0, #96]\n"
+    "    stp d8, d9, [x0, #104]\n"
+    "    stp d10, d11, [x0, #120]\n"
+    "    stp d12, d13, [x0, #136]\n"
+    "    stp d14, d15, [x0, #152]\n"
+    "    mov w0, #0\n"
+    "    ret\n"
+    ".globl " EXCLIB_ASM_SYM(exclib_longjmp) "\n"
+    EXCLIB_ASM_TYPE(exclib_longjmp)
+    ".p2align 4\n"
+    EXCLIB_ASM_SYM(exclib_longjmp) ":\n"
+    "    ldp x19, x20, [x0, #0]\n"
+    "    ldp x21, x22, [x0, #16]\n"
+    "    ldp x23, x24, [x0, #32]\n"
+    "    ldp x25, x26, [x0, #48]\n"
+    "    ldp x27, x28, [x0, #64]\n"
+    "    ldp x29, x30, [x0, #80]\n"
+    "    ldr x2, [x0, #96]\n"
+    "    mov sp, x2\n"
+    "    ldp d8, d9, [x0, #104]\n"
+    "    ldp d10, d11, [x0, #120]\n"
+    "    ldp d12, d13, [x0, #136]\n"
+    "    ldp d14, d15, [x0, #152]\n"
+    "    cmp w1, #0\n"
+    "    csinc w0, w1, wzr, ne\n"
+    "    ret\n"
+);
+
+#endif /* __x86_64__ / __aarch64__ */
+
+#endif /* EXCLIB_CONTEXT */
@@ -5,216 +5,797 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <string.h>
+#include <pthread.h>
+#include <stdarg.h>
 
-int __exclib_curidx = 0;
-int __exclib_inited = 0;
-struct exclib_status __exclib_statuses[EXC_MAX_FRAMES];
-struct exclib_status *EXCLIB_EXCEPTION = &__exclib_statuses[0];
-char *__exclib_names[EXC_MAX_EXCEPTIONS];
-int __exclib_rc;
-char __exclib_strbuf[EXC_STRBUF_SIZE];
-
-struct exclib_name_data __exclib_exc_names[EXC_PREDEFINED_EXCEPTIONS] = {
-    {EXC_NULLPOINTER, "Null Pointer", SIGSEGV},
-    {EXC_OUTOFBOUNDS, "Array Index Out of Bounds", SIGTERM}
+/*
+ * Everything a TRY/THROW/ETRY touches is per-thread. Frame N's parent is frame
+ * N-1; EXCLIB_EXCEPTION points at frame __exclib_curidx-1, or is NULL when no
+ * TRY is active. __exclib_throwidx remembers the frame the last exception was
+ * thrown from until it's handled, so a trace still shows the frames it
+ * propagated out of.
+ */
+EXCLIB_TLS int __exclib_curidx = 0;
+EXCLIB_TLS int __exclib_inited = 0;
+EXCLIB_TLS int __exclib_throwidx = -1;
+EXCLIB_TLS struct exclib_status *EXCLIB_EXCEPTION = NULL;
+/* the inline frames of whichever exclib_context is active; NULL until the thread's first TRY */
+EXCLIB_TLS struct exclib_status *__exclib_frames = NULL;
+EXCLIB_TLS struct exclib_frame_info *__exclib_frame_infos = NULL;
+/* the active exclib_context's EXCLIB_DEFER actions, and how many are waiting */
+EXCLIB_TLS struct exclib_defer *__exclib_defers = NULL;
+EXCLIB_TLS int __exclib_ndefers = 0;
+/* the active exclib_context's exclib_arena_alloc arena */
+EXCLIB_TLS struct exclib_arena *__exclib_arena = NULL;
+EXCLIB_TLS int __exclib_rc;
+EXCLIB_TLS char __exclib_strbuf[EXC_STRBUF_SIZE];
+/* set by exclib.h in C++ code built with EXCLIB_CXX; throws an exclib::exception into a C++ TRY's frame */
+void (*__exclib_native_throw)(int idx) = NULL;
+
+/*
+ * Frames past the first EXC_INLINE_FRAMES live in segments of EXC_FRAME_CHUNK,
+ * malloc'd the first time the thread gets that deep. A segment is never moved
+ * or given back while the thread runs, so EXCLIB_EXCEPTION, the saved contexts
+ * and the frames' parents stay put while the stack grows and shrinks under
+ * them; they're freed by a thread-specific data destructor when it exits.
+ */
+#define EXCLIB_SEGMENTS ((EXC_MAX_FRAMES - EXC_INLINE_FRAMES + EXC_FRAME_CHUNK - 1) / EXC_FRAME_CHUNK + 1)
+#define EXCLIB_SEGMENT_ALIGN 64
+
+struct exclib_segment {
+  struct exclib_status frames[EXC_FRAME_CHUNK];
+  struct exclib_frame_info info[EXC_FRAME_CHUNK];
 };
 
-void exclib_print_exception_stack(char *mbuf, char *file, char *func, int line)
-{
-    char buf[512];
-    char flagbuf[256];
-    char *excname = NULL;
-    struct exclib_status *cur = EXCLIB_EXCEPTION;
-    int idx = 0;
-
-    fprintf(stderr,
-	    "EXCLIB: %s:%d:%s: %s\n",
-	    file,
-	    line,
-	    func,
-	    mbuf);    
-
-    for ( idx = 0; idx < EXC_MAX_FRAMES; idx++ ) {
-      if ( __exclib_statuses[idx].file != NULL )
-	cur = &__exclib_statuses[idx];
-    }
-    idx = 0;
-
-    if ( ! cur )
-	fprintf(stderr, "EXCLIB: #0: No exception stack\n");
-    else {
-      while ( cur != NULL ) {
-	memset((char *)&buf, 0, 256);
-	memset((char *)&flagbuf, 0, 256);
-	if ( cur->catching == 1) {
-	  if ( strlen((char *)&flagbuf) > 0 )
-	    strcat((char *)&flagbuf, ",");
-	  strcat((char *)&flagbuf, "catching");
-	} 
-	if ( cur->caught == 1) {
-	  if ( strlen((char *)&flagbuf) > 0 )
-	    strcat((char *)&flagbuf, ",");
-	  strcat((char *)&flagbuf, "caught");
-	} 
-	if ( cur->tried == 1) {
-	  if ( strlen((char *)&flagbuf) > 0 )
-	    strcat((char *)&flagbuf, ",");
-	  strcat((char *)&flagbuf, "tried");
-	}
-	if ( cur->thrown == 1) {
-	  if ( strlen((char *)&flagbuf) > 0 )
-	    strcat((char *)&flagbuf, ",");
-	  strcat((char *)&flagbuf, "thrown");
-	}
+struct exclib_segments {
+  struct exclib_segment *seg[EXCLIB_SEGMENTS];
+  void *mem[EXCLIB_SEGMENTS];
+};
 
-	if ( cur->name )
-	  excname = cur->name;
-	else
-	  excname = "NULL";
-	sprintf((char *)&buf,
-		"EXCLIB: #%d[0x%lx] %s:%d:%s:%s:%d:%s: %s\n",
-		idx,
-		(unsigned long int)cur,
-		cur->file,
-		cur->line,
-		cur->function,
-		excname,
-		cur->value,
-		(char *)&flagbuf,
-		cur->description);
-	fprintf(stderr, "%s", (char *)&buf);
-	idx += 1;
-	cur = cur->prev;
-      }
-    }
+/*
+ * A whole frame stack. Each thread has one built in; exclib_context_create
+ * makes more, for fibers, and exclib_context_switch swaps which one the
+ * thread's TRY/THROW/ETRY work on. Only the active one's position is kept in
+ * the thread's own variables above: the rest keep theirs in here.
+ */
+struct exclib_context {
+  int curidx;
+  int throwidx;
+  int ndefers;
+  struct exclib_status *exception;
+  struct exclib_defer defers[EXC_MAX_DEFERS];
+  struct exclib_arena arena;
+  struct exclib_segments segments;
+  struct exclib_status frames[EXC_INLINE_FRAMES];
+  struct exclib_frame_info info[EXC_INLINE_FRAMES];
+};
+
+static EXCLIB_TLS struct exclib_context __exclib_thread_context;
+static EXCLIB_TLS struct exclib_context *__exclib_context = NULL;     /* NULL for __exclib_thread_context */
+static EXCLIB_TLS struct exclib_segments *__exclib_segments = NULL;
+static pthread_key_t __exclib_segments_key;
+static pthread_once_t __exclib_segments_once = PTHREAD_ONCE_INIT;
+
+static void exclib_free_segments(void *arg)
+{
+  struct exclib_segments *segs = (struct exclib_segments *)arg;
+  int i;
+
+  for ( i = 0; i < EXCLIB_SEGMENTS; i++ ) {
+    free(segs->mem[i]);
+    segs->mem[i] = NULL;
+    segs->seg[i] = NULL;
+  }
+}
+
+static void exclib_segments_key_init(void)
+{
+  pthread_key_create(&__exclib_segments_key, exclib_free_segments);
 }
 
-void exclib_bulk_name_exceptions(struct exclib_name_data *exclib_exc_names, int size)
+/* Returns frame idx, allocating the segment it lives in if need be; NULL past EXC_MAX_FRAMES or out of memory */
+static struct exclib_status *exclib_frame_grow(int idx)
 {
-    struct exclib_name_data *ptr;
-    int i = 0;
-    /*THROW_ZERO(exclib_exc_names, EXC_NULLPOINTER, "Null Pointer");*/
-    ptr = exclib_exc_names;
-    for ( i = 0; i < size ; i++) {
-	exclib_name_exception(ptr->exc, ptr->name);
-	ptr += sizeof(struct exclib_name_data);
+  struct exclib_segments *segs = __exclib_segments;
+  int n;
+  void *mem;
+
+  if ( idx >= EXC_MAX_FRAMES )
+    return NULL;
+  n = (idx - EXC_INLINE_FRAMES) / EXC_FRAME_CHUNK;
+  if ( !segs->seg[n] ) {
+    mem = malloc(sizeof(struct exclib_segment) + EXCLIB_SEGMENT_ALIGN);
+    if ( !mem )
+      return NULL;
+    /* a created context's segments go with exclib_context_destroy instead */
+    if ( segs == &__exclib_thread_context.segments ) {
+      pthread_once(&__exclib_segments_once, exclib_segments_key_init);
+      pthread_setspecific(__exclib_segments_key, segs);
     }
+    segs->mem[n] = mem;
+    segs->seg[n] = (struct exclib_segment *)(((unsigned long)mem + EXCLIB_SEGMENT_ALIGN) & ~(unsigned long)(EXCLIB_SEGMENT_ALIGN - 1));
+  }
+  return exclib_frame_at(idx);
 }
 
-void exclib_name_exception(int value, char *name)
+struct exclib_status *exclib_frame_at(int idx)
 {
-    __exclib_names[value] = name;
+  if ( idx < EXC_INLINE_FRAMES )
+    return &__exclib_frames[idx];
+  idx -= EXC_INLINE_FRAMES;
+  return &__exclib_segments->seg[idx / EXC_FRAME_CHUNK]->frames[idx % EXC_FRAME_CHUNK];
 }
 
+struct exclib_frame_info *exclib_frame_info_at(int idx)
+{
+  if ( idx < EXC_INLINE_FRAMES )
+    return &__exclib_frame_infos[idx];
+  idx -= EXC_INLINE_FRAMES;
+  return &__exclib_segments->seg[idx / EXC_FRAME_CHUNK]->info[idx % EXC_FRAME_CHUNK];
+}
+
+/* Makes ctx's frames the ones frame_at and friends hand out */
+static void exclib_use_context(struct exclib_context *ctx)
+{
+  __exclib_frames = ctx->frames;
+  __exclib_frame_infos = ctx->info;
+  __exclib_segments = &ctx->segments;
+  __exclib_defers = ctx->defers;
+  __exclib_arena = &ctx->arena;
+}
+
+/*
+ * Nothing needs this any more: the registry sets itself up before main and
+ * each thread looks its stack up on its first THROW. Calling it does both
+ * ahead of time, for a thread that shouldn't pay for that on its first throw.
+ */
 void exclib_init()
 {
-  int i = 0;
   if ( __exclib_inited == 1 )
     return;
   __exclib_inited = 1;
-  memset(&__exclib_statuses, 0x00, sizeof(struct exclib_status) * EXC_MAX_FRAMES);
-  /* for whatever reason memset isn't safe here, so ... */
-  for ( i = 0 ; i < EXC_MAX_EXCEPTIONS; i++ ) {
-    __exclib_names[i] = NULL;
-  }
-  exclib_bulk_name_exceptions(&__exclib_exc_names[0], EXC_PREDEFINED_EXCEPTIONS);
-}
-
-void exclib_prep_throw(int value, char *msg, char *file, char *func, int line, int setflag)
-{
-    if ( EXCLIB_EXCEPTION && EXCLIB_EXCEPTION->tried == 1) {
-		sprintf((char *)&__exclib_strbuf, "Tried to THROW %d but couldn't create new exception frame", value);
-		if ( EXCLIB_EXCEPTION->catching == 1 && EXCLIB_EXCEPTION->prev ) {
-			if ( exclib_new_exc_frame(EXCLIB_EXCEPTION, file, func, line) ) {
-				exclib_print_exception_stack((char *)&__exclib_strbuf, file, func, line);
-				exit(value);
-			}
-			memcpy(EXCLIB_EXCEPTION->buf, EXCLIB_EXCEPTION->prev->buf, sizeof(jmp_buf));
-			if ( setflag )
-				EXCLIB_EXCEPTION->thrown = 1;
-			} else if ( EXCLIB_EXCEPTION->catching == 1 && (EXCLIB_EXCEPTION->prev == NULL) ) {
-				exclib_clear_exc_frame();
-			} else {
-			if ( exclib_new_exc_frame(EXCLIB_EXCEPTION, file, func, line) )
-				exclib_print_exception_stack((char *)&__exclib_strbuf, file, func, line);
-			if ( setflag )
-				EXCLIB_EXCEPTION->thrown = 1;
-		}
-		if ( setflag ) {
-			EXCLIB_EXCEPTION->value = value;
-			EXCLIB_EXCEPTION->name = __exclib_names[value];
-			EXCLIB_EXCEPTION->description = msg;
-		}
-		return;
-    }
+  exclib_init_registry();
+  exclib_init_backtrace();
+}
+
+/* Makes the current frame the one value was thrown into, from site; the caller takes the backtrace */
+static struct exclib_frame_info *exclib_mark_thrown(struct exclib_status *es, int value, char *msg, const struct exclib_site *site)
+{
+    struct exclib_frame_info *info = exclib_frame_info_at(__exclib_curidx - 1);
+
+    /* the frame now reports where it was thrown from rather than where it was entered */
+    info->site = site;
+    es->flags |= EXCLIB_F_THROWN | EXCLIB_F_UNWOUND | EXCLIB_F_RAISED;
+    es->value = value;
+    __exclib_throwidx = __exclib_curidx - 1;
+    info->name = exclib_exception_name(value);
+    info->description = msg;
+    info->msg.fmt = NULL;
+    info->payload.type = EXCLIB_PAYLOAD_NONE;
+    info->ncauses = 0;
+    return info;
+}
+
+static void exclib_no_context(int value, const struct exclib_site *site)
+{
+    EXCLIB_STAT(EXCLIB_STAT_THROWN, value, site);
+    EXCLIB_STAT(EXCLIB_STAT_UNCAUGHT, value, site);
+    EXCLIB_PROBE_EXC_DESC(uncaught, value, site, -1, (char *)NULL);
+    EXCLIB_RECORD(EXCLIB_STAT_UNCAUGHT, value, site, -1, NULL);
     sprintf((char *)&__exclib_strbuf, "Tried to THROW Exception %d but had no exception context. (Called outside of TRY block, or thrown while TRY was setting up?)", value);
-    exclib_print_exception_stack((char *)&__exclib_strbuf, file, func, line);
-    exit(value);
+    if ( exclib_report_allowed(value, site) )
+	exclib_print_exception_stack((char *)&__exclib_strbuf, (char *)site->file, (char *)site->function, site->line);
+    exclib_raise_uncaught(value);
 }
 
+void exclib_prep_throw(int value, char *msg, const struct exclib_site *site, int setflag)
+{
+    struct exclib_status *es = EXCLIB_EXCEPTION;
 
-int exclib_new_exc_frame(struct exclib_status *es, char *file, char *function, int line)
+    if ( es && (es->flags & EXCLIB_F_TRIED) ) {
+	if ( setflag ) {
+	    exclib_mark_thrown(es, value, msg, site);
+	    exclib_capture_backtrace(1);
+	    EXCLIB_STAT(EXCLIB_STAT_THROWN, value, site);
+	    EXCLIB_PROBE_EXC_DESC(throw, value, site, __exclib_curidx - 1, msg);
+	    EXCLIB_RECORD(EXCLIB_STAT_THROWN, value, site, __exclib_curidx - 1, msg);
+	    EXCLIB_PROFILE_THROW();
+	    /* C's THROW longjmps when this returns, which a C++ TRY has no context for */
+	    if ( es->flags & EXCLIB_F_NATIVE )
+		__exclib_native_throw(__exclib_curidx - 1);
+	} else {
+	    exclib_frame_info_at(__exclib_curidx - 1)->site = site;
+	    es->flags |= EXCLIB_F_RAISED;
+	    __exclib_throwidx = __exclib_curidx - 1;
+	}
+	return;
+    }
+    exclib_capture_backtrace(1);
+    exclib_no_context(value, site);
+}
+
+/* Adds the exception frame idx holds, and then its own causes, to a chain of at most EXC_MAX_CAUSES */
+static int exclib_chain_causes(struct exclib_cause *causes, int n, int idx)
+{
+    struct exclib_status *es = exclib_frame_at(idx);
+    struct exclib_frame_info *info = exclib_frame_info_at(idx);
+    struct exclib_cause *c;
+    int i;
+
+    if ( !(es->flags & EXCLIB_F_THROWN) || n >= EXC_MAX_CAUSES )
+	return n;
+    c = &causes[n++];
+    c->value = es->value;
+    c->site = exclib_frame_site(idx);
+    c->name = info->name;
+    c->description = info->description;
+    c->msg.fmt = NULL;
+    if ( info->msg.fmt )
+	c->msg = info->msg;
+    c->payload = info->payload;
+    for ( i = 0; i < info->ncauses && n < EXC_MAX_CAUSES; i++ )
+	causes[n++] = info->causes[i];
+    return n;
+}
+
+/* Whether frame idx, a TRY_FOR, listed something value is or is under */
+static int exclib_frame_handles(struct exclib_status *es, int value)
+{
+    const int *h;
+
+    for ( h = es->site->handles; h && *h; h++ ) {
+	if ( exclib_exception_is(value, *h) )
+	    return 1;
+    }
+    return 0;
+}
+
+/*
+ * Runs the EXCLIB_DEFER actions left for frame idx, and any left above it by
+ * frames that were dropped without being popped, newest first. Each is taken
+ * off the stack before it runs, so one can defer another.
+ */
+static void exclib_run_defers(int idx)
+{
+    struct exclib_defer *d;
+
+    while ( __exclib_ndefers > 0 && __exclib_defers[__exclib_ndefers - 1].idx >= idx ) {
+	d = &__exclib_defers[--__exclib_ndefers];
+	d->fn(d->arg);
+    }
+}
+
+int exclib_defer(void (*fn)(void *arg), void *arg)
+{
+    EXCLIB_SITE(__exclib_defer_site, EXCLIB_SITE_THROW);
+    struct exclib_defer *d;
+
+    if ( !EXCLIB_EXCEPTION )
+	return -1;
+    if ( __exclib_ndefers >= EXC_MAX_DEFERS )
+	exclib_throw(EXC_OUTOFDEFERS, "No room to defer another action", &__exclib_defer_site);
+    d = &__exclib_defers[__exclib_ndefers++];
+    d->fn = fn;
+    d->arg = arg;
+    d->idx = __exclib_curidx - 1;
+    EXCLIB_EXCEPTION->flags |= EXCLIB_F_DEFERRED;
+    return 0;
+}
+
+/*
+ * Pops the TRY_FORs on top of the stack that value would only pass through,
+ * running their EXCLIB_DEFER and then EXCLIB_ON_UNWIND actions, and returns
+ * the frame it stops at.
+ * Frame 0 is never skipped, so an uncaught exception still ends up there.
+ */
+static struct exclib_status *exclib_skip_frames(struct exclib_status *es, int value)
 {
-    int i = 0;
-    exclib_init();
-    if ( !es )
-	return 1;
-    if (EXCLIB_EXCEPTION && EXCLIB_EXCEPTION != es) {
-	EXCLIB_EXCEPTION->next = es;
-	es->prev = EXCLIB_EXCEPTION;
-    } else if (!EXCLIB_EXCEPTION) {
- 	es->prev = NULL;
+    struct exclib_frame_info *info;
+
+    while ( (es->flags & (EXCLIB_F_FILTERED | EXCLIB_F_UNWOUND)) == EXCLIB_F_FILTERED && __exclib_curidx > 1 &&
+	    !exclib_frame_handles(es, value) ) {
+	EXCLIB_STAT(EXCLIB_STAT_PROPAGATED, value, es->site);
+	EXCLIB_PROBE_EXC(propagate, value, es->site, __exclib_curidx - 1);
+	EXCLIB_RECORD(EXCLIB_STAT_PROPAGATED, value, es->site, __exclib_curidx - 1, NULL);
+	EXCLIB_PROFILE_HOP(es->site);
+	__exclib_curidx--;
+	exclib_run_defers(__exclib_curidx);
+	if ( es->flags & EXCLIB_F_ONUNWIND ) {
+	    info = exclib_frame_info_at(__exclib_curidx);
+	    es->flags &= ~EXCLIB_F_ONUNWIND;
+	    info->unwind(info->unwind_arg);
+	}
+	es = EXCLIB_EXCEPTION = exclib_frame_at(__exclib_curidx - 1);
     }
-    es->next = NULL;
-    es->file = file;
-    es->function = function;
-    es->line = line;
-    es->name = "Unnamed Exception";
-    es->description = "No Description";
+    return es;
+}
+
+void exclib_on_unwind(void (*fn)(void *arg), void *arg)
+{
+    struct exclib_frame_info *info;
+
+    if ( !EXCLIB_EXCEPTION )
+	return;
+    info = exclib_frame_info_at(__exclib_curidx - 1);
+    info->unwind = fn;
+    info->unwind_arg = arg;
+    EXCLIB_EXCEPTION->flags |= EXCLIB_F_ONUNWIND;
+}
+
+#if defined(__GNUC__)
+#define EXCLIB_RAISE_ATTRS __attribute__((noinline, noreturn))
+#else
+#define EXCLIB_RAISE_ATTRS
+#endif
+
+/*
+ * Where exclib_throw, THROWF, THROW_PAYLOAD and EXCLIB_RETHROW end up. msg
+ * and payload are NULL for a plain THROW; had is the causes a rethrown
+ * exception already had, which go ahead of any it picks up here. When the current frame is already handling an
+ * exception (the THROW came from its CLEANUP, CATCH or FINALLY), that frame
+ * is finished: its exception becomes the first cause of the new one and the
+ * new one goes to the frame above it, or is uncaught if there isn't one.
+ * Always called straight from the exported function, which is skipped along
+ * with this one in the backtrace.
+ */
+static EXCLIB_RAISE_ATTRS void exclib_raise(int value, char *desc, const struct exclib_message *msg,
+					    const struct exclib_payload *payload, const struct exclib_site *site,
+					    const struct exclib_cause *had, int nhad)
+{
+    struct exclib_cause causes[EXC_MAX_CAUSES];
+    struct exclib_status *es = EXCLIB_EXCEPTION;
+    struct exclib_frame_info *info;
+    int ncauses = nhad < EXC_MAX_CAUSES ? nhad : EXC_MAX_CAUSES;
+    int uncaught;
+    int idx;
+
+    if ( ncauses > 0 )
+	memcpy(causes, had, ncauses * sizeof(struct exclib_cause));
+    /* before the frames it leaves, so a trace sees them in order */
+    EXCLIB_PROBE_EXC_DESC(throw, value, site, __exclib_curidx - 1, desc);
+    EXCLIB_RECORD(EXCLIB_STAT_THROWN, value, site, __exclib_curidx - 1, desc);
+    EXCLIB_PROFILE_THROW();
+
+    while ( es ) {
+	if ( !(es->flags & EXCLIB_F_UNWOUND) ) {
+	    es = exclib_skip_frames(es, value);
+	    if ( !(es->flags & EXCLIB_F_UNWOUND) )
+		break;
+	}
+	idx = __exclib_curidx - 1;
+	ncauses = exclib_chain_causes(causes, ncauses, idx);
+	if ( idx == 0 )
+	    break;
+	/* this frame's ETRY never runs, so pop it here */
+	if ( es->flags & EXCLIB_F_CAUGHT ) {
+	    EXCLIB_STAT(EXCLIB_STAT_CAUGHT, es->value, es->site);
+	    EXCLIB_RECORD(EXCLIB_STAT_CAUGHT, es->value, es->site, idx, NULL);
+	} else {
+	    EXCLIB_STAT(EXCLIB_STAT_PROPAGATED, es->value, es->site);
+	    EXCLIB_PROBE_EXC(propagate, es->value, es->site, idx);
+	    EXCLIB_RECORD(EXCLIB_STAT_PROPAGATED, es->value, es->site, idx, NULL);
+	    EXCLIB_PROFILE_HOP(es->site);
+	}
+	__exclib_curidx--;
+	exclib_run_defers(idx);
+	es = EXCLIB_EXCEPTION = exclib_frame_at(idx - 1);
+    }
+    if ( !es || !(es->flags & EXCLIB_F_TRIED) ) {
+	exclib_capture_backtrace(2);
+	exclib_no_context(value, site);
+    }
+    /* still unwound means it's the outermost frame, and it was already handling something */
+    uncaught = (es->flags & EXCLIB_F_UNWOUND);
+    es->flags &= ~(EXCLIB_F_CAUGHT | EXCLIB_F_CATCHING);
+    info = exclib_mark_thrown(es, value, desc, site);
+    if ( msg )
+	info->msg = *msg;
+    if ( payload )
+	info->payload = *payload;
+    memcpy(info->causes, causes, ncauses * sizeof(struct exclib_cause));
+    info->ncauses = ncauses;
+    exclib_capture_backtrace(2);
+    EXCLIB_STAT(EXCLIB_STAT_THROWN, value, site);
+    if ( uncaught ) {
+	EXCLIB_STAT(EXCLIB_STAT_UNCAUGHT, value, es->site);
+	EXCLIB_PROBE_EXC_DESC(uncaught, value, es->site, __exclib_curidx - 1, desc);
+	EXCLIB_RECORD(EXCLIB_STAT_UNCAUGHT, value, es->site, __exclib_curidx - 1, desc);
+	if ( exclib_report_allowed(value, site) )
+	    exclib_print_exception_stack("Uncaught exception", (char *)site->file, (char *)site->function, site->line);
+	exclib_raise_uncaught(value);
+    }
+    /* out of the fault handler, if that's where this came from */
+    __exclib_faulting = 0;
+    if ( es->flags & EXCLIB_F_NATIVE )
+	__exclib_native_throw(__exclib_curidx - 1);
+    EXCLIB_LONGJMP(es->buf, value);
+}
+
+void exclib_throw(int value, char *msg, const struct exclib_site *site)
+{
+    exclib_raise(value, msg, NULL, NULL, site, NULL, 0);
+}
+
+void exclib_throw_payload(int value, char *msg, int type, unsigned long data, const struct exclib_site *site)
+{
+    struct exclib_payload payload;
+
+    payload.type = type;
+    payload.value = data;
+    exclib_raise(value, msg, NULL, &payload, site, NULL, 0);
+}
+
+/*
+ * Keeps what fmt's conversions will need when the message is printed, without
+ * printing it; exclib_format_message is the other half, and the two have to
+ * agree on what takes an argument. Arguments past EXC_MESSAGE_ARGS are
+ * dropped, and print as "?". A conversion outside what THROWF understands
+ * (see exclib.h) would leave the rest of the arguments out of step, so it's
+ * reported and nothing from it on is kept.
+ */
+void exclib_throwf(int value, const struct exclib_site *site, const char *fmt, ...)
+{
+    struct exclib_message msg;
+    va_list ap;
+    const char *p;
+    const char *spec;
+    const char *s;
+    unsigned int text = 0;
+    int lng;
+    int n;
+    long l = 0;
+    unsigned long u = 0;
+    double d = 0;
+    const void *ptr = NULL;
+    char kind;
+
+    msg.fmt = fmt;
+    msg.nargs = 0;
+    va_start(ap, fmt);
+    for ( p = fmt; *p; p++ ) {
+	if ( *p != '%' )
+	    continue;
+	spec = p;
+	for ( p++; *p == '-' || *p == '0' || *p == '+' || *p == ' ' || *p == '#'; p++ )
+	    ;
+	/* a * width or precision is an int argument of its own, kept like any other */
+	for ( ; (*p >= '0' && *p <= '9') || *p == '.' || *p == '*'; p++ ) {
+	    if ( *p != '*' )
+		continue;
+	    n = va_arg(ap, int);
+	    if ( msg.nargs < EXC_MESSAGE_ARGS )
+		msg.args[msg.nargs++].l = n;
+	}
+	/* 1 for a long (l, ll, z, j, t), 2 for a long double (L) */
+	for ( lng = 0; *p == 'h' || *p == 'l' || *p == 'z' || *p == 'j' || *p == 't' || *p == 'L'; p++ )
+	    lng = (*p == 'L') ? 2 : (*p == 'h' ? lng : 1);
+	kind = *p;
+	switch ( kind ) {
+	case 'd': case 'i':
+	    l = lng ? va_arg(ap, long) : (long)va_arg(ap, int);
+	    break;
+	case 'u': case 'x': case 'X': case 'o':
+	    u = lng ? va_arg(ap, unsigned long) : (unsigned long)va_arg(ap, unsigned int);
+	    break;
+	case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+	    d = lng == 2 ? (double)va_arg(ap, long double) : va_arg(ap, double);
+	    break;
+	case 'c':
+	    if ( lng )
+		goto unsupported;
+	    l = (long)va_arg(ap, int);
+	    break;
+	case 's':
+	    if ( lng )
+		goto unsupported;
+	    ptr = va_arg(ap, const void *);
+	    break;
+	case 'p':
+	    ptr = va_arg(ap, const void *);
+	    break;
+	case 'n':
+	    /* nothing is ever written through it; it prints nothing */
+	    (void)va_arg(ap, void *);
+	    continue;
+	case '%':
+	    continue;
+	case '\0':
+	    p--;
+	    continue;
+	default:
+	    goto unsupported;
+	}
+	if ( msg.nargs == EXC_MESSAGE_ARGS )
+	    continue;
+	switch ( kind ) {
+	case 'd': case 'i': case 'c':
+	    msg.args[msg.nargs].l = l;
+	    break;
+	case 'u': case 'x': case 'X': case 'o':
+	    msg.args[msg.nargs].u = u;
+	    break;
+	case 's':
+	    /* the string may well be on a stack the longjmp is about to unwind, so it's copied */
+	    msg.args[msg.nargs].u = text;
+	    for ( s = ptr ? (const char *)ptr : "(null)"; *s && text < EXC_MESSAGE_TEXT - 1; s++ )
+		msg.text[text++] = *s;
+	    msg.text[text] = '\0';
+	    if ( text < EXC_MESSAGE_TEXT - 1 )
+		text++;
+	    break;
+	case 'p':
+	    msg.args[msg.nargs].p = ptr;
+	    break;
+	default:
+	    msg.args[msg.nargs].d = d;
+	    break;
+	}
+	msg.nargs++;
+    }
+    goto done;
+unsupported:
+    exclib_print_bad_format(site, spec, (int)(p - spec + 1), fmt);
+done:
+    va_end(ap);
+    exclib_raise(value, (char *)fmt, &msg, NULL, site, NULL, 0);
+}
+
+/*
+ * Copies the exception the current frame is handling into *out, where it can
+ * outlive the frame and go to another thread; out->exception.value is 0 if
+ * nothing was thrown. The description is the THROW's pointer, so like the
+ * THROW it has to stay valid; THROWF's %s arguments are already copies.
+ */
+void exclib_exception_capture(struct exclib_captured *out)
+{
+    struct exclib_status *es = EXCLIB_EXCEPTION;
+    struct exclib_cause cause[EXC_MAX_CAUSES];
+    struct exclib_frame_info *info;
+
+    memset(out, 0, sizeof(*out));
+    if ( !es || !(es->flags & EXCLIB_F_THROWN) )
+	return;
+    /* the first link of a chain is the frame's own exception, filled in the way the frame's causes were */
+    exclib_chain_causes(cause, 0, __exclib_curidx - 1);
+    info = exclib_frame_info_at(__exclib_curidx - 1);
+    out->exception = cause[0];
+    out->ncauses = info->ncauses;
+    memcpy(out->causes, info->causes, info->ncauses * sizeof(struct exclib_cause));
+}
+
+/* EXCLIB_RETHROW: throws a captured exception again, in this thread, as if from where it was first thrown */
+void exclib_rethrow(const struct exclib_captured *captured)
+{
+    const struct exclib_cause *c = &captured->exception;
+
+    if ( c->value == 0 )
+	return;
+    exclib_raise(c->value, c->description, c->msg.fmt ? &c->msg : NULL, &c->payload, c->site,
+		 captured->causes, captured->ncauses);
+}
+
+void exclib_new_exc_frame(const struct exclib_site *site)
+{
+    struct exclib_status *es;
+
+    if ( !__exclib_frames )
+	exclib_use_context(&__exclib_thread_context);
+    if ( __exclib_curidx < EXC_INLINE_FRAMES )
+	es = &__exclib_frames[__exclib_curidx];
+    else if ( (es = exclib_frame_grow(__exclib_curidx)) == NULL ) {
+	/* the TRY can't go ahead; it becomes a THROW into the frame it's nested in (or that frame's parent) */
+	exclib_throw(EXC_OUTOFFRAMES, "No available exception stack context", site);
+    }
+    __exclib_curidx++;
     es->value = 0;
-    es->caught = 0;
-    es->tried = 0;
-    es->catching = 0;
+    es->flags = EXCLIB_F_TRIED;
+    es->site = site;
     EXCLIB_EXCEPTION = es;
-    return 0;
+    EXCLIB_PROBE_TRY(site, __exclib_curidx - 1);
+    EXCLIB_PROFILE_TRY();
+}
+
+const struct exclib_site *exclib_frame_site(int idx)
+{
+    if ( exclib_frame_at(idx)->flags & EXCLIB_F_RAISED )
+	return exclib_frame_info_at(idx)->site;
+    return exclib_frame_at(idx)->site;
 }
 
 int exclib_clear_exc_frame()
 {
     struct exclib_status *es = EXCLIB_EXCEPTION;
+    struct exclib_status *up;
+    struct exclib_frame_info *info;
+    struct exclib_frame_info *upinfo;
+    const struct exclib_site *site;
+    int idx = __exclib_curidx - 1;
+
     if ( !es ) {
 	exclib_print_exception_stack("exclib_clear_exc_frame was called but there were no exception frames to clear!",
 			   __FILE__, (char *)__func__, __LINE__);
 	exit(1);
     }
-    if ( es->prev )
-      es->prev->next = NULL;
-    if ( es->thrown && !es->caught ) {
+    info = exclib_frame_info_at(idx);
+    /* the frame's handlers are done with whatever these were looking after */
+    exclib_run_defers(idx);
+    if ( (es->flags & (EXCLIB_F_THROWN | EXCLIB_F_CAUGHT)) == EXCLIB_F_THROWN ) {
 	/* thrown exception was unhandled - do we have anywhere else to go? */
-        if ( !es->prev ) {
+        if ( idx == 0 ) {
 	  /* No frame above us to propagate this into, stacktrace and kill ourselves */
-	  exclib_print_exception_stack("Uncaught exception", es->file, es->function, es->line);
-	  exit(es->value);
-	} else if ( es->tried && es->prev && (es->catching == 0)) {
-	  /* copy this exception up into the upper frame and siglongjmp back to that */
-	  EXCLIB_EXCEPTION = es->prev;
-	  EXCLIB_EXCEPTION->caught = 0;
-	  EXCLIB_EXCEPTION->name = es->name;
-	  EXCLIB_EXCEPTION->description = es->description;
-	  int val = es->value;
-	  THROW_EXPLICIT(val, 
-			 EXCLIB_EXCEPTION->description, 
-			 EXCLIB_EXCEPTION->file,
-			 EXCLIB_EXCEPTION->function,
-			 EXCLIB_EXCEPTION->line,
-			 0);
+	  EXCLIB_STAT(EXCLIB_STAT_UNCAUGHT, es->value, es->site);
+	  EXCLIB_PROBE_EXC_DESC(uncaught, es->value, es->site, idx, info->description);
+	  EXCLIB_RECORD(EXCLIB_STAT_UNCAUGHT, es->value, es->site, idx, info->description);
+	  site = exclib_frame_site(idx);
+	  if ( exclib_report_allowed(es->value, site) )
+	    exclib_print_exception_stack("Uncaught exception", (char *)site->file, (char *)site->function, site->line);
+	  exclib_raise_uncaught(es->value);
+	}
+	/* copy this exception up into the upper frame and longjmp back to that */
+	EXCLIB_STAT(EXCLIB_STAT_PROPAGATED, es->value, es->site);
+	EXCLIB_PROBE_EXC(propagate, es->value, es->site, idx);
+	EXCLIB_RECORD(EXCLIB_STAT_PROPAGATED, es->value, es->site, idx, NULL);
+	EXCLIB_PROFILE_HOP(es->site);
+	__exclib_curidx--;
+	up = EXCLIB_EXCEPTION = exclib_skip_frames(exclib_frame_at(idx - 1), es->value);
+	up->flags = (up->flags & ~EXCLIB_F_CAUGHT) | EXCLIB_F_THROWN;
+	up->value = es->value;
+	upinfo = exclib_frame_info_at(__exclib_curidx - 1);
+	upinfo->name = info->name;
+	upinfo->description = info->description;
+	upinfo->msg.fmt = NULL;
+	if ( info->msg.fmt )
+	  upinfo->msg = info->msg;
+	upinfo->payload = info->payload;
+	memcpy(upinfo->causes, info->causes, info->ncauses * sizeof(struct exclib_cause));
+	upinfo->ncauses = info->ncauses;
+	if ( !(up->flags & EXCLIB_F_UNWOUND) ) {
+	  up->flags |= EXCLIB_F_UNWOUND;
+	  if ( up->flags & EXCLIB_F_NATIVE )
+	    __exclib_native_throw(__exclib_curidx - 1);
+	  EXCLIB_LONGJMP(up->buf, up->value);
 	}
-    } else {
-      if ( es->prev) {
-	EXCLIB_EXCEPTION = es->prev;
-      }
-      memset((void *)es, 0x00, sizeof(struct exclib_status));
+	/* the upper frame is already in its EXCEPT block; the exception goes on up from its ETRY */
+	return 0;
+    }
+    /* handled, or nothing was thrown: just pop, nothing needs wiping */
+    if ( es->flags & EXCLIB_F_THROWN ) {
+      EXCLIB_STAT(EXCLIB_STAT_CAUGHT, es->value, es->site);
+      EXCLIB_RECORD(EXCLIB_STAT_CAUGHT, es->value, es->site, idx, NULL);
     }
+    if ( __exclib_throwidx >= idx ) {
+      __exclib_throwidx = -1;
+      __exclib_backtrace_len = 0;
+    }
+    __exclib_curidx--;
+    EXCLIB_EXCEPTION = idx > 0 ? exclib_frame_at(idx - 1) : NULL;
     return 0;
 }
 
+/*
+ * ETRY_BATCH's half: the batch's frame caught what an item threw. The item's
+ * result gets it, and the frame goes back to how TRY_BATCH armed it.
+ */
+void exclib_batch_failed(struct exclib_batch_result *result)
+{
+    struct exclib_status *es = EXCLIB_EXCEPTION;
+    int idx = __exclib_curidx - 1;
+
+    result->value = es->value;
+    result->description = exclib_frame_info_at(idx)->description;
+    EXCLIB_STAT(EXCLIB_STAT_CAUGHT, es->value, es->site);
+    EXCLIB_PROBE_EXC(catch, es->value, es->site, idx);
+    EXCLIB_RECORD(EXCLIB_STAT_CAUGHT, es->value, es->site, idx, NULL);
+    EXCLIB_PROFILE_CATCH();
+    exclib_run_defers(idx);
+    es->value = 0;
+    es->flags = EXCLIB_F_TRIED;
+    if ( __exclib_throwidx >= idx ) {
+	__exclib_throwidx = -1;
+	__exclib_backtrace_len = 0;
+    }
+}
+
+/*
+ * Calls fn(items, i) for each i from 0 to n-1 under one TRY_BATCH frame,
+ * filling in results[i] for each. Returns how many of them threw.
+ */
+int exclib_try_batch(exclib_batch_fn fn, void *items, int n, struct exclib_batch_result *results)
+{
+    volatile int i;
+    int failed = 0;
+
+    TRY_BATCH(i, n, results) {
+	fn(items, i);
+    } ETRY_BATCH;
+    for ( i = 0; i < n; i++ )
+	failed += results[i].value != 0;
+    return failed;
+}
+
+/*
+ * A C++ TRY (EXCLIB_CXX) caught an exclib::exception thrown into frame idx.
+ * Any frames above it were unwound by C++ without their ETRY running; they're
+ * dropped here. One thrown with a plain C++ throw never went through
+ * exclib_raise, so the frame is filled in as if it had been THROWn at its TRY.
+ */
+void exclib_native_catch(int idx, int value, char *description)
+{
+    struct exclib_status *es = exclib_frame_at(idx);
+
+    exclib_run_defers(idx + 1);
+    __exclib_curidx = idx + 1;
+    EXCLIB_EXCEPTION = es;
+    if ( es->flags & EXCLIB_F_UNWOUND )
+	return;
+    exclib_mark_thrown(es, value, description, es->site);
+    __exclib_backtrace_len = 0;
+    EXCLIB_STAT(EXCLIB_STAT_THROWN, value, es->site);
+    EXCLIB_PROBE_EXC_DESC(throw, value, es->site, idx, description);
+    EXCLIB_RECORD(EXCLIB_STAT_THROWN, value, es->site, idx, description);
+}
+
+/* A C++ TRY's frame is going out of scope without its ETRY: pops it, and whatever is still above it */
+void exclib_native_pop(int idx)
+{
+    exclib_run_defers(idx);
+    __exclib_curidx = idx;
+    EXCLIB_EXCEPTION = idx > 0 ? exclib_frame_at(idx - 1) : NULL;
+    if ( __exclib_throwidx >= idx ) {
+	__exclib_throwidx = -1;
+	__exclib_backtrace_len = 0;
+    }
+}
+
+struct exclib_context *exclib_context_create()
+{
+    struct exclib_context *ctx = (struct exclib_context *)calloc(1, sizeof(struct exclib_context));
+
+    if ( ctx ) {
+	ctx->throwidx = -1;
+	/* its arena's chunks go with exclib_context_destroy, not the thread */
+	ctx->arena.context = 1;
+    }
+    return ctx;
+}
+
+/* Frees a context made by exclib_context_create; it mustn't be the active one */
+void exclib_context_destroy(struct exclib_context *ctx)
+{
+    int i;
+
+    if ( !ctx )
+	return;
+    for ( i = 0; i < EXCLIB_SEGMENTS; i++ )
+	free(ctx->segments.mem[i]);
+    exclib_arena_destroy(&ctx->arena);
+    free(ctx);
+}
+
+/*
+ * Parks the active frame stack and picks up ctx's where it was left, or the
+ * thread's own for NULL; returns the one that was active, NULL again meaning
+ * the thread's own. Nothing is copied, only where the stack is. The thread's
+ * backtrace isn't part of a context, so it's forgotten rather than left to
+ * turn up in the next context's reports.
+ */
+struct exclib_context *exclib_context_switch(struct exclib_context *ctx)
+{
+    struct exclib_context *from = __exclib_context;
+    struct exclib_context *cur = from ? from : &__exclib_thread_context;
+
+    cur->curidx = __exclib_curidx;
+    cur->throwidx = __exclib_throwidx;
+    cur->ndefers = __exclib_ndefers;
+    cur->exception = EXCLIB_EXCEPTION;
+    if ( !ctx )
+	ctx = &__exclib_thread_context;
+    __exclib_context = ctx == &__exclib_thread_context ? NULL : ctx;
+    exclib_use_context(ctx);
+    __exclib_curidx = ctx->curidx;
+    __exclib_throwidx = ctx->throwidx;
+    __exclib_ndefers = ctx->ndefers;
+    EXCLIB_EXCEPTION = ctx->exception;
+    __exclib_backtrace_len = 0;
+    return from;
+}
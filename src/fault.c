@@ -0,0 +1,190 @@
+#define _GNU_SOURCE
+#include "exclib.h"
+#include <pthread.h>
+#include <errno.h>
+
+/*
+ * The fault translator. A SIGSEGV, SIGBUS, SIGFPE or SIGILL that exclib has
+ * been asked to translate is thrown, from inside its signal handler, into
+ * the innermost TRY as the code it was given, with the faulting address as
+ * an EXCLIB_PAYLOAD_PTR. The handler leaves through the same longjmp a THROW
+ * does; it's installed with SA_NODEFER so that longjmp doesn't leave the
+ * signal blocked for the next fault.
+ *
+ * A SIGSEGV just below the thread's stack is a stack overflow, and goes in
+ * as EXC_STACKOVERFLOW. For the handler to be able to run at all then, it
+ * needs a stack of its own: exclib_fault_thread_init sets one up, and looks
+ * up where the thread's stack ends and anything else THROW would otherwise
+ * look up lazily, since none of that is safe to do from a handler.
+ *
+ * For the same reason the handler raises with __exclib_faulting set, until
+ * exclib_raise longjmps out: the counters, the profiler and the flight
+ * recorder then drop anything that would need a lock or an allocation.
+ * exclib_fault_prepare makes what a fault needs ahead of time (the thread's
+ * stats shard with a slot for each translated code, its profiler shard, its
+ * flight recorder ring), so a thread's first fault is counted like the rest.
+ */
+
+/* a fault this far below the bottom of the stack (or in its first page) counts as an overflow */
+#define EXCLIB_FAULT_OVERFLOW_REACH (1024 * 1024)
+#define EXCLIB_FAULT_PAGE           4096
+
+static int __exclib_fault_codes[NSIG];
+EXCLIB_TLS int __exclib_faulting = 0;
+static EXCLIB_TLS char *__exclib_fault_stack_lo = NULL;
+static EXCLIB_TLS void *__exclib_fault_altstack = NULL;
+static pthread_key_t __exclib_fault_key;
+static pthread_once_t __exclib_fault_once = PTHREAD_ONCE_INIT;
+
+static void exclib_fault_thread_exit(void *mem)
+{
+    stack_t ss;
+
+    memset(&ss, 0, sizeof(ss));
+    ss.ss_flags = SS_DISABLE;
+    sigaltstack(&ss, NULL);
+    free(mem);
+}
+
+static void exclib_fault_key_init(void)
+{
+    pthread_key_create(&__exclib_fault_key, exclib_fault_thread_exit);
+}
+
+/* Sets the calling thread up so a fault needs nothing from the counters, profiler or recorder that isn't there yet */
+static void exclib_fault_prepare(void)
+{
+    int signal;
+
+    exclib_stats_prepare(EXC_STACKOVERFLOW);
+    for ( signal = 1; signal < NSIG; signal++ ) {
+	if ( __exclib_fault_codes[signal] )
+	    exclib_stats_prepare(__exclib_fault_codes[signal]);
+    }
+    exclib_profile_prepare();
+    exclib_recorder_prepare();
+}
+
+/*
+ * Gives the calling thread a signal stack for the fault handler, and gets
+ * it ready to count, profile and record faults. Call it from each thread
+ * that should get EXC_STACKOVERFLOW (exclib_translate_fault does it for its
+ * own), after translation is set up; calling it again only does the
+ * latter. Returns 0, or -1 with errno set.
+ */
+int exclib_fault_thread_init()
+{
+    pthread_attr_t attr;
+    stack_t ss;
+    void *addr;
+    size_t size;
+
+    if ( __exclib_fault_altstack ) {
+	exclib_fault_prepare();
+	return 0;
+    }
+    exclib_init();
+    if ( pthread_getattr_np(pthread_self(), &attr) == 0 ) {
+	if ( pthread_attr_getstack(&attr, &addr, &size) == 0 )
+	    __exclib_fault_stack_lo = (char *)addr;
+	pthread_attr_destroy(&attr);
+    }
+    ss.ss_sp = malloc(EXC_FAULT_STACK_SIZE);
+    if ( !ss.ss_sp )
+	return -1;
+    ss.ss_size = EXC_FAULT_STACK_SIZE;
+    ss.ss_flags = 0;
+    if ( sigaltstack(&ss, NULL) != 0 ) {
+	free(ss.ss_sp);
+	return -1;
+    }
+    __exclib_fault_altstack = ss.ss_sp;
+    pthread_once(&__exclib_fault_once, exclib_fault_key_init);
+    pthread_setspecific(__exclib_fault_key, ss.ss_sp);
+    exclib_fault_prepare();
+    return 0;
+}
+
+/* signal 0 is a stack overflow */
+static char *exclib_fault_description(int signal)
+{
+    switch ( signal ) {
+    case SIGSEGV:
+	return "Segmentation fault";
+    case SIGBUS:
+	return "Bus error";
+    case SIGFPE:
+	return "Arithmetic fault";
+    case SIGILL:
+	return "Illegal instruction";
+    default:
+	return "Stack overflow";
+    }
+}
+
+static void exclib_fault_handler(int signal, siginfo_t *si, void *context)
+{
+    EXCLIB_SITE(__exclib_fault_site, EXCLIB_SITE_THROW);
+    struct sigaction dfl;
+    char *addr = (char *)si->si_addr;
+    char *lo = __exclib_fault_stack_lo;
+    int code = __exclib_fault_codes[signal];
+
+    (void)context;
+    /* sent rather than a fault (an uncaught exception re-raising it, say), or nowhere to throw it */
+    if ( si->si_code <= 0 || code == 0 || !EXCLIB_EXCEPTION || !(EXCLIB_EXCEPTION->flags & EXCLIB_F_TRIED) ) {
+	memset(&dfl, 0, sizeof(dfl));
+	dfl.sa_handler = SIG_DFL;
+	sigemptyset(&dfl.sa_mask);
+	sigaction(signal, &dfl, NULL);
+	/* a fault comes straight back when we return and now kills us; a sent signal has to be sent again */
+	if ( si->si_code <= 0 )
+	    raise(signal);
+	return;
+    }
+    if ( signal == SIGSEGV && lo && addr < lo + EXCLIB_FAULT_PAGE && addr + EXCLIB_FAULT_OVERFLOW_REACH >= lo ) {
+	code = EXC_STACKOVERFLOW;
+	signal = 0;
+    }
+    __exclib_faulting = 1;
+    exclib_throw_payload(code, exclib_fault_description(signal), EXCLIB_PAYLOAD_PTR, (unsigned long)addr, &__exclib_fault_site);
+}
+
+/*
+ * From now on signal (SIGSEGV, SIGBUS, SIGFPE or SIGILL) in a TRY is thrown
+ * as code; a code of 0 goes back to the default action. Returns 0, or -1
+ * with errno set.
+ */
+int exclib_translate_fault(int signal, int code)
+{
+    struct sigaction sa;
+
+    if ( signal != SIGSEGV && signal != SIGBUS && signal != SIGFPE && signal != SIGILL ) {
+	errno = EINVAL;
+	return -1;
+    }
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+    if ( code == 0 ) {
+	sa.sa_handler = SIG_DFL;
+	__exclib_fault_codes[signal] = 0;
+	return sigaction(signal, &sa, NULL);
+    }
+    if ( exclib_fault_thread_init() != 0 )
+	return -1;
+    __exclib_fault_codes[signal] = code;
+    exclib_fault_prepare();
+    sa.sa_sigaction = exclib_fault_handler;
+    sa.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_NODEFER;
+    return sigaction(signal, &sa, NULL);
+}
+
+/* The usual mapping: SIGSEGV, SIGBUS and SIGFPE to EXC_NULLPOINTER, EXC_BUSERROR and EXC_ARITHMETIC */
+int exclib_translate_faults()
+{
+    if ( exclib_translate_fault(SIGSEGV, EXC_NULLPOINTER) != 0 ||
+	 exclib_translate_fault(SIGBUS, EXC_BUSERROR) != 0 ||
+	 exclib_translate_fault(SIGFPE, EXC_ARITHMETIC) != 0 )
+	return -1;
+    return 0;
+}
@@ -0,0 +1,213 @@
+#define _POSIX_C_SOURCE 200112L
+#include "exclib.h"
+#include <pthread.h>
+
+/*
+ * exclib_parallel_for: [0, n) is dealt out in even slices to nthreads
+ * workers (the caller is worker 0, the rest are threads started for the
+ * call). Each takes chunks off the front of its own slice, and once that's
+ * empty steals the back half of whichever slice has the most left, so an
+ * uneven load still ends with everyone busy. A slice is a pair of bounds
+ * under a mutex that's only contended while a steal is going on.
+ *
+ * Every chunk runs in a TRY on the worker's own frame stack. The first
+ * exception a worker catches is captured along with the iteration it came
+ * from, and stops everyone from starting new chunks. When they've all
+ * finished, the caller rethrows.
+ */
+
+#define EXCLIB_PFOR_CHUNKS_PER_WORKER 8
+
+struct exclib_pfor;
+
+struct exclib_pfor_worker {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    long lo;                        /* what's left of this worker's slice */
+    long hi;
+    int started;
+    struct exclib_pfor *job;
+    long failed_at;                 /* -1, or the iteration whose exception is in failure */
+    struct exclib_captured failure;
+};
+
+struct exclib_pfor {
+    exclib_for_fn fn;
+    void *arg;
+    long chunk;
+    int nworkers;
+    int stop;
+    struct exclib_pfor_worker *workers;
+};
+
+static void exclib_pfor_run(struct exclib_pfor_worker *w, long lo, long hi)
+{
+    struct exclib_pfor *job = w->job;
+    volatile long i = lo;
+
+    TRY {
+	for ( ; i < hi && !__atomic_load_n(&job->stop, __ATOMIC_RELAXED); i++ )
+	    job->fn(i, job->arg);
+    } CLEANUP {
+    } EXCEPT {
+    } DEFAULT {
+	exclib_exception_capture(&w->failure);
+	w->failed_at = i;
+	__atomic_store_n(&job->stop, 1, __ATOMIC_RELAXED);
+    } FINALLY {
+    } ETRY;
+}
+
+/* Moves the back half of the fullest other slice into w's; 0 when there's nothing left anywhere */
+static int exclib_pfor_steal(struct exclib_pfor_worker *w)
+{
+    struct exclib_pfor *job = w->job;
+    struct exclib_pfor_worker *victim;
+    long most;
+    long left;
+    long mid;
+    int i;
+
+    for ( ;; ) {
+	victim = NULL;
+	most = 0;
+	for ( i = 0; i < job->nworkers; i++ ) {
+	    if ( &job->workers[i] == w )
+		continue;
+	    left = __atomic_load_n(&job->workers[i].hi, __ATOMIC_RELAXED) - __atomic_load_n(&job->workers[i].lo, __ATOMIC_RELAXED);
+	    if ( left > most ) {
+		most = left;
+		victim = &job->workers[i];
+	    }
+	}
+	if ( !victim )
+	    return 0;
+	pthread_mutex_lock(&victim->lock);
+	left = victim->hi - victim->lo;
+	if ( left <= 0 ) {
+	    /* someone got there first; look again */
+	    pthread_mutex_unlock(&victim->lock);
+	    continue;
+	}
+	mid = victim->lo + left / 2;
+	pthread_mutex_lock(&w->lock);
+	w->lo = mid;
+	w->hi = victim->hi;
+	pthread_mutex_unlock(&w->lock);
+	victim->hi = mid;
+	pthread_mutex_unlock(&victim->lock);
+	return 1;
+    }
+}
+
+static void *exclib_pfor_worker_main(void *arg)
+{
+    struct exclib_pfor_worker *w = (struct exclib_pfor_worker *)arg;
+    struct exclib_pfor *job = w->job;
+    long lo;
+    long hi;
+
+    while ( !__atomic_load_n(&job->stop, __ATOMIC_RELAXED) ) {
+	pthread_mutex_lock(&w->lock);
+	lo = w->lo;
+	hi = w->hi - lo > job->chunk ? lo + job->chunk : w->hi;
+	w->lo = hi;
+	pthread_mutex_unlock(&w->lock);
+	if ( lo < hi )
+	    exclib_pfor_run(w, lo, hi);
+	else if ( !exclib_pfor_steal(w) )
+	    break;
+    }
+    return NULL;
+}
+
+/*
+ * Calls fn(i, arg) for every i in [0, n) on nthreads threads (the caller's
+ * included; 0 for one per online CPU), and returns once they're all done.
+ * If any of them threw, the one with the lowest i is rethrown here, or
+ * EXC_PARALLEL with them as its causes if there was more than one.
+ */
+void exclib_parallel_for(long n, exclib_for_fn fn, void *arg, int nthreads)
+{
+    EXCLIB_SITE(site, EXCLIB_SITE_THROW);
+    struct exclib_pfor job;
+    struct exclib_pfor_worker one;
+    struct exclib_pfor_worker *w;
+    struct exclib_pfor_worker *order[EXC_MAX_CAUSES];
+    struct exclib_captured result;
+    int nfailed = 0;
+    int i;
+    int j;
+
+    if ( n <= 0 )
+	return;
+    if ( nthreads <= 0 )
+	nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if ( nthreads <= 0 )
+	nthreads = 1;
+    if ( nthreads > n )
+	nthreads = (int)n;
+    job.fn = fn;
+    job.arg = arg;
+    job.stop = 0;
+    job.workers = nthreads > 1 ? (struct exclib_pfor_worker *)calloc(nthreads, sizeof(struct exclib_pfor_worker)) : NULL;
+    if ( !job.workers ) {
+	nthreads = 1;
+	memset(&one, 0, sizeof(one));
+	job.workers = &one;
+    }
+    job.nworkers = nthreads;
+    job.chunk = n / ((long)nthreads * EXCLIB_PFOR_CHUNKS_PER_WORKER);
+    if ( job.chunk < 1 )
+	job.chunk = 1;
+
+    for ( i = 0; i < nthreads; i++ ) {
+	w = &job.workers[i];
+	pthread_mutex_init(&w->lock, NULL);
+	w->lo = n * i / nthreads;
+	w->hi = n * (i + 1) / nthreads;
+	w->job = &job;
+	w->failed_at = -1;
+    }
+    /* a worker that can't be started just leaves its slice for the others to steal */
+    for ( i = 1; i < nthreads; i++ )
+	job.workers[i].started = pthread_create(&job.workers[i].thread, NULL, exclib_pfor_worker_main, &job.workers[i]) == 0;
+    exclib_pfor_worker_main(&job.workers[0]);
+    for ( i = 1; i < nthreads; i++ ) {
+	if ( job.workers[i].started )
+	    pthread_join(job.workers[i].thread, NULL);
+    }
+
+    for ( i = 0; i < nthreads; i++ ) {
+	pthread_mutex_destroy(&job.workers[i].lock);
+	nfailed += job.workers[i].failed_at >= 0;
+    }
+    /* the first EXC_MAX_CAUSES failures, lowest iteration first */
+    for ( j = 0; j < nfailed && j < EXC_MAX_CAUSES; j++ ) {
+	order[j] = NULL;
+	for ( i = 0; i < nthreads; i++ ) {
+	    w = &job.workers[i];
+	    if ( w->failed_at >= 0 && (j == 0 || w->failed_at > order[j - 1]->failed_at) &&
+		 (!order[j] || w->failed_at < order[j]->failed_at) )
+		order[j] = w;
+	}
+    }
+    if ( nfailed == 1 )
+	result = order[0]->failure;
+    else if ( nfailed > 1 ) {
+	memset(&result, 0, sizeof(result));
+	result.exception.value = EXC_PARALLEL;
+	result.exception.site = &site;
+	result.exception.name = exclib_exception_name(EXC_PARALLEL);
+	result.exception.description = "More than one iteration threw";
+	result.exception.payload.type = EXCLIB_PAYLOAD_SIZE;
+	result.exception.payload.value = (unsigned long)nfailed;
+	for ( j = 0; j < nfailed && j < EXC_MAX_CAUSES; j++ )
+	    result.causes[j] = order[j]->failure.exception;
+	result.ncauses = j;
+    }
+    if ( job.workers != &one )
+	free(job.workers);
+    if ( nfailed > 0 )
+	EXCLIB_RETHROW(result);
+}
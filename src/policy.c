@@ -0,0 +1,174 @@
+#define _POSIX_C_SOURCE 200112L
+#include "exclib.h"
+#include <time.h>
+
+/*
+ * The reporting policy: which of the reports EXCLIB_TRACE and the uncaught
+ * paths want to print actually get printed, for when the same exception is
+ * being thrown a million times a second.
+ *
+ * Reports are keyed by (exception code, site) in a fixed table. A key prints
+ * its first report, then nothing for window_ms but every sample_every'th
+ * occurrence; whatever gets through that is also held to a token bucket of
+ * rate reports a second (burst at once) across all keys. What's held back is
+ * counted per key and reported as "suppressed N similar" the next time that
+ * key prints, every summary_ms from whichever report gets there first, or
+ * on exclib_report_flush_suppressed.
+ *
+ * All of it is atomics on the table and two globals: no locks, so it's safe
+ * from signal handlers, and a suppressed report costs a hash, a couple of
+ * atomic adds and a coarse clock read.
+ */
+
+struct exclib_report_key {
+    int state;                          /* 0 free, 1 being claimed, 2 in use */
+    int code;
+    const struct exclib_site *site;
+    unsigned long seen;                 /* held back by the window, for sampling */
+    unsigned long suppressed;
+    unsigned long next_ok;              /* ms; the next report from here that can print without being sampled */
+};
+
+#define EXCLIB_KEY_CLAIMING 1
+#define EXCLIB_KEY_USED     2
+
+static struct exclib_report_key __exclib_report_keys[EXC_REPORT_KEYS];
+static struct exclib_report_policy __exclib_report_policy;
+static int __exclib_report_policy_on = 0;
+static unsigned long __exclib_report_tat = 0;          /* ns; the token bucket, as a theoretical arrival time */
+static unsigned long __exclib_report_next_summary = 0; /* ms */
+
+static unsigned long exclib_policy_now_ns(void)
+{
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (unsigned long)ts.tv_sec * 1000000000UL + (unsigned long)ts.tv_nsec;
+}
+
+void exclib_set_report_policy(const struct exclib_report_policy *policy)
+{
+    if ( !policy ) {
+	__atomic_store_n(&__exclib_report_policy_on, 0, __ATOMIC_RELEASE);
+	return;
+    }
+    __exclib_report_policy = *policy;
+    __atomic_store_n(&__exclib_report_policy_on, 1, __ATOMIC_RELEASE);
+}
+
+static struct exclib_report_key *exclib_policy_key(int code, const struct exclib_site *site)
+{
+    unsigned int h = exclib_code_hash(code) ^ exclib_code_hash((int)((unsigned long)site >> 3));
+    unsigned int i;
+    unsigned int n;
+    int state;
+    struct exclib_report_key *k;
+
+    for ( n = 0, i = h & (EXC_REPORT_KEYS - 1); n < EXC_REPORT_KEYS; n++, i = (i + 1) & (EXC_REPORT_KEYS - 1) ) {
+	k = &__exclib_report_keys[i];
+	state = __atomic_load_n(&k->state, __ATOMIC_ACQUIRE);
+	if ( state == EXCLIB_KEY_USED ) {
+	    if ( k->code == code && k->site == site )
+		return k;
+	    continue;
+	}
+	/* a slot mid-claim is skipped; at worst a key ends up in two slots and its counts are split */
+	if ( state == 0 && __atomic_compare_exchange_n(&k->state, &state, EXCLIB_KEY_CLAIMING, 0,
+						       __ATOMIC_ACQ_REL, __ATOMIC_RELAXED) ) {
+	    k->code = code;
+	    k->site = site;
+	    __atomic_store_n(&k->state, EXCLIB_KEY_USED, __ATOMIC_RELEASE);
+	    return k;
+	}
+    }
+    return NULL;
+}
+
+/* One token from the bucket, GCRA style: a single CAS on the time the bucket next has room */
+static int exclib_policy_take_token(unsigned long now)
+{
+    unsigned long interval;
+    unsigned long limit;
+    unsigned long tat;
+    unsigned long next;
+
+    if ( __exclib_report_policy.rate == 0 )
+	return 1;
+    interval = 1000000000UL / __exclib_report_policy.rate;
+    limit = interval * (__exclib_report_policy.burst ? __exclib_report_policy.burst : 1);
+    tat = __atomic_load_n(&__exclib_report_tat, __ATOMIC_RELAXED);
+    do {
+	next = (tat > now ? tat : now) + interval;
+	if ( next - now > limit )
+	    return 0;
+    } while ( !__atomic_compare_exchange_n(&__exclib_report_tat, &tat, next, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED) );
+    return 1;
+}
+
+static void exclib_policy_summarize(struct exclib_report_key *k)
+{
+    unsigned long n = __atomic_exchange_n(&k->suppressed, 0, __ATOMIC_RELAXED);
+
+    if ( n > 0 )
+	exclib_print_suppressed(k->code, k->site, n);
+}
+
+void exclib_report_flush_suppressed()
+{
+    int i;
+
+    for ( i = 0; i < EXC_REPORT_KEYS; i++ ) {
+	if ( __atomic_load_n(&__exclib_report_keys[i].state, __ATOMIC_ACQUIRE) == EXCLIB_KEY_USED )
+	    exclib_policy_summarize(&__exclib_report_keys[i]);
+    }
+}
+
+int exclib_report_allowed(int code, const struct exclib_site *site)
+{
+    struct exclib_report_key *k;
+    unsigned long now;
+    unsigned long ms;
+    unsigned long ok;
+    unsigned long seen;
+    int candidate = 1;
+
+    if ( !__atomic_load_n(&__exclib_report_policy_on, __ATOMIC_ACQUIRE) )
+	return 1;
+    now = exclib_policy_now_ns();
+    ms = now / 1000000UL;
+    k = exclib_policy_key(code, site);
+    if ( k ) {
+	if ( __exclib_report_policy.window_ms ) {
+	    ok = __atomic_load_n(&k->next_ok, __ATOMIC_RELAXED);
+	    candidate = (ms >= ok && __atomic_compare_exchange_n(&k->next_ok, &ok, ms + __exclib_report_policy.window_ms, 0,
+								   __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	    if ( !candidate && __exclib_report_policy.sample_every ) {
+		seen = __atomic_add_fetch(&k->seen, 1, __ATOMIC_RELAXED);
+		candidate = (seen % __exclib_report_policy.sample_every) == 0;
+	    }
+	}
+    }
+    if ( !candidate || !exclib_policy_take_token(now) ) {
+	if ( k )
+	    __atomic_add_fetch(&k->suppressed, 1, __ATOMIC_RELAXED);
+	return 0;
+    }
+    if ( k )
+	exclib_policy_summarize(k);
+    if ( __exclib_report_policy.summary_ms ) {
+	ok = __atomic_load_n(&__exclib_report_next_summary, __ATOMIC_RELAXED);
+	if ( ms >= ok && __atomic_compare_exchange_n(&__exclib_report_next_summary, &ok, ms + __exclib_report_policy.summary_ms, 0,
+						     __ATOMIC_RELAXED, __ATOMIC_RELAXED) )
+	    exclib_report_flush_suppressed();
+    }
+    return 1;
+}
+
+void exclib_trace(char *msg, const struct exclib_site *site)
+{
+    if ( exclib_report_allowed(EXCLIB_EXCEPTION ? EXCLIB_EXCEPTION->value : 0, site) )
+	exclib_print_exception_stack(msg, (char *)site->file, (char *)site->function, site->line);
+}
@@ -0,0 +1,505 @@
+#define _GNU_SOURCE
+#include "exclib.h"
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+/*
+ * The profiler; see exclib.h. Like the counters in stats.c, each thread
+ * records into a shard of its own with plain stores. __exclib_profile_lock is
+ * only taken for what changes a shard's layout (its first use, a site's first
+ * histograms) and by exclib_profile_snapshot walking the shards; a thread's
+ * shard is folded into __exclib_profile_retired when it exits. While the
+ * fault handler is raising (__exclib_faulting), neither can happen, so a hop
+ * out of a site that has no histograms yet isn't timed.
+ *
+ * An exception is timed from when exclib_profile_throw saw it thrown; each
+ * hop takes its time from __exclib_profile_last and moves it on. The catch
+ * clears __exclib_profile_thrown, so an exception the profiler didn't see
+ * thrown (it was off then, or it came from a plain C++ throw) isn't timed.
+ */
+
+struct exclib_profile_shard {
+    struct exclib_profile_shard *next;
+    struct exclib_profile_shard *prev;
+    int max_depth;
+    unsigned int nsites;
+    struct exclib_site_profile **sites;   /* by site ID, each allocated the first time it's needed */
+};
+
+int __exclib_profile_on = 0;
+/* the deepest this thread has been since the profiler was turned on */
+EXCLIB_TLS int __exclib_profile_depth = 0;
+static EXCLIB_TLS unsigned long __exclib_profile_thrown = 0;
+static EXCLIB_TLS unsigned long __exclib_profile_last = 0;
+static EXCLIB_TLS struct exclib_profile_shard *__exclib_profile_shard = NULL;
+static struct exclib_profile_shard *__exclib_profile_shards = NULL;
+static struct exclib_profile_shard __exclib_profile_retired;
+static pthread_mutex_t __exclib_profile_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t __exclib_profile_key;
+static pthread_once_t __exclib_profile_once = PTHREAD_ONCE_INIT;
+static double __exclib_profile_ns_per_tick = 1.0;
+
+/* Which bucket ns goes in: ns itself below EXCLIB_PROFILE_SUB, then EXCLIB_PROFILE_SUB to each power of two */
+static unsigned int exclib_profile_bucket(unsigned long ns)
+{
+    unsigned int e;
+    unsigned int b;
+
+    if ( ns < EXCLIB_PROFILE_SUB )
+	return (unsigned int)ns;
+    e = 63 - __builtin_clzl(ns);
+    b = (e - EXCLIB_PROFILE_SUB_BITS + 1) * EXCLIB_PROFILE_SUB +
+	(unsigned int)((ns >> (e - EXCLIB_PROFILE_SUB_BITS)) & (EXCLIB_PROFILE_SUB - 1));
+    return b < EXCLIB_PROFILE_BUCKETS ? b : EXCLIB_PROFILE_BUCKETS - 1;
+}
+
+/* The most ns that goes in bucket b */
+static unsigned long exclib_profile_bucket_top(unsigned int b)
+{
+    unsigned int e;
+
+    if ( b < EXCLIB_PROFILE_SUB )
+	return b;
+    e = b / EXCLIB_PROFILE_SUB + EXCLIB_PROFILE_SUB_BITS - 1;
+    return ((unsigned long)(EXCLIB_PROFILE_SUB + b % EXCLIB_PROFILE_SUB + 1) << (e - EXCLIB_PROFILE_SUB_BITS)) - 1;
+}
+
+/* Caller holds __exclib_profile_lock */
+static void exclib_profile_merge_latency(struct exclib_latency *dst, const struct exclib_latency *src)
+{
+    unsigned long max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+    unsigned int b;
+
+    for ( b = 0; b < EXCLIB_PROFILE_BUCKETS; b++ )
+	dst->bucket[b] += __atomic_load_n(&src->bucket[b], __ATOMIC_RELAXED);
+    dst->n += __atomic_load_n(&src->n, __ATOMIC_RELAXED);
+    if ( max > dst->max )
+	dst->max = max;
+}
+
+/* Caller holds __exclib_profile_lock */
+static void exclib_profile_merge(struct exclib_profile_shard *dst, struct exclib_profile_shard *src)
+{
+    unsigned int i;
+    int depth = __atomic_load_n(&src->max_depth, __ATOMIC_RELAXED);
+
+    if ( depth > dst->max_depth )
+	dst->max_depth = depth;
+    if ( !dst->sites ) {
+	dst->sites = (struct exclib_site_profile **)calloc(exclib_site_count() + 1, sizeof(*dst->sites));
+	if ( !dst->sites )
+	    return;
+	dst->nsites = exclib_site_count() + 1;
+    }
+    for ( i = 0; i < src->nsites && i < dst->nsites; i++ ) {
+	if ( !src->sites[i] )
+	    continue;
+	if ( !dst->sites[i] ) {
+	    dst->sites[i] = (struct exclib_site_profile *)calloc(1, sizeof(struct exclib_site_profile));
+	    if ( !dst->sites[i] )
+		continue;
+	    dst->sites[i]->site = src->sites[i]->site;
+	}
+	exclib_profile_merge_latency(&dst->sites[i]->caught, &src->sites[i]->caught);
+	exclib_profile_merge_latency(&dst->sites[i]->hop, &src->sites[i]->hop);
+    }
+}
+
+static void exclib_profile_free_sites(struct exclib_profile_shard *shard)
+{
+    unsigned int i;
+
+    for ( i = 0; shard->sites && i < shard->nsites; i++ )
+	free(shard->sites[i]);
+    free(shard->sites);
+}
+
+static void exclib_profile_thread_exit(void *arg)
+{
+    struct exclib_profile_shard *shard = (struct exclib_profile_shard *)arg;
+
+    pthread_mutex_lock(&__exclib_profile_lock);
+    exclib_profile_merge(&__exclib_profile_retired, shard);
+    if ( shard->prev )
+	shard->prev->next = shard->next;
+    else
+	__exclib_profile_shards = shard->next;
+    if ( shard->next )
+	shard->next->prev = shard->prev;
+    pthread_mutex_unlock(&__exclib_profile_lock);
+    __exclib_profile_shard = NULL;
+    exclib_profile_free_sites(shard);
+    free(shard);
+}
+
+static void exclib_profile_key_init(void)
+{
+    pthread_key_create(&__exclib_profile_key, exclib_profile_thread_exit);
+}
+
+static struct exclib_profile_shard *exclib_profile_new_shard(void)
+{
+    struct exclib_profile_shard *shard;
+
+    shard = (struct exclib_profile_shard *)calloc(1, sizeof(struct exclib_profile_shard));
+    if ( !shard )
+	return NULL;
+    /* site IDs are fixed at link time, so this never has to grow; 0 is for a frame with no site */
+    shard->nsites = exclib_site_count() + 1;
+    shard->sites = (struct exclib_site_profile **)calloc(shard->nsites, sizeof(*shard->sites));
+    if ( !shard->sites ) {
+	free(shard);
+	return NULL;
+    }
+    pthread_once(&__exclib_profile_once, exclib_profile_key_init);
+    pthread_mutex_lock(&__exclib_profile_lock);
+    shard->next = __exclib_profile_shards;
+    if ( shard->next )
+	shard->next->prev = shard;
+    __exclib_profile_shards = shard;
+    pthread_mutex_unlock(&__exclib_profile_lock);
+    pthread_setspecific(__exclib_profile_key, shard);
+    __exclib_profile_shard = shard;
+    return shard;
+}
+
+/* This thread's histograms for site; NULL out of memory */
+static struct exclib_site_profile *exclib_profile_site(const struct exclib_site *site)
+{
+    struct exclib_profile_shard *shard = __exclib_profile_shard;
+    struct exclib_site_profile *sp;
+    unsigned int id;
+
+    if ( !shard && (__exclib_faulting || (shard = exclib_profile_new_shard()) == NULL) )
+	return NULL;
+    id = exclib_site_id(site);
+    if ( id >= shard->nsites )
+	id = 0;
+    sp = shard->sites[id];
+    if ( !sp ) {
+	if ( __exclib_faulting )
+	    return NULL;
+	sp = (struct exclib_site_profile *)calloc(1, sizeof(struct exclib_site_profile));
+	if ( !sp )
+	    return NULL;
+	sp->site = exclib_site_by_id(id);
+	pthread_mutex_lock(&__exclib_profile_lock);
+	shard->sites[id] = sp;
+	pthread_mutex_unlock(&__exclib_profile_lock);
+    }
+    return sp;
+}
+
+static void exclib_profile_add(struct exclib_latency *latency, unsigned long ticks)
+{
+    unsigned long ns = (unsigned long)((double)ticks * __exclib_profile_ns_per_tick);
+    unsigned int b = exclib_profile_bucket(ns);
+
+    /* only this thread writes these; the relaxed stores just keep a snapshot's read from tearing */
+    __atomic_store_n(&latency->bucket[b], latency->bucket[b] + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&latency->n, latency->n + 1, __ATOMIC_RELAXED);
+    if ( ns > latency->max )
+	__atomic_store_n(&latency->max, ns, __ATOMIC_RELAXED);
+}
+
+/* Makes this thread's shard ahead of the fault handler needing it */
+void exclib_profile_prepare()
+{
+    if ( !__exclib_profile_shard )
+	exclib_profile_new_shard();
+}
+
+/* EXCLIB_PROFILE_TRY: this thread is deeper than it's been before */
+void exclib_profile_try()
+{
+    struct exclib_profile_shard *shard = __exclib_profile_shard;
+
+    __exclib_profile_depth = __exclib_curidx;
+    if ( !shard && (shard = exclib_profile_new_shard()) == NULL )
+	return;
+    __atomic_store_n(&shard->max_depth, __exclib_curidx, __ATOMIC_RELAXED);
+}
+
+void exclib_profile_throw()
+{
+    __exclib_profile_thrown = __exclib_profile_last = exclib_ticks();
+}
+
+/* The exception this thread is throwing propagated out of site's TRY */
+void exclib_profile_hop(const struct exclib_site *site)
+{
+    unsigned long now = exclib_ticks();
+    struct exclib_site_profile *sp;
+
+    if ( !__exclib_profile_thrown )
+	return;
+    sp = exclib_profile_site(site);
+    if ( sp )
+	exclib_profile_add(&sp->hop, now - __exclib_profile_last);
+    __exclib_profile_last = now;
+}
+
+/* ...and site's TRY caught it */
+void exclib_profile_catch(const struct exclib_site *site)
+{
+    unsigned long now = exclib_ticks();
+    struct exclib_site_profile *sp;
+
+    if ( !__exclib_profile_thrown )
+	return;
+    sp = exclib_profile_site(site);
+    if ( sp )
+	exclib_profile_add(&sp->caught, now - __exclib_profile_thrown);
+    __exclib_profile_thrown = 0;
+}
+
+/*
+ * Turns the profiler on (1) or off (0). What it has recorded is kept either
+ * way. Turning it on measures exclib_ticks_hz first if nothing has yet.
+ */
+void exclib_profile_enable(int on)
+{
+    if ( on )
+	__exclib_profile_ns_per_tick = 1e9 / (double)exclib_ticks_hz();
+    __atomic_store_n(&__exclib_profile_on, on, __ATOMIC_RELEASE);
+}
+
+struct exclib_profile *exclib_profile_snapshot()
+{
+    struct exclib_profile_shard sum;
+    struct exclib_profile_shard *shard;
+    struct exclib_profile *profile;
+    unsigned int n = 0;
+    unsigned int i;
+
+    memset(&sum, 0, sizeof(sum));
+    pthread_mutex_lock(&__exclib_profile_lock);
+    exclib_profile_merge(&sum, &__exclib_profile_retired);
+    for ( shard = __exclib_profile_shards; shard; shard = shard->next )
+	exclib_profile_merge(&sum, shard);
+    pthread_mutex_unlock(&__exclib_profile_lock);
+
+    for ( i = 0; i < sum.nsites; i++ )
+	n += sum.sites[i] != NULL;
+    profile = (struct exclib_profile *)calloc(1, sizeof(struct exclib_profile));
+    if ( !profile )
+	goto out;
+    profile->sites = (struct exclib_site_profile *)calloc(n + 1, sizeof(struct exclib_site_profile));
+    if ( !profile->sites ) {
+	exclib_profile_free(profile);
+	profile = NULL;
+	goto out;
+    }
+    profile->max_depth = sum.max_depth;
+    for ( i = 0; i < sum.nsites; i++ ) {
+	if ( !sum.sites[i] )
+	    continue;
+	profile->sites[profile->nsites++] = *sum.sites[i];
+	exclib_profile_merge_latency(&profile->caught, &sum.sites[i]->caught);
+	exclib_profile_merge_latency(&profile->hop, &sum.sites[i]->hop);
+    }
+out:
+    exclib_profile_free_sites(&sum);
+    return profile;
+}
+
+void exclib_profile_free(struct exclib_profile *profile)
+{
+    if ( !profile )
+	return;
+    free(profile->sites);
+    free(profile);
+}
+
+/*
+ * The latency (ns) that percent of latency's times are at or under, as the
+ * top of the bucket it falls in; 0 when there are none.
+ */
+unsigned long exclib_profile_percentile(const struct exclib_latency *latency, double percent)
+{
+    double want;
+    unsigned long seen = 0;
+    unsigned long top;
+    unsigned int b;
+
+    if ( !latency || latency->n == 0 )
+	return 0;
+    want = percent / 100.0 * (double)latency->n;
+    for ( b = 0; b < EXCLIB_PROFILE_BUCKETS; b++ ) {
+	seen += latency->bucket[b];
+	if ( seen > 0 && (double)seen >= want ) {
+	    top = exclib_profile_bucket_top(b);
+	    return top < latency->max ? top : latency->max;
+	}
+    }
+    return latency->max;
+}
+
+static const double __exclib_profile_percents[] = {50.0, 90.0, 99.0, 99.9};
+static const char *__exclib_profile_percent_names[] = {"p50", "p90", "p99", "p999"};
+
+static void exclib_profile_dump_latency(FILE *out, const char *name, const struct exclib_latency *latency, int json)
+{
+    unsigned int i;
+
+    if ( json )
+	fprintf(out, "\"%s\":{\"n\":%lu", name, latency->n);
+    else
+	fprintf(out, " %s n %lu", name, latency->n);
+    for ( i = 0; i < sizeof(__exclib_profile_percents) / sizeof(__exclib_profile_percents[0]); i++ ) {
+	if ( json )
+	    fprintf(out, ",\"%s\":%lu", __exclib_profile_percent_names[i],
+		    exclib_profile_percentile(latency, __exclib_profile_percents[i]));
+	else
+	    fprintf(out, " %s %luns", __exclib_profile_percent_names[i],
+		    exclib_profile_percentile(latency, __exclib_profile_percents[i]));
+    }
+    if ( json )
+	fprintf(out, ",\"max\":%lu}", latency->max);
+    else
+	fprintf(out, " max %luns", latency->max);
+}
+
+/* Prints profile as text, or as one line of JSON for EXCLIB_STATS_JSON; latencies are in ns */
+void exclib_profile_dump(FILE *out, const struct exclib_profile *profile, int format)
+{
+    const struct exclib_site *site;
+    unsigned int i;
+    int json = (format == EXCLIB_STATS_JSON);
+
+    if ( !profile )
+	return;
+    if ( json ) {
+	fprintf(out, "{\"max_depth\":%d,", profile->max_depth);
+	exclib_profile_dump_latency(out, "caught", &profile->caught, 1);
+	fprintf(out, ",");
+	exclib_profile_dump_latency(out, "hop", &profile->hop, 1);
+	fprintf(out, ",\"sites\":[");
+    } else {
+	fprintf(out, "profile: max depth %d\n", profile->max_depth);
+	fprintf(out, "all:");
+	exclib_profile_dump_latency(out, "caught", &profile->caught, 0);
+	fprintf(out, ";");
+	exclib_profile_dump_latency(out, "hop", &profile->hop, 0);
+	fprintf(out, "\n");
+    }
+    for ( i = 0; i < profile->nsites; i++ ) {
+	site = profile->sites[i].site;
+	if ( json ) {
+	    fprintf(out, "%s{\"file\":", i ? "," : "");
+	    exclib_stats_json_str(out, site ? site->file : NULL);
+	    fprintf(out, ",\"line\":%d,\"function\":", site ? site->line : 0);
+	    exclib_stats_json_str(out, site ? site->function : NULL);
+	    fprintf(out, ",");
+	    exclib_profile_dump_latency(out, "caught", &profile->sites[i].caught, 1);
+	    fprintf(out, ",");
+	    exclib_profile_dump_latency(out, "hop", &profile->sites[i].hop, 1);
+	    fprintf(out, "}");
+	} else {
+	    if ( site )
+		fprintf(out, "site %s:%d:%s:", site->file, site->line, site->function);
+	    else
+		fprintf(out, "site unknown:");
+	    if ( profile->sites[i].caught.n )
+		exclib_profile_dump_latency(out, "caught", &profile->sites[i].caught, 0);
+	    if ( profile->sites[i].caught.n && profile->sites[i].hop.n )
+		fprintf(out, ";");
+	    if ( profile->sites[i].hop.n )
+		exclib_profile_dump_latency(out, "hop", &profile->sites[i].hop, 0);
+	    fprintf(out, "\n");
+	}
+    }
+    if ( json )
+	fprintf(out, "]}\n");
+}
+
+static pthread_mutex_t __exclib_profile_dump_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t __exclib_profile_dump_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t __exclib_profile_dumper;
+static int __exclib_profile_dumping = 0;
+static FILE *__exclib_profile_dump_out = NULL;
+static unsigned int __exclib_profile_dump_seconds = 0;
+static int __exclib_profile_dump_format = EXCLIB_STATS_TEXT;
+
+static void *exclib_profile_dump_thread(void *arg)
+{
+    struct exclib_profile *profile;
+    struct timespec until;
+
+    (void)arg;
+    pthread_mutex_lock(&__exclib_profile_dump_lock);
+    while ( __exclib_profile_dumping ) {
+	clock_gettime(CLOCK_REALTIME, &until);
+	until.tv_sec += __exclib_profile_dump_seconds;
+	while ( __exclib_profile_dumping &&
+		pthread_cond_timedwait(&__exclib_profile_dump_cond, &__exclib_profile_dump_lock, &until) != ETIMEDOUT )
+	    ;
+	if ( !__exclib_profile_dumping )
+	    break;
+	profile = exclib_profile_snapshot();
+	exclib_profile_dump(__exclib_profile_dump_out, profile, __exclib_profile_dump_format);
+	fflush(__exclib_profile_dump_out);
+	exclib_profile_free(profile);
+    }
+    pthread_mutex_unlock(&__exclib_profile_dump_lock);
+    return NULL;
+}
+
+/*
+ * Starts a thread that prints a snapshot to out every seconds seconds, in
+ * format (see exclib_profile_dump), replacing the one a previous call started;
+ * 0 seconds just stops it. Returns 0, or -1 if the thread couldn't be started.
+ */
+int exclib_profile_dump_every(FILE *out, unsigned int seconds, int format)
+{
+    int rc = 0;
+
+    pthread_mutex_lock(&__exclib_profile_dump_lock);
+    if ( __exclib_profile_dumping ) {
+	__exclib_profile_dumping = 0;
+	pthread_cond_signal(&__exclib_profile_dump_cond);
+	pthread_mutex_unlock(&__exclib_profile_dump_lock);
+	pthread_join(__exclib_profile_dumper, NULL);
+	pthread_mutex_lock(&__exclib_profile_dump_lock);
+    }
+    if ( seconds > 0 ) {
+	__exclib_profile_dump_out = out;
+	__exclib_profile_dump_seconds = seconds;
+	__exclib_profile_dump_format = format;
+	__exclib_profile_dumping = 1;
+	if ( pthread_create(&__exclib_profile_dumper, NULL, exclib_profile_dump_thread, NULL) != 0 ) {
+	    __exclib_profile_dumping = 0;
+	    rc = -1;
+	}
+    }
+    pthread_mutex_unlock(&__exclib_profile_dump_lock);
+    return rc;
+}
+
+#if defined(__GNUC__)
+static void exclib_profile_at_exit(void)
+{
+    struct exclib_profile *profile = exclib_profile_snapshot();
+
+    exclib_profile_dump(stderr, profile, EXCLIB_STATS_TEXT);
+    exclib_profile_free(profile);
+}
+
+/*
+ * EXCLIB_PROFILE=<seconds> profiles a program that never calls
+ * exclib_profile_enable, printing to stderr every that many seconds (never,
+ * for 0) and once more as it exits.
+ */
+__attribute__((constructor)) static void exclib_profile_ctor(void)
+{
+    const char *every = getenv("EXCLIB_PROFILE");
+
+    if ( !every || !*every )
+	return;
+    exclib_profile_enable(1);
+    if ( atoi(every) > 0 )
+	exclib_profile_dump_every(stderr, (unsigned int)atoi(every), EXCLIB_STATS_TEXT);
+    atexit(exclib_profile_at_exit);
+}
+#endif
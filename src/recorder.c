@@ -0,0 +1,229 @@
+#define _GNU_SOURCE
+#include "exclib.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/*
+ * The flight recorder; the file's layout is in exclib.h. Each thread writes
+ * only its own ring, so a record is plain stores: seq goes to 0 first and to
+ * its place in the ring last, so a record the process died half way through
+ * writing is left out by exclib-dump rather than shown torn. Rings are taken
+ * with a CAS and given back by a thread-specific data destructor.
+ *
+ * Close (or reopen) the recorder only while no other thread can be throwing:
+ * it unmaps the file from under them.
+ */
+
+#define EXCLIB_RECORDER_ALIGN 64
+
+int __exclib_recorder_on = 0;
+static char *__exclib_recorder_map = NULL;
+static size_t __exclib_recorder_size = 0;
+static size_t __exclib_recorder_stride = 0;
+/* bumped by every open, so a ring a thread took from an earlier file isn't used */
+static unsigned int __exclib_recorder_gen = 0;
+static EXCLIB_TLS struct exclib_flight_ring *__exclib_recorder_ring = NULL;
+static EXCLIB_TLS unsigned int __exclib_recorder_ring_gen = 0;
+static pthread_key_t __exclib_recorder_key;
+static pthread_once_t __exclib_recorder_once = PTHREAD_ONCE_INIT;
+
+#define EXCLIB_RECORDER_HEADER ((struct exclib_flight_header *)__exclib_recorder_map)
+
+static size_t exclib_recorder_align(size_t n)
+{
+    return (n + EXCLIB_RECORDER_ALIGN - 1) & ~(size_t)(EXCLIB_RECORDER_ALIGN - 1);
+}
+
+static struct exclib_flight_ring *exclib_recorder_ring_at(unsigned int i)
+{
+    return (struct exclib_flight_ring *)(__exclib_recorder_map + EXCLIB_RECORDER_HEADER->rings_offset +
+					 i * __exclib_recorder_stride);
+}
+
+static void exclib_recorder_thread_exit(void *arg)
+{
+    struct exclib_flight_ring *ring = (struct exclib_flight_ring *)arg;
+
+    if ( ring && ring == __exclib_recorder_ring && __exclib_recorder_ring_gen == __exclib_recorder_gen &&
+	 __atomic_load_n(&__exclib_recorder_on, __ATOMIC_ACQUIRE) )
+	__atomic_store_n(&ring->owner, 0, __ATOMIC_RELEASE);
+    __exclib_recorder_ring = NULL;
+}
+
+static void exclib_recorder_key_init(void)
+{
+    pthread_key_create(&__exclib_recorder_key, exclib_recorder_thread_exit);
+}
+
+/* A free ring for this thread, or NULL (for the rest of this file's life) if there are none */
+static struct exclib_flight_ring *exclib_recorder_claim(void)
+{
+    struct exclib_flight_ring *ring;
+    unsigned int i;
+    int expect;
+
+    __exclib_recorder_ring = NULL;
+    __exclib_recorder_ring_gen = __exclib_recorder_gen;
+    for ( i = 0; i < EXCLIB_RECORDER_HEADER->nrings; i++ ) {
+	ring = exclib_recorder_ring_at(i);
+	expect = 0;
+	if ( __atomic_compare_exchange_n(&ring->owner, &expect, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED) ) {
+	    ring->tid = (int)syscall(SYS_gettid);
+	    __exclib_recorder_ring = ring;
+	    pthread_once(&__exclib_recorder_once, exclib_recorder_key_init);
+	    pthread_setspecific(__exclib_recorder_key, ring);
+	    return ring;
+	}
+    }
+    return NULL;
+}
+
+/* Claims this thread a ring, if a file is open and it hasn't one in it yet, ahead of the fault handler recording */
+void exclib_recorder_prepare()
+{
+    if ( __atomic_load_n(&__exclib_recorder_on, __ATOMIC_ACQUIRE) && __exclib_recorder_ring_gen != __exclib_recorder_gen )
+	exclib_recorder_claim();
+}
+
+void exclib_record(int event, int code, const struct exclib_site *site, int depth, const char *description)
+{
+    struct exclib_flight_ring *ring = __exclib_recorder_ring;
+    struct exclib_flight_record *r;
+    unsigned long head;
+    int i;
+
+    /* claiming a ring isn't safe from the fault handler; exclib_recorder_prepare does it beforehand */
+    if ( __exclib_recorder_ring_gen != __exclib_recorder_gen )
+	ring = __exclib_faulting ? NULL : exclib_recorder_claim();
+    if ( !ring ) {
+	__atomic_add_fetch(&EXCLIB_RECORDER_HEADER->dropped, 1, __ATOMIC_RELAXED);
+	return;
+    }
+    head = ring->head;
+    r = (struct exclib_flight_record *)(ring + 1) + head % EXCLIB_RECORDER_HEADER->nrecords;
+    __atomic_store_n(&r->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    r->clock = exclib_ticks();
+    r->description = (unsigned long)description;
+    r->tid = ring->tid;
+    r->code = code;
+    r->depth = depth;
+    r->site = exclib_site_id(site);
+    r->line = site ? site->line : 0;
+    r->event = (unsigned char)event;
+    i = 0;
+    if ( description )
+	for ( ; i < EXCLIB_FLIGHT_TEXT - 1 && description[i]; i++ )
+	    r->text[i] = description[i];
+    r->text[i] = '\0';
+    __atomic_store_n(&r->seq, head + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Makes path (replacing whatever was there) a flight recorder file of nrings
+ * rings of nrecords records, 0 for EXC_RECORDER_RINGS and EXC_RECORDER_RECORDS,
+ * and starts recording into it. Returns 0, or -1 with errno set.
+ */
+int exclib_recorder_open(const char *path, unsigned int nrings, unsigned int nrecords)
+{
+    struct exclib_flight_header *h;
+    struct exclib_flight_site *fs;
+    const struct exclib_site *site;
+    unsigned int nsites = exclib_site_count();
+    size_t strings = 0;
+    size_t size;
+    size_t len;
+    unsigned int off;
+    unsigned int i;
+    char *map;
+    int fd;
+
+    exclib_recorder_close();
+    if ( nrings == 0 )
+	nrings = EXC_RECORDER_RINGS;
+    if ( nrecords == 0 )
+	nrecords = EXC_RECORDER_RECORDS;
+    for ( i = 1; i <= nsites; i++ ) {
+	site = exclib_site_by_id(i);
+	strings += strlen(site->file) + strlen(site->function) + 2;
+    }
+    size = exclib_recorder_align(sizeof(struct exclib_flight_header)) +
+	exclib_recorder_align(nsites * sizeof(struct exclib_flight_site)) + exclib_recorder_align(strings) +
+	(size_t)nrings * (sizeof(struct exclib_flight_ring) + (size_t)nrecords * sizeof(struct exclib_flight_record));
+
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if ( fd < 0 )
+	return -1;
+    if ( ftruncate(fd, (off_t)size) != 0 ) {
+	close(fd);
+	return -1;
+    }
+    map = (char *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if ( map == MAP_FAILED )
+	return -1;
+
+    /* the file starts out zeroed: every ring free and every record unwritten */
+    h = (struct exclib_flight_header *)map;
+    h->version = EXCLIB_FLIGHT_VERSION;
+    h->record_size = sizeof(struct exclib_flight_record);
+    h->nrings = nrings;
+    h->nrecords = nrecords;
+    h->nsites = nsites;
+    h->sites_offset = exclib_recorder_align(sizeof(struct exclib_flight_header));
+    h->strings_offset = h->sites_offset + exclib_recorder_align(nsites * sizeof(struct exclib_flight_site));
+    h->rings_offset = h->strings_offset + exclib_recorder_align(strings);
+    h->pid = (int)getpid();
+    h->clock_hz = exclib_ticks_hz();
+    h->clock_base = exclib_ticks();
+    h->started = exclib_wall_ns();
+    fs = (struct exclib_flight_site *)(map + h->sites_offset);
+    off = 0;
+    for ( i = 1; i <= nsites; i++, fs++ ) {
+	site = exclib_site_by_id(i);
+	len = strlen(site->file) + 1;
+	memcpy(map + h->strings_offset + off, site->file, len);
+	fs->file = off;
+	off += len;
+	len = strlen(site->function) + 1;
+	memcpy(map + h->strings_offset + off, site->function, len);
+	fs->function = off;
+	off += len;
+	fs->line = site->line;
+	fs->kind = site->kind;
+    }
+    /* last, so a file that was never finished isn't taken for one */
+    memcpy(h->magic, EXCLIB_FLIGHT_MAGIC, sizeof(EXCLIB_FLIGHT_MAGIC));
+
+    __exclib_recorder_map = map;
+    __exclib_recorder_size = size;
+    __exclib_recorder_stride = sizeof(struct exclib_flight_ring) + (size_t)nrecords * sizeof(struct exclib_flight_record);
+    __exclib_recorder_gen++;
+    __atomic_store_n(&__exclib_recorder_on, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Stops recording and unmaps the file; what was recorded stays in it */
+void exclib_recorder_close()
+{
+    if ( !__exclib_recorder_map )
+	return;
+    __atomic_store_n(&__exclib_recorder_on, 0, __ATOMIC_RELEASE);
+    munmap(__exclib_recorder_map, __exclib_recorder_size);
+    __exclib_recorder_map = NULL;
+    __exclib_recorder_ring = NULL;
+}
+
+#if defined(__GNUC__)
+/* EXCLIB_RECORDER=<file> records a program that never calls exclib_recorder_open */
+__attribute__((constructor)) static void exclib_recorder_ctor(void)
+{
+    const char *path = getenv("EXCLIB_RECORDER");
+
+    if ( path && *path )
+	exclib_recorder_open(path, 0, 0);
+}
+#endif
@@ -0,0 +1,537 @@
+#include "exclib.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/*
+ * The exception registry maps any int code to a name and the signal to raise
+ * if that code goes uncaught. It's an open-addressing table (linear probing,
+ * kept at most half full) sized to the codes actually registered.
+ *
+ * Registration is meant to happen at startup and takes a mutex. Lookups are
+ * on the throw path and take no lock: an entry's fields are written before it
+ * is marked used, and a table that has been outgrown is never freed, so a
+ * reader that loaded the old table pointer can keep probing it safely.
+ *
+ * Codes can also be put under a class (another code) one at a time, or a
+ * whole range at once, for CATCH_CLASS. Every code that is made a parent gets
+ * one of EXC_MAX_CLASSES bits, and each class's set of ancestors (itself
+ * included) is worked out at registration into a bitmask, so asking whether
+ * a code is under a class is two hash lookups and a bit test however deep
+ * the hierarchy goes. Codes that are only covered by a range cost a binary
+ * search over the ranges' boundaries on top of that.
+ */
+
+#define EXCLIB_CLASS_BITS  (8 * sizeof(unsigned long))
+#define EXCLIB_CLASS_WORDS ((EXC_MAX_CLASSES + EXCLIB_CLASS_BITS - 1) / EXCLIB_CLASS_BITS)
+
+#define EXCLIB_REGISTRY_MIN 16
+
+struct exclib_registry_entry {
+    char *name;
+    int exc;
+    int signal;
+    int used;
+    int parent;     /* set by exclib_class_exception; 0 for none */
+    int up;         /* 1 + the class bit of parent, 0 for none */
+    int klass;      /* 1 + its own class bit if it's a parent of anything, else 0 */
+};
+
+/* A stretch of codes whose innermost range put them under the class with bit up - 1 */
+struct exclib_class_segment {
+    long lo;
+    long hi;
+    int up;
+};
+
+struct exclib_class_segments {
+    unsigned int n;
+    struct exclib_class_segments *retired;
+    struct exclib_class_segment seg[1];
+};
+
+struct exclib_class_range {
+    long lo;
+    long hi;
+    int parent;
+};
+
+struct exclib_registry {
+    unsigned int mask;
+    unsigned int count;
+    struct exclib_registry *retired;
+    struct exclib_registry_entry entries[1];
+};
+
+struct exclib_name_data __exclib_exc_names[EXC_PREDEFINED_EXCEPTIONS] = {
+    {EXC_NULLPOINTER, "Null Pointer", SIGSEGV},
+    {EXC_OUTOFBOUNDS, "Array Index Out of Bounds", SIGTERM},
+    {EXC_OUTOFFRAMES, "Out of Exception Frames", SIGABRT},
+    {EXC_PARALLEL, "Parallel Iterations Failed", SIGABRT},
+    {EXC_BUSERROR, "Bus Error", SIGBUS},
+    {EXC_ARITHMETIC, "Arithmetic Error", SIGFPE},
+    {EXC_STACKOVERFLOW, "Stack Overflow", SIGSEGV},
+    {EXC_OUTOFDEFERS, "Out of Deferred Actions", SIGABRT}
+};
+
+static struct exclib_registry *__exclib_registry = NULL;
+static pthread_mutex_t __exclib_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t __exclib_registry_once = PTHREAD_ONCE_INIT;
+
+/* the rest is the class hierarchy, also written under __exclib_registry_lock */
+static int __exclib_class_count = 0;
+static int __exclib_class_codes[EXC_MAX_CLASSES];
+static unsigned long __exclib_class_ancestors[EXC_MAX_CLASSES][EXCLIB_CLASS_WORDS];
+/* for a class with no parent of its own: the class bit of the range its code is in, or 0 */
+static int __exclib_class_range_up[EXC_MAX_CLASSES];
+static struct exclib_class_range *__exclib_class_ranges = NULL;
+static unsigned int __exclib_class_nranges = 0;
+static struct exclib_class_segments *__exclib_class_segments = NULL;
+
+/*
+ * Where an exception code starts looking in a power-of-two table (masked to
+ * the table's size); the registry and the per-thread counters share it.
+ * murmur3's fmix32 finalizer, so every bit of the code moves the low bits:
+ * codes that only differ high up (multiples of 4096, say, a common way to
+ * lay out vendor codes) spread out as well as sequential or negative ones.
+ */
+unsigned int exclib_code_hash(int code)
+{
+    unsigned int h = (unsigned int)code;
+
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+    return h;
+}
+
+static struct exclib_registry_entry *exclib_registry_find(struct exclib_registry *reg, int exc)
+{
+    unsigned int i;
+    struct exclib_registry_entry *e;
+
+    if ( !reg )
+	return NULL;
+    for ( i = exclib_code_hash(exc) & reg->mask; ; i = (i + 1) & reg->mask ) {
+	e = &reg->entries[i];
+	if ( !__atomic_load_n(&e->used, __ATOMIC_ACQUIRE) )
+	    return NULL;
+	if ( e->exc == exc )
+	    return e;
+    }
+}
+
+static struct exclib_registry *exclib_registry_alloc(unsigned int size)
+{
+    struct exclib_registry *reg;
+
+    reg = (struct exclib_registry *)calloc(1, sizeof(struct exclib_registry) +
+					     (size - 1) * sizeof(struct exclib_registry_entry));
+    if ( !reg ) {
+	fprintf(stderr, "EXCLIB: out of memory growing the exception registry to %u entries\n", size);
+	exit(1);
+    }
+    reg->mask = size - 1;
+    return reg;
+}
+
+/* Caller holds __exclib_registry_lock */
+static void exclib_registry_put(struct exclib_registry *reg, int exc, char *name, int signal, int keepsignal)
+{
+    unsigned int i;
+    struct exclib_registry_entry *e;
+
+    for ( i = exclib_code_hash(exc) & reg->mask; ; i = (i + 1) & reg->mask ) {
+	e = &reg->entries[i];
+	if ( !e->used ) {
+	    e->exc = exc;
+	    e->name = name;
+	    e->signal = signal;
+	    reg->count++;
+	    __atomic_store_n(&e->used, 1, __ATOMIC_RELEASE);
+	    return;
+	}
+	if ( e->exc == exc ) {
+	    __atomic_store_n(&e->name, name, __ATOMIC_RELAXED);
+	    if ( !keepsignal )
+		__atomic_store_n(&e->signal, signal, __ATOMIC_RELAXED);
+	    return;
+	}
+    }
+}
+
+/* Caller holds __exclib_registry_lock. Makes room for `more` new codes with a single rehash. */
+static struct exclib_registry *exclib_registry_reserve(unsigned int more)
+{
+    struct exclib_registry *old = __exclib_registry;
+    struct exclib_registry *reg;
+    struct exclib_registry_entry *e;
+    unsigned int need = (old ? old->count : 0) + more;
+    unsigned int size = EXCLIB_REGISTRY_MIN;
+    unsigned int i;
+
+    if ( old && need * 2 <= old->mask + 1 )
+	return old;
+    while ( size < need * 2 )
+	size *= 2;
+    reg = exclib_registry_alloc(size);
+    if ( old ) {
+	for ( i = 0; i <= old->mask; i++ ) {
+	    if ( !old->entries[i].used )
+		continue;
+	    exclib_registry_put(reg, old->entries[i].exc, old->entries[i].name, old->entries[i].signal, 0);
+	    e = exclib_registry_find(reg, old->entries[i].exc);
+	    e->parent = old->entries[i].parent;
+	    e->up = old->entries[i].up;
+	    e->klass = old->entries[i].klass;
+	}
+	reg->retired = old;
+    }
+    __atomic_store_n(&__exclib_registry, reg, __ATOMIC_RELEASE);
+    return reg;
+}
+
+static void exclib_register(struct exclib_name_data *data, int size, int keepsignal)
+{
+    struct exclib_registry *reg;
+    int i;
+
+    pthread_mutex_lock(&__exclib_registry_lock);
+    reg = exclib_registry_reserve((unsigned int)size);
+    for ( i = 0; i < size; i++ )
+	exclib_registry_put(reg, data[i].exc, data[i].name, data[i].signal, keepsignal);
+    pthread_mutex_unlock(&__exclib_registry_lock);
+}
+
+static void exclib_registry_init(void)
+{
+    exclib_register(&__exclib_exc_names[0], EXC_PREDEFINED_EXCEPTIONS, 0);
+}
+
+void exclib_init_registry()
+{
+    pthread_once(&__exclib_registry_once, exclib_registry_init);
+}
+
+#if defined(__GNUC__)
+/* so TRY/THROW never have to check; exclib_exception_name catches the rest */
+__attribute__((constructor)) static void exclib_registry_ctor(void)
+{
+    exclib_init_registry();
+}
+#endif
+
+void exclib_bulk_name_exceptions(struct exclib_name_data *exclib_exc_names, int size)
+{
+    if ( !exclib_exc_names || size <= 0 )
+	return;
+    exclib_init_registry();
+    exclib_register(exclib_exc_names, size, 0);
+}
+
+void exclib_name_exception(int value, const char *name)
+{
+    struct exclib_name_data data;
+
+    data.exc = value;
+    data.name = (char *)name;
+    data.signal = 0;
+    exclib_init_registry();
+    exclib_register(&data, 1, 1);
+}
+
+void exclib_name_exception_signal(int value, const char *name, int signal)
+{
+    struct exclib_name_data data;
+
+    data.exc = value;
+    data.name = (char *)name;
+    data.signal = signal;
+    exclib_init_registry();
+    exclib_register(&data, 1, 0);
+}
+
+char *exclib_exception_name(int value)
+{
+    struct exclib_registry_entry *e;
+    struct exclib_registry *reg = __atomic_load_n(&__exclib_registry, __ATOMIC_ACQUIRE);
+
+    if ( !reg ) {
+	/* nothing has been registered yet, not even the predefined codes */
+	exclib_init_registry();
+	reg = __atomic_load_n(&__exclib_registry, __ATOMIC_ACQUIRE);
+    }
+    e = exclib_registry_find(reg, value);
+    return e ? __atomic_load_n(&e->name, __ATOMIC_RELAXED) : NULL;
+}
+
+int exclib_exception_signal(int value)
+{
+    struct exclib_registry_entry *e;
+
+    e = exclib_registry_find(__atomic_load_n(&__exclib_registry, __ATOMIC_ACQUIRE), value);
+    return e ? __atomic_load_n(&e->signal, __ATOMIC_RELAXED) : 0;
+}
+
+/* Caller holds __exclib_registry_lock. The entry for exc, registering it (with no name) if need be. */
+static struct exclib_registry_entry *exclib_registry_entry_for(int exc)
+{
+    struct exclib_registry *reg = __exclib_registry;
+    struct exclib_registry_entry *e = exclib_registry_find(reg, exc);
+
+    if ( e )
+	return e;
+    reg = exclib_registry_reserve(1);
+    exclib_registry_put(reg, exc, NULL, 0, 1);
+    return exclib_registry_find(reg, exc);
+}
+
+/* Caller holds __exclib_registry_lock. Gives exc a class bit if it hasn't one; 0 when they've run out. */
+static int exclib_class_bit(int exc)
+{
+    struct exclib_registry_entry *e = exclib_registry_entry_for(exc);
+
+    if ( e->klass )
+	return e->klass;
+    if ( __exclib_class_count == EXC_MAX_CLASSES ) {
+	fprintf(stderr, "EXCLIB: can't make %d an exception class, all %d are taken (see EXC_MAX_CLASSES)\n",
+		exc, EXC_MAX_CLASSES);
+	return 0;
+    }
+    __exclib_class_codes[__exclib_class_count] = exc;
+    e->klass = ++__exclib_class_count;
+    return e->klass;
+}
+
+/*
+ * Caller holds __exclib_registry_lock. The class bit of the narrowest range
+ * around exc, leaving out ranges exc is itself the parent of; 0 if none.
+ */
+static int exclib_class_range_parent(int exc)
+{
+    struct exclib_class_range *r = NULL;
+    unsigned int j;
+
+    for ( j = 0; j < __exclib_class_nranges; j++ ) {
+	if ( __exclib_class_ranges[j].lo <= exc && exc <= __exclib_class_ranges[j].hi &&
+	     __exclib_class_ranges[j].parent != exc &&
+	     (!r || __exclib_class_ranges[j].hi - __exclib_class_ranges[j].lo < r->hi - r->lo) )
+	    r = &__exclib_class_ranges[j];
+    }
+    return r ? exclib_registry_find(__exclib_registry, r->parent)->klass : 0;
+}
+
+/*
+ * Caller holds __exclib_registry_lock. Works every class's ancestors out
+ * again, from the parents; a class with no parent of its own goes under the
+ * range its code is in, if any.
+ */
+static void exclib_class_rebuild()
+{
+    struct exclib_registry_entry *e;
+    unsigned long *bits;
+    int k;
+    int up;
+    int depth;
+
+    for ( k = 0; k < __exclib_class_count; k++ ) {
+	e = exclib_registry_find(__exclib_registry, __exclib_class_codes[k]);
+	__exclib_class_range_up[k] = (e && e->up) ? 0 : exclib_class_range_parent(__exclib_class_codes[k]);
+    }
+    for ( k = 0; k < __exclib_class_count; k++ ) {
+	bits = __exclib_class_ancestors[k];
+	memset(bits, 0, sizeof(__exclib_class_ancestors[k]));
+	/* a parent loop can't go on for longer than there are classes */
+	for ( up = k + 1, depth = 0; up && depth < EXC_MAX_CLASSES; depth++ ) {
+	    bits[(up - 1) / EXCLIB_CLASS_BITS] |= 1UL << ((up - 1) % EXCLIB_CLASS_BITS);
+	    e = exclib_registry_find(__exclib_registry, __exclib_class_codes[up - 1]);
+	    up = (e && e->up) ? e->up : __exclib_class_range_up[up - 1];
+	}
+    }
+}
+
+static int exclib_compare_long(const void *a, const void *b)
+{
+    long x = *(const long *)a;
+    long y = *(const long *)b;
+
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/*
+ * Caller holds __exclib_registry_lock. Cuts the ranges up into stretches that
+ * each lie in the same innermost range, for exclib_class_of to search, and
+ * publishes them; the old ones are kept, like an outgrown registry.
+ */
+static void exclib_class_segment_ranges()
+{
+    struct exclib_class_segments *segs;
+    struct exclib_class_range *r;
+    long *bounds;
+    unsigned int nbounds = 0;
+    unsigned int i;
+    unsigned int j;
+    int up;
+
+    bounds = (long *)malloc(2 * __exclib_class_nranges * sizeof(long));
+    segs = (struct exclib_class_segments *)malloc(sizeof(struct exclib_class_segments) +
+						   2 * __exclib_class_nranges * sizeof(struct exclib_class_segment));
+    if ( !bounds || !segs ) {
+	fprintf(stderr, "EXCLIB: out of memory indexing %u exception class ranges\n", __exclib_class_nranges);
+	exit(1);
+    }
+    for ( i = 0; i < __exclib_class_nranges; i++ ) {
+	bounds[nbounds++] = __exclib_class_ranges[i].lo;
+	bounds[nbounds++] = __exclib_class_ranges[i].hi + 1;
+    }
+    qsort(bounds, nbounds, sizeof(long), exclib_compare_long);
+    segs->n = 0;
+    for ( i = 0; i + 1 < nbounds; i++ ) {
+	if ( bounds[i] == bounds[i + 1] )
+	    continue;
+	/* the narrowest range around this stretch is the innermost */
+	for ( r = NULL, j = 0; j < __exclib_class_nranges; j++ ) {
+	    if ( __exclib_class_ranges[j].lo <= bounds[i] && bounds[i] <= __exclib_class_ranges[j].hi &&
+		 (!r || __exclib_class_ranges[j].hi - __exclib_class_ranges[j].lo < r->hi - r->lo) )
+		r = &__exclib_class_ranges[j];
+	}
+	if ( !r )
+	    continue;
+	up = exclib_registry_find(__exclib_registry, r->parent)->klass;
+	if ( segs->n > 0 && segs->seg[segs->n - 1].up == up && segs->seg[segs->n - 1].hi + 1 == bounds[i] ) {
+	    segs->seg[segs->n - 1].hi = bounds[i + 1] - 1;
+	    continue;
+	}
+	segs->seg[segs->n].lo = bounds[i];
+	segs->seg[segs->n].hi = bounds[i + 1] - 1;
+	segs->seg[segs->n].up = up;
+	segs->n++;
+    }
+    free(bounds);
+    segs->retired = __exclib_class_segments;
+    __atomic_store_n(&__exclib_class_segments, segs, __ATOMIC_RELEASE);
+}
+
+void exclib_class_exception(int value, int parent)
+{
+    struct exclib_registry_entry *e;
+    int up;
+
+    exclib_init_registry();
+    pthread_mutex_lock(&__exclib_registry_lock);
+    up = exclib_class_bit(parent);
+    if ( up && value != parent ) {
+	e = exclib_registry_entry_for(value);
+	e->parent = parent;
+	e->up = up;
+	exclib_class_rebuild();
+    }
+    pthread_mutex_unlock(&__exclib_registry_lock);
+}
+
+void exclib_class_range(int lo, int hi, int parent)
+{
+    struct exclib_class_range *ranges;
+
+    if ( lo > hi )
+	return;
+    exclib_init_registry();
+    pthread_mutex_lock(&__exclib_registry_lock);
+    if ( exclib_class_bit(parent) ) {
+	ranges = (struct exclib_class_range *)realloc(__exclib_class_ranges, (__exclib_class_nranges + 1) * sizeof(*ranges));
+	if ( !ranges ) {
+	    fprintf(stderr, "EXCLIB: out of memory adding an exception class range\n");
+	    exit(1);
+	}
+	ranges[__exclib_class_nranges].lo = lo;
+	ranges[__exclib_class_nranges].hi = hi;
+	ranges[__exclib_class_nranges].parent = parent;
+	__exclib_class_ranges = ranges;
+	__exclib_class_nranges++;
+	exclib_class_segment_ranges();
+	exclib_class_rebuild();
+    }
+    pthread_mutex_unlock(&__exclib_registry_lock);
+}
+
+/* 1 + the class bit that value's own ancestors start from, or 0 if it isn't under anything */
+static int exclib_class_of(struct exclib_registry *reg, int value)
+{
+    struct exclib_registry_entry *e = exclib_registry_find(reg, value);
+    struct exclib_class_segments *segs;
+    unsigned int lo;
+    unsigned int hi;
+    unsigned int mid;
+
+    if ( e && e->klass )
+	return e->klass;
+    if ( e && e->up )
+	return e->up;
+    segs = __atomic_load_n(&__exclib_class_segments, __ATOMIC_ACQUIRE);
+    if ( !segs )
+	return 0;
+    for ( lo = 0, hi = segs->n; lo < hi; ) {
+	mid = lo + (hi - lo) / 2;
+	if ( value < segs->seg[mid].lo )
+	    hi = mid;
+	else if ( value > segs->seg[mid].hi )
+	    lo = mid + 1;
+	else
+	    return segs->seg[mid].up;
+    }
+    return 0;
+}
+
+int exclib_exception_is(int value, int cls)
+{
+    struct exclib_registry *reg;
+    struct exclib_registry_entry *e;
+    int k;
+    int up;
+
+    if ( value == cls )
+	return 1;
+    if ( __atomic_load_n(&__exclib_class_count, __ATOMIC_RELAXED) == 0 )
+	return 0;
+    reg = __atomic_load_n(&__exclib_registry, __ATOMIC_ACQUIRE);
+    e = exclib_registry_find(reg, cls);
+    if ( !e || !e->klass )
+	return 0;
+    k = e->klass - 1;
+    up = exclib_class_of(reg, value);
+    if ( !up )
+	return 0;
+    return (int)((__exclib_class_ancestors[up - 1][k / EXCLIB_CLASS_BITS] >> (k % EXCLIB_CLASS_BITS)) & 1UL);
+}
+
+int exclib_exception_parent(int value)
+{
+    struct exclib_registry *reg = __atomic_load_n(&__exclib_registry, __ATOMIC_ACQUIRE);
+    struct exclib_registry_entry *e = exclib_registry_find(reg, value);
+    int up;
+
+    if ( e && e->parent )
+	return e->parent;
+    if ( e && e->klass )
+	up = __atomic_load_n(&__exclib_class_range_up[e->klass - 1], __ATOMIC_RELAXED);
+    else
+	up = exclib_class_of(reg, value);
+    return up ? __exclib_class_codes[up - 1] : 0;
+}
+
+void exclib_raise_uncaught(int value)
+{
+    int signal;
+
+    exclib_init_registry();
+    signal = exclib_exception_signal(value);
+    if ( signal != 0 ) {
+	/* exit() would have flushed stdio for us, a signal won't */
+	fflush(NULL);
+	raise(signal);
+    }
+    /* no signal registered, or it was caught/ignored and we came back */
+    exit(value);
+}
@@ -0,0 +1,628 @@
+#include "exclib.h"
+#include <errno.h>
+
+/*
+ * Exception reports are formatted by hand into a buffer on the caller's stack
+ * and go out with a single write(2): no malloc, no stdio, no locks. That makes
+ * them safe to print from a signal handler, and keeps many threads failing at
+ * once from queueing up on the stderr lock or interleaving their lines. Only a
+ * report too big for EXC_REPORT_BUFSIZE takes more than one write.
+ */
+
+/* the most decimals a THROWF floating conversion prints, so they fit an unsigned long */
+#define EXCLIB_REPORT_DECIMALS 9
+/* base 10^9 limbs enough for the integer part of the largest double, 309 digits */
+#define EXCLIB_REPORT_LIMBS    35
+/* room for any one THROWF conversion: a double's sign, 309 digits, point and decimals */
+#define EXCLIB_REPORT_NUMBER   (1 + 9 * EXCLIB_REPORT_LIMBS + 1 + EXCLIB_REPORT_DECIMALS + 1)
+
+int __exclib_report_format = EXCLIB_REPORT_LINES;
+int __exclib_report_fd = 2;
+
+struct exclib_report {
+    char buf[EXC_REPORT_BUFSIZE];
+    unsigned int len;
+    int fd;
+    int compact;
+};
+
+static void exclib_report_flush(struct exclib_report *r)
+{
+    unsigned int done = 0;
+    ssize_t n;
+    int saved = errno;
+
+    while ( done < r->len ) {
+	n = write(r->fd, r->buf + done, r->len - done);
+	if ( n < 0 && errno == EINTR )
+	    continue;
+	if ( n <= 0 )
+	    break;
+	done += (unsigned int)n;
+    }
+    r->len = 0;
+    errno = saved;
+}
+
+static void exclib_report_char(struct exclib_report *r, char c)
+{
+    if ( r->len == sizeof(r->buf) ) {
+	/* no fd: it's being formatted into memory (exclib_format_message), and the rest won't fit */
+	if ( r->fd < 0 )
+	    return;
+	exclib_report_flush(r);
+    }
+    /* the compact form has to stay on one line whatever the description holds */
+    if ( r->compact && (c == '\n' || c == '\r') )
+	c = ' ';
+    r->buf[r->len++] = c;
+}
+
+static void exclib_report_str(struct exclib_report *r, const char *s)
+{
+    if ( !s )
+	s = "(null)";
+    for ( ; *s; s++ )
+	exclib_report_char(r, *s);
+}
+
+static void exclib_report_ulong(struct exclib_report *r, unsigned long v)
+{
+    char digits[3 * sizeof(unsigned long)];
+    int i = 0;
+
+    do {
+	digits[i++] = (char)('0' + v % 10);
+	v /= 10;
+    } while ( v );
+    while ( i > 0 )
+	exclib_report_char(r, digits[--i]);
+}
+
+static void exclib_report_int(struct exclib_report *r, int value)
+{
+    unsigned int v = (unsigned int)value;
+
+    if ( value < 0 ) {
+	exclib_report_char(r, '-');
+	v = 0U - v;
+    }
+    exclib_report_ulong(r, v);
+}
+
+static void exclib_report_hex(struct exclib_report *r, unsigned long value)
+{
+    char digits[2 * sizeof(unsigned long)];
+    int i = 0;
+
+    exclib_report_str(r, "0x");
+    do {
+	digits[i++] = "0123456789abcdef"[value & 0xf];
+	value >>= 4;
+    } while ( value );
+    while ( i > 0 )
+	exclib_report_char(r, digits[--i]);
+}
+
+/*
+ * One conversion of a THROWF message: the len characters at s, with pad
+ * zeros (for an integer's precision) between any sign and the digits, padded
+ * out to width
+ */
+static void exclib_report_field(struct exclib_report *r, const char *s, int len, int pad, int width, int left, int zero)
+{
+    int sign = (len > 0 && *s == '-' && (zero || pad > 0));
+    int i;
+
+    if ( sign ) {
+	s++;
+	len--;
+    }
+    for ( i = sign + pad + len; !left && !zero && i < width; i++ )
+	exclib_report_char(r, ' ');
+    if ( sign )
+	exclib_report_char(r, '-');
+    for ( i = sign + pad + len; !left && zero && i < width; i++ )
+	exclib_report_char(r, '0');
+    for ( i = 0; i < pad; i++ )
+	exclib_report_char(r, '0');
+    for ( i = 0; i < len; i++ )
+	exclib_report_char(r, s[i]);
+    for ( i = sign + pad + len; left && i < width; i++ )
+	exclib_report_char(r, ' ');
+}
+
+/* Writes v in base backwards from end, which is left NUL-terminated; returns where it starts */
+static char *exclib_report_digits(char *end, unsigned long v, unsigned int base, int upper)
+{
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+
+    *--end = '\0';
+    do {
+	*--end = digits[v % base];
+	v /= base;
+    } while ( v );
+    return end;
+}
+
+/*
+ * Writes the digits of d, a whole number too big for an unsigned long,
+ * backwards from end. It's m * 2^e for a 53-bit m, so it's worked out
+ * exactly, doubling m e times in base 10^9.
+ */
+static char *exclib_report_big(char *end, double d)
+{
+    unsigned long limbs[EXCLIB_REPORT_LIMBS];
+    unsigned long m;
+    unsigned long carry;
+    int nlimbs = 0;
+    int e;
+    int i;
+    int j;
+
+    for ( e = 0; d >= 9007199254740992.0; e++ )
+	d /= 2;
+    for ( m = (unsigned long)d; m; m /= 1000000000UL )
+	limbs[nlimbs++] = m % 1000000000UL;
+    for ( ; e > 0; e-- ) {
+	for ( carry = 0, i = 0; i < nlimbs; i++ ) {
+	    limbs[i] = limbs[i] * 2 + carry;
+	    carry = limbs[i] >= 1000000000UL;
+	    limbs[i] -= carry * 1000000000UL;
+	}
+	if ( carry )
+	    limbs[nlimbs++] = carry;
+    }
+    for ( i = 0; i < nlimbs; i++ ) {
+	for ( m = limbs[i], j = 0; j < 9 && (m || i < nlimbs - 1); j++, m /= 10 )
+	    *--end = (char)('0' + m % 10);
+    }
+    return end;
+}
+
+/*
+ * Every floating conversion comes out as %f would: fixed point, all the
+ * digits before the point, and decimals (at most EXCLIB_REPORT_DECIMALS)
+ * after it
+ */
+static char *exclib_report_double(char *end, double d, int decimals)
+{
+    unsigned long ip;
+    unsigned long fp;
+    unsigned long scale = 1;
+    int negative = (d < 0);
+    int big;
+    int i;
+
+    if ( d != d )
+	return "nan";
+    if ( negative )
+	d = -d;
+    /* only an infinity minus itself isn't 0 */
+    if ( d - d != 0 )
+	return negative ? "-inf" : "inf";
+    if ( decimals > EXCLIB_REPORT_DECIMALS )
+	decimals = EXCLIB_REPORT_DECIMALS;
+    for ( i = 0; i < decimals; i++ )
+	scale *= 10;
+    /* anything this big is a whole number, so it's all in the digits before the point */
+    big = (d >= 1e19);
+    ip = big ? 0 : (unsigned long)d;
+    fp = big ? 0 : (unsigned long)((d - (double)ip) * (double)scale + 0.5);
+    if ( fp >= scale ) {
+	ip++;
+	fp -= scale;
+    }
+    *--end = '\0';
+    for ( i = 0; i < decimals; i++, fp /= 10 )
+	*--end = (char)('0' + fp % 10);
+    if ( decimals > 0 )
+	*--end = '.';
+    if ( big ) {
+	end = exclib_report_big(end, d);
+    } else {
+	do {
+	    *--end = (char)('0' + ip % 10);
+	    ip /= 10;
+	} while ( ip );
+    }
+    if ( negative )
+	*--end = '-';
+    return end;
+}
+
+/*
+ * The next of a THROWF message's arguments, as an int: a * width or
+ * precision. def if exclib_throwf didn't keep it.
+ */
+static int exclib_report_star(const struct exclib_message *msg, int *arg, int def)
+{
+    return (*arg)++ < msg->nargs ? (int)msg->args[*arg - 1].l : def;
+}
+
+/*
+ * Formats a THROWF message (or copies the plain description) into the
+ * report. What takes an argument has to match exclib_throwf exactly.
+ */
+static void exclib_report_message(struct exclib_report *r, const struct exclib_message *msg, const char *description)
+{
+    char tmp[EXCLIB_REPORT_NUMBER];
+    char *end;
+    char *s;
+    const char *p;
+    const char *spec;
+    int arg = 0;
+    int width;
+    int precision;
+    int left;
+    int zero;
+    int lng;
+    int half;
+    int len;
+    long l;
+    unsigned long u;
+
+    if ( !msg->fmt ) {
+	exclib_report_str(r, description);
+	return;
+    }
+    for ( p = msg->fmt; *p; p++ ) {
+	if ( *p != '%' ) {
+	    exclib_report_char(r, *p);
+	    continue;
+	}
+	spec = p;
+	for ( left = zero = 0, p++; *p == '-' || *p == '0' || *p == '+' || *p == ' ' || *p == '#'; p++ ) {
+	    left |= (*p == '-');
+	    zero |= (*p == '0');
+	}
+	width = 0;
+	if ( *p == '*' ) {
+	    width = exclib_report_star(msg, &arg, 0);
+	    p++;
+	}
+	for ( ; *p >= '0' && *p <= '9'; p++ )
+	    width = width * 10 + (*p - '0');
+	/* a negative * width is the - flag, a negative * precision none at all */
+	if ( width < 0 ) {
+	    left = 1;
+	    width = -width;
+	}
+	precision = -1;
+	if ( *p == '.' ) {
+	    p++;
+	    precision = 0;
+	    if ( *p == '*' ) {
+		precision = exclib_report_star(msg, &arg, -1);
+		p++;
+	    }
+	    for ( ; *p >= '0' && *p <= '9'; p++ )
+		precision = precision * 10 + (*p - '0');
+	}
+	for ( lng = half = 0; *p == 'h' || *p == 'l' || *p == 'z' || *p == 'j' || *p == 't' || *p == 'L'; p++ ) {
+	    lng |= (*p != 'h');
+	    half += (*p == 'h');
+	}
+	if ( *p == '\0' )
+	    break;
+	if ( *p == '%' ) {
+	    exclib_report_char(r, '%');
+	    continue;
+	}
+	if ( *p == 'n' )
+	    continue;
+	/* what exclib_throwf refused is printed as written, and the arguments stopped there */
+	if ( !strchr("diuxXopfFeEgGaAcs", *p) || (lng && (*p == 'c' || *p == 's')) ) {
+	    for ( ; spec <= p; spec++ )
+		exclib_report_char(r, *spec);
+	    continue;
+	}
+	if ( arg >= msg->nargs ) {
+	    exclib_report_char(r, '?');
+	    continue;
+	}
+	end = tmp + sizeof(tmp);
+	len = -1;
+	/* h and hh arguments came promoted to int, and print cut back down to a short or a char */
+	l = msg->args[arg].l;
+	u = msg->args[arg].u;
+	if ( half == 1 ) {
+	    l = (short)l;
+	    u = (unsigned short)u;
+	} else if ( half > 1 ) {
+	    l = (signed char)l;
+	    u = (unsigned char)u;
+	}
+	switch ( *p ) {
+	case 'd': case 'i':
+	    u = l < 0 ? 0UL - (unsigned long)l : (unsigned long)l;
+	    s = exclib_report_digits(end, u, 10, 0);
+	    break;
+	case 'u':
+	    s = exclib_report_digits(end, u, 10, 0);
+	    break;
+	case 'x': case 'X':
+	    s = exclib_report_digits(end, u, 16, *p == 'X');
+	    break;
+	case 'o':
+	    s = exclib_report_digits(end, u, 8, 0);
+	    break;
+	case 'c':
+	    s = end - 2;
+	    s[0] = (char)msg->args[arg].l;
+	    s[1] = '\0';
+	    precision = -1;
+	    break;
+	case 's':
+	    s = (char *)msg->text + msg->args[arg].u;
+	    len = (int)strlen(s);
+	    if ( precision >= 0 && precision < len )
+		len = precision;
+	    precision = -1;
+	    zero = 0;
+	    break;
+	case 'p':
+	    s = exclib_report_digits(end, (unsigned long)msg->args[arg].p, 16, 0);
+	    *--s = 'x';
+	    *--s = '0';
+	    precision = -1;
+	    break;
+	default:
+	    s = exclib_report_double(end, msg->args[arg].d, precision >= 0 ? precision : 6);
+	    precision = -1;
+	    break;
+	}
+	/* an integer's precision is the fewest digits, and 0 in none prints nothing; it turns off the 0 flag */
+	if ( precision >= 0 ) {
+	    if ( precision == 0 && u == 0 )
+		*s = '\0';
+	    zero = 0;
+	}
+	if ( (*p == 'd' || *p == 'i') && l < 0 )
+	    *--s = '-';
+	if ( len < 0 )
+	    len = (int)strlen(s);
+	arg++;
+	exclib_report_field(r, s, len, precision > len - (*s == '-') ? precision - (len - (*s == '-')) : 0,
+			    width, left, zero);
+    }
+}
+
+static void exclib_report_payload(struct exclib_report *r, const struct exclib_payload *payload)
+{
+    static const char *names[] = {NULL, "errno", "ptr", "size", "int"};
+
+    if ( payload->type <= EXCLIB_PAYLOAD_NONE || payload->type > EXCLIB_PAYLOAD_INT )
+	return;
+    exclib_report_str(r, " [");
+    exclib_report_str(r, names[payload->type]);
+    exclib_report_char(r, '=');
+    if ( payload->type == EXCLIB_PAYLOAD_PTR )
+	exclib_report_hex(r, payload->value);
+    else if ( payload->type == EXCLIB_PAYLOAD_SIZE )
+	exclib_report_ulong(r, payload->value);
+    else
+	exclib_report_int(r, (int)(long)payload->value);
+    exclib_report_char(r, ']');
+}
+
+int exclib_format_message(const struct exclib_message *msg, const char *description, char *buf, int size)
+{
+    struct exclib_report r;
+    int n;
+
+    r.len = 0;
+    r.fd = -1;
+    r.compact = 0;
+    exclib_report_message(&r, msg, description);
+    if ( size <= 0 )
+	return (int)r.len;
+    n = (int)r.len < size - 1 ? (int)r.len : size - 1;
+    memcpy(buf, r.buf, n);
+    buf[n] = '\0';
+    return n;
+}
+
+/* Ends a line of the report; in the compact form the lines are joined with " | " */
+static void exclib_report_eol(struct exclib_report *r, int last)
+{
+    if ( !r->compact ) {
+	exclib_report_char(r, '\n');
+	return;
+    }
+    if ( last ) {
+	r->compact = 0;
+	exclib_report_char(r, '\n');
+    } else
+	exclib_report_str(r, " | ");
+}
+
+static void exclib_report_flags(struct exclib_report *r, unsigned int flags)
+{
+    static const struct {
+	unsigned int flag;
+	const char *text;
+    } names[] = {
+	{EXCLIB_F_CATCHING, "catching"},
+	{EXCLIB_F_CAUGHT, "caught"},
+	{EXCLIB_F_TRIED, "tried"},
+	{EXCLIB_F_THROWN, "thrown"}
+    };
+    unsigned int i;
+    int first = 1;
+
+    for ( i = 0; i < sizeof(names) / sizeof(names[0]); i++ ) {
+	if ( !(flags & names[i].flag) )
+	    continue;
+	if ( !first )
+	    exclib_report_char(r, ',');
+	exclib_report_str(r, names[i].text);
+	first = 0;
+    }
+}
+
+void exclib_set_report_format(int format)
+{
+    __exclib_report_format = format;
+}
+
+void exclib_set_report_fd(int fd)
+{
+    __exclib_report_fd = fd;
+}
+
+void exclib_print_exception_stack(char *mbuf, char *file, char *func, int line)
+{
+    struct exclib_report r;
+    struct exclib_status *cur;
+    struct exclib_frame_info *info;
+    const struct exclib_site *site;
+    const struct exclib_cause *cause;
+    int top = __exclib_curidx - 1;
+    int idx = 0;
+    int chained = 0;
+    int i;
+
+    r.len = 0;
+    r.fd = __exclib_report_fd;
+    r.compact = (__exclib_report_format == EXCLIB_REPORT_COMPACT);
+
+    exclib_report_str(&r, "EXCLIB: ");
+    exclib_report_str(&r, file);
+    exclib_report_char(&r, ':');
+    exclib_report_int(&r, line);
+    exclib_report_char(&r, ':');
+    exclib_report_str(&r, func);
+    exclib_report_str(&r, ": ");
+    exclib_report_str(&r, mbuf);
+
+    if ( __exclib_throwidx > top )
+      top = __exclib_throwidx;
+
+    if ( top < 0 ) {
+	exclib_report_eol(&r, 0);
+	if ( !r.compact )
+	    exclib_report_str(&r, "EXCLIB: ");
+	exclib_report_str(&r, "#0: No exception stack");
+    } else {
+      for ( ; top >= 0; top-- ) {
+	cur = exclib_frame_at(top);
+	info = exclib_frame_info_at(top);
+	site = exclib_frame_site(top);
+	exclib_report_eol(&r, 0);
+	if ( !r.compact )
+	    exclib_report_str(&r, "EXCLIB: ");
+	exclib_report_char(&r, '#');
+	exclib_report_int(&r, idx);
+	exclib_report_char(&r, '[');
+	exclib_report_hex(&r, (unsigned long)cur);
+	exclib_report_str(&r, "] ");
+	exclib_report_str(&r, site->file);
+	exclib_report_char(&r, ':');
+	exclib_report_int(&r, site->line);
+	exclib_report_char(&r, ':');
+	exclib_report_str(&r, site->function);
+	exclib_report_char(&r, ':');
+	/* name and description are only written by THROW */
+	if ( !(cur->flags & EXCLIB_F_THROWN) )
+	  exclib_report_str(&r, "Unnamed Exception");
+	else
+	  exclib_report_str(&r, info->name ? info->name : "NULL");
+	exclib_report_char(&r, ':');
+	exclib_report_int(&r, cur->value);
+	exclib_report_char(&r, ':');
+	exclib_report_flags(&r, cur->flags);
+	exclib_report_str(&r, ": ");
+	if ( !(cur->flags & EXCLIB_F_THROWN) ) {
+	  exclib_report_str(&r, "No Description");
+	} else {
+	  exclib_report_message(&r, &info->msg, info->description);
+	  exclib_report_payload(&r, &info->payload);
+	}
+	/* what the innermost exception replaced when it was rethrown */
+	for ( i = 0; !chained && (cur->flags & EXCLIB_F_THROWN) && i < info->ncauses; i++ ) {
+	  cause = &info->causes[i];
+	  exclib_report_eol(&r, 0);
+	  if ( !r.compact )
+	      exclib_report_str(&r, "EXCLIB: ");
+	  exclib_report_str(&r, "  caused by ");
+	  exclib_report_str(&r, cause->site->file);
+	  exclib_report_char(&r, ':');
+	  exclib_report_int(&r, cause->site->line);
+	  exclib_report_char(&r, ':');
+	  exclib_report_str(&r, cause->site->function);
+	  exclib_report_char(&r, ':');
+	  exclib_report_str(&r, cause->name ? cause->name : "NULL");
+	  exclib_report_char(&r, ':');
+	  exclib_report_int(&r, cause->value);
+	  exclib_report_str(&r, ": ");
+	  exclib_report_message(&r, &cause->msg, cause->description);
+	  exclib_report_payload(&r, &cause->payload);
+	}
+	chained |= (cur->flags & EXCLIB_F_THROWN);
+	idx += 1;
+      }
+    }
+    /* the native stack of the exception still in flight, as raw addresses; see exclib_print_backtrace */
+    for ( idx = 0; idx < __exclib_backtrace_len; idx++ ) {
+	exclib_report_eol(&r, 0);
+	if ( !r.compact )
+	    exclib_report_str(&r, "EXCLIB: ");
+	exclib_report_char(&r, '@');
+	exclib_report_int(&r, idx);
+	exclib_report_char(&r, ' ');
+	exclib_report_hex(&r, (unsigned long)__exclib_backtrace[idx]);
+    }
+    exclib_report_eol(&r, 1);
+    exclib_report_flush(&r);
+}
+
+/* exclib_throwf's complaint about the conversion spec (len characters) in fmt that it couldn't keep the argument for */
+void exclib_print_bad_format(const struct exclib_site *site, const char *spec, int len, const char *fmt)
+{
+    struct exclib_report r;
+    int i;
+
+    r.len = 0;
+    r.fd = __exclib_report_fd;
+    r.compact = 0;
+    exclib_report_str(&r, "EXCLIB: ");
+    exclib_report_str(&r, site->file);
+    exclib_report_char(&r, ':');
+    exclib_report_int(&r, site->line);
+    exclib_report_char(&r, ':');
+    exclib_report_str(&r, site->function);
+    exclib_report_str(&r, ": THROWF can't keep the argument for ");
+    for ( i = 0; i < len; i++ )
+	exclib_report_char(&r, spec[i]);
+    exclib_report_str(&r, " in \"");
+    exclib_report_str(&r, fmt);
+    exclib_report_str(&r, "\"; it and the rest print as ?");
+    exclib_report_char(&r, '\n');
+    exclib_report_flush(&r);
+}
+
+/* The reporting policy's summary for a (code, site) it has been holding back; see src/policy.c */
+void exclib_print_suppressed(int code, const struct exclib_site *site, unsigned long count)
+{
+    struct exclib_report r;
+    char *name = exclib_exception_name(code);
+
+    r.len = 0;
+    r.fd = __exclib_report_fd;
+    r.compact = 0;
+    exclib_report_str(&r, "EXCLIB: ");
+    exclib_report_str(&r, site->file);
+    exclib_report_char(&r, ':');
+    exclib_report_int(&r, site->line);
+    exclib_report_char(&r, ':');
+    exclib_report_str(&r, site->function);
+    exclib_report_str(&r, ": suppressed ");
+    exclib_report_ulong(&r, count);
+    exclib_report_str(&r, " similar reports of ");
+    exclib_report_str(&r, name ? name : "exception");
+    exclib_report_char(&r, ' ');
+    exclib_report_int(&r, code);
+    exclib_report_char(&r, '\n');
+    exclib_report_flush(&r);
+}
@@ -0,0 +1,40 @@
+#include "exclib.h"
+
+/*
+ * Site IDs. On ELF with gcc/clang every struct exclib_site lands in the
+ * exclib_sites section and the linker brackets it with __start_/__stop_
+ * symbols, so a site's ID is just its index there, plus one. The symbols are
+ * weak: a program with no TRY/THROW at all has no section to bracket.
+ * Elsewhere (and for sites in other shared objects) the ID is 0, "unknown".
+ */
+
+#if defined(__GNUC__) && defined(__ELF__)
+extern const struct exclib_site __start_exclib_sites[] __attribute__((weak, visibility("hidden")));
+extern const struct exclib_site __stop_exclib_sites[] __attribute__((weak, visibility("hidden")));
+#define EXCLIB_SITES_START __start_exclib_sites
+#define EXCLIB_SITES_STOP  __stop_exclib_sites
+#else
+#define EXCLIB_SITES_START ((const struct exclib_site *)0)
+#define EXCLIB_SITES_STOP  ((const struct exclib_site *)0)
+#endif
+
+unsigned int exclib_site_count()
+{
+    if ( !EXCLIB_SITES_START || !EXCLIB_SITES_STOP )
+	return 0;
+    return (unsigned int)(EXCLIB_SITES_STOP - EXCLIB_SITES_START);
+}
+
+unsigned int exclib_site_id(const struct exclib_site *site)
+{
+    if ( !site || !EXCLIB_SITES_START || site < EXCLIB_SITES_START || site >= EXCLIB_SITES_STOP )
+	return 0;
+    return (unsigned int)(site - EXCLIB_SITES_START) + 1;
+}
+
+const struct exclib_site *exclib_site_by_id(unsigned int id)
+{
+    if ( id == 0 || id > exclib_site_count() )
+	return (const struct exclib_site *)0;
+    return &EXCLIB_SITES_START[id - 1];
+}
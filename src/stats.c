@@ -0,0 +1,417 @@
+#include "exclib.h"
+#include <pthread.h>
+
+/*
+ * Exception telemetry. Each thread counts into its own shard, so recording an
+ * event is a plain load and store on memory no other thread writes: no lock,
+ * no atomic read-modify-write. A shard holds a small open-addressing table
+ * keyed by exception code and an array indexed by site ID.
+ *
+ * Anything that changes a shard's layout (its first use, a code it hasn't
+ * seen before, the code table growing) happens under __exclib_stats_lock, and
+ * so does exclib_stats_snapshot when it walks the shards, so a snapshot never
+ * sees a table being freed from under it. Counters themselves are read while
+ * their threads keep counting; a snapshot is a consistent-enough sum, not an
+ * instant. When a thread exits its shard is folded into __exclib_stats_retired.
+ *
+ * The fault handler can't take the lock or allocate, so while it's raising
+ * (__exclib_faulting) an event that would need either isn't counted;
+ * exclib_stats_prepare sets a thread up beforehand so its faults are.
+ */
+
+#define EXCLIB_STATS_MIN 16
+
+struct exclib_stats_code {
+    int code;
+    int used;
+    unsigned long n[EXCLIB_STAT_EVENTS];
+};
+
+struct exclib_stats_shard {
+    struct exclib_stats_shard *next;
+    struct exclib_stats_shard *prev;
+    unsigned int mask;
+    unsigned int count;
+    struct exclib_stats_code *codes;
+    struct exclib_stats_code *last;     /* most exceptions are caught by the frame that threw them */
+    unsigned int nsites;
+    unsigned long (*sites)[EXCLIB_STAT_EVENTS];
+};
+
+int __exclib_stats_enabled = 1;
+
+#if EXCLIB_STATS
+
+static EXCLIB_TLS struct exclib_stats_shard *__exclib_stats_shard = NULL;
+static struct exclib_stats_shard *__exclib_stats_shards = NULL;
+static struct exclib_stats_shard __exclib_stats_retired;
+static pthread_mutex_t __exclib_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t __exclib_stats_key;
+static pthread_once_t __exclib_stats_once = PTHREAD_ONCE_INIT;
+
+static struct exclib_stats_code *exclib_stats_find(struct exclib_stats_shard *shard, int code)
+{
+    unsigned int i;
+    struct exclib_stats_code *c;
+
+    if ( !shard->codes )
+	return NULL;
+    for ( i = exclib_code_hash(code) & shard->mask; ; i = (i + 1) & shard->mask ) {
+	c = &shard->codes[i];
+	if ( !c->used )
+	    return NULL;
+	if ( c->code == code )
+	    return c;
+    }
+}
+
+/* Caller holds __exclib_stats_lock. Returns code's slot, making room for it if need be; NULL out of memory */
+static struct exclib_stats_code *exclib_stats_insert(struct exclib_stats_shard *shard, int code)
+{
+    struct exclib_stats_code *c;
+    struct exclib_stats_code *old = shard->codes;
+    unsigned int oldsize = old ? shard->mask + 1 : 0;
+    unsigned int size;
+    unsigned int i;
+
+    c = exclib_stats_find(shard, code);
+    if ( c )
+	return c;
+    if ( (shard->count + 1) * 2 > oldsize ) {
+	size = oldsize ? oldsize * 2 : EXCLIB_STATS_MIN;
+	c = (struct exclib_stats_code *)calloc(size, sizeof(struct exclib_stats_code));
+	if ( !c )
+	    return NULL;
+	shard->codes = c;
+	shard->last = NULL;
+	shard->mask = size - 1;
+	shard->count = 0;
+	for ( i = 0; i < oldsize; i++ ) {
+	    if ( old[i].used )
+		*exclib_stats_insert(shard, old[i].code) = old[i];
+	}
+	free(old);
+    }
+    for ( i = exclib_code_hash(code) & shard->mask; shard->codes[i].used; i = (i + 1) & shard->mask )
+	;
+    c = &shard->codes[i];
+    c->code = code;
+    c->used = 1;
+    shard->count++;
+    return c;
+}
+
+/* Caller holds __exclib_stats_lock */
+static void exclib_stats_merge(struct exclib_stats_shard *dst, struct exclib_stats_shard *src)
+{
+    struct exclib_stats_code *c;
+    unsigned long (*sites)[EXCLIB_STAT_EVENTS];
+    unsigned int i;
+    int e;
+
+    for ( i = 0; src->codes && i <= src->mask; i++ ) {
+	if ( !src->codes[i].used )
+	    continue;
+	c = exclib_stats_insert(dst, src->codes[i].code);
+	if ( !c )
+	    continue;
+	for ( e = 0; e < EXCLIB_STAT_EVENTS; e++ )
+	    c->n[e] += __atomic_load_n(&src->codes[i].n[e], __ATOMIC_RELAXED);
+    }
+    if ( src->nsites > dst->nsites ) {
+	sites = (unsigned long (*)[EXCLIB_STAT_EVENTS])calloc(src->nsites, sizeof(*dst->sites));
+	if ( sites ) {
+	    if ( dst->sites )
+		memcpy(sites, dst->sites, dst->nsites * sizeof(*dst->sites));
+	    free(dst->sites);
+	    dst->sites = sites;
+	    dst->nsites = src->nsites;
+	}
+    }
+    for ( i = 0; i < src->nsites && i < dst->nsites; i++ ) {
+	for ( e = 0; e < EXCLIB_STAT_EVENTS; e++ )
+	    dst->sites[i][e] += __atomic_load_n(&src->sites[i][e], __ATOMIC_RELAXED);
+    }
+}
+
+static void exclib_stats_free_shard(struct exclib_stats_shard *shard)
+{
+    free(shard->codes);
+    free(shard->sites);
+    free(shard);
+}
+
+static void exclib_stats_thread_exit(void *arg)
+{
+    struct exclib_stats_shard *shard = (struct exclib_stats_shard *)arg;
+
+    pthread_mutex_lock(&__exclib_stats_lock);
+    exclib_stats_merge(&__exclib_stats_retired, shard);
+    if ( shard->prev )
+	shard->prev->next = shard->next;
+    else
+	__exclib_stats_shards = shard->next;
+    if ( shard->next )
+	shard->next->prev = shard->prev;
+    pthread_mutex_unlock(&__exclib_stats_lock);
+    __exclib_stats_shard = NULL;
+    exclib_stats_free_shard(shard);
+}
+
+static void exclib_stats_key_init(void)
+{
+    pthread_key_create(&__exclib_stats_key, exclib_stats_thread_exit);
+}
+
+static struct exclib_stats_shard *exclib_stats_new_shard(void)
+{
+    struct exclib_stats_shard *shard;
+
+    shard = (struct exclib_stats_shard *)calloc(1, sizeof(struct exclib_stats_shard));
+    if ( !shard )
+	return NULL;
+    /* site IDs are fixed at link time, so this never has to grow */
+    shard->nsites = exclib_site_count() + 1;
+    shard->sites = (unsigned long (*)[EXCLIB_STAT_EVENTS])calloc(shard->nsites, sizeof(*shard->sites));
+    if ( !shard->sites ) {
+	free(shard);
+	return NULL;
+    }
+    pthread_once(&__exclib_stats_once, exclib_stats_key_init);
+    pthread_mutex_lock(&__exclib_stats_lock);
+    shard->next = __exclib_stats_shards;
+    if ( shard->next )
+	shard->next->prev = shard;
+    __exclib_stats_shards = shard;
+    pthread_mutex_unlock(&__exclib_stats_lock);
+    pthread_setspecific(__exclib_stats_key, shard);
+    __exclib_stats_shard = shard;
+    return shard;
+}
+
+/* Makes this thread's shard, and a slot in it for code, ahead of code being counted from the fault handler */
+void exclib_stats_prepare(int code)
+{
+    struct exclib_stats_shard *shard = __exclib_stats_shard;
+
+    if ( !shard && (shard = exclib_stats_new_shard()) == NULL )
+	return;
+    if ( exclib_stats_find(shard, code) )
+	return;
+    pthread_mutex_lock(&__exclib_stats_lock);
+    exclib_stats_insert(shard, code);
+    pthread_mutex_unlock(&__exclib_stats_lock);
+}
+
+void exclib_stats_record(int event, int code, const struct exclib_site *site)
+{
+    struct exclib_stats_shard *shard = __exclib_stats_shard;
+    struct exclib_stats_code *c;
+    unsigned int id;
+
+    if ( !__exclib_stats_enabled )
+	return;
+    if ( !shard && (__exclib_faulting || (shard = exclib_stats_new_shard()) == NULL) )
+	return;
+    c = shard->last;
+    if ( !c || c->code != code ) {
+	c = exclib_stats_find(shard, code);
+	if ( !c ) {
+	    if ( __exclib_faulting )
+		return;
+	    pthread_mutex_lock(&__exclib_stats_lock);
+	    c = exclib_stats_insert(shard, code);
+	    pthread_mutex_unlock(&__exclib_stats_lock);
+	    if ( !c )
+		return;
+	}
+	shard->last = c;
+    }
+    /* only this thread writes these; the relaxed store just keeps a snapshot's read from tearing */
+    __atomic_store_n(&c->n[event], c->n[event] + 1, __ATOMIC_RELAXED);
+    id = exclib_site_id(site);
+    if ( id != 0 && id < shard->nsites )
+	__atomic_store_n(&shard->sites[id][event], shard->sites[id][event] + 1, __ATOMIC_RELAXED);
+}
+
+static int exclib_stats_code_cmp(const void *a, const void *b)
+{
+    int x = ((const struct exclib_code_stats *)a)->code;
+    int y = ((const struct exclib_code_stats *)b)->code;
+
+    return x < y ? -1 : x > y;
+}
+
+struct exclib_stats *exclib_stats_snapshot()
+{
+    struct exclib_stats_shard sum;
+    struct exclib_stats_shard *shard;
+    struct exclib_stats *stats;
+    unsigned int i;
+    int e;
+
+    memset(&sum, 0, sizeof(sum));
+    pthread_mutex_lock(&__exclib_stats_lock);
+    exclib_stats_merge(&sum, &__exclib_stats_retired);
+    for ( shard = __exclib_stats_shards; shard; shard = shard->next )
+	exclib_stats_merge(&sum, shard);
+    pthread_mutex_unlock(&__exclib_stats_lock);
+
+    stats = (struct exclib_stats *)calloc(1, sizeof(struct exclib_stats));
+    if ( !stats )
+	goto out;
+    stats->codes = (struct exclib_code_stats *)calloc(sum.count + 1, sizeof(struct exclib_code_stats));
+    stats->sites = (struct exclib_site_stats *)calloc(sum.nsites + 1, sizeof(struct exclib_site_stats));
+    if ( !stats->codes || !stats->sites ) {
+	exclib_stats_free(stats);
+	stats = NULL;
+	goto out;
+    }
+    for ( i = 0; sum.codes && i <= sum.mask; i++ ) {
+	if ( !sum.codes[i].used )
+	    continue;
+	stats->codes[stats->ncodes].code = sum.codes[i].code;
+	for ( e = 0; e < EXCLIB_STAT_EVENTS; e++ ) {
+	    stats->codes[stats->ncodes].n[e] = sum.codes[i].n[e];
+	    stats->total[e] += sum.codes[i].n[e];
+	}
+	stats->ncodes++;
+    }
+    qsort(stats->codes, stats->ncodes, sizeof(struct exclib_code_stats), exclib_stats_code_cmp);
+    for ( i = 1; i < sum.nsites; i++ ) {
+	for ( e = 0; e < EXCLIB_STAT_EVENTS && sum.sites[i][e] == 0; e++ )
+	    ;
+	if ( e == EXCLIB_STAT_EVENTS )
+	    continue;
+	stats->sites[stats->nsites].site = exclib_site_by_id(i);
+	memcpy(stats->sites[stats->nsites].n, sum.sites[i], sizeof(sum.sites[i]));
+	stats->nsites++;
+    }
+out:
+    free(sum.codes);
+    free(sum.sites);
+    return stats;
+}
+
+#else /* EXCLIB_STATS */
+
+void exclib_stats_prepare(int code)
+{
+    (void)code;
+}
+
+void exclib_stats_record(int event, int code, const struct exclib_site *site)
+{
+    (void)event;
+    (void)code;
+    (void)site;
+}
+
+/* compiled out: a snapshot is always empty */
+struct exclib_stats *exclib_stats_snapshot()
+{
+    return (struct exclib_stats *)calloc(1, sizeof(struct exclib_stats));
+}
+
+#endif /* EXCLIB_STATS */
+
+void exclib_stats_enable(int on)
+{
+    __exclib_stats_enabled = on;
+}
+
+void exclib_stats_free(struct exclib_stats *stats)
+{
+    if ( !stats )
+	return;
+    free(stats->codes);
+    free(stats->sites);
+    free(stats);
+}
+
+static const char *__exclib_stat_names[EXCLIB_STAT_EVENTS] = {"thrown", "caught", "propagated", "uncaught"};
+
+/* s as a JSON string; exclib_profile_dump uses it too */
+void exclib_stats_json_str(FILE *out, const char *s)
+{
+    fputc('"', out);
+    for ( ; s && *s; s++ ) {
+	if ( *s == '"' || *s == '\\' )
+	    fprintf(out, "\\%c", *s);
+	else if ( (unsigned char)*s < 0x20 )
+	    fprintf(out, "\\u%04x", (unsigned int)(unsigned char)*s);
+	else
+	    fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+static void exclib_stats_dump_counts(FILE *out, const unsigned long *n, int json)
+{
+    int e;
+
+    for ( e = 0; e < EXCLIB_STAT_EVENTS; e++ ) {
+	if ( json )
+	    fprintf(out, "%s\"%s\":%lu", e ? "," : "", __exclib_stat_names[e], n[e]);
+	else
+	    fprintf(out, " %s %lu", __exclib_stat_names[e], n[e]);
+    }
+}
+
+void exclib_stats_dump(FILE *out, const struct exclib_stats *stats, int format)
+{
+    const struct exclib_site *site;
+    const char *name;
+    unsigned int i;
+    int json = (format == EXCLIB_STATS_JSON);
+
+    if ( !stats )
+	return;
+    if ( json ) {
+	fprintf(out, "{\"total\":{");
+	exclib_stats_dump_counts(out, stats->total, 1);
+	fprintf(out, "},\"codes\":[");
+    } else {
+	fprintf(out, "total:");
+	exclib_stats_dump_counts(out, stats->total, 0);
+	fprintf(out, "\n");
+    }
+    for ( i = 0; i < stats->ncodes; i++ ) {
+	name = exclib_exception_name(stats->codes[i].code);
+	if ( json ) {
+	    fprintf(out, "%s{\"code\":%d,\"name\":", i ? "," : "", stats->codes[i].code);
+	    if ( name )
+		exclib_stats_json_str(out, name);
+	    else
+		fprintf(out, "null");
+	    fprintf(out, ",");
+	    exclib_stats_dump_counts(out, stats->codes[i].n, 1);
+	    fprintf(out, "}");
+	} else {
+	    fprintf(out, "code %d (%s):", stats->codes[i].code, name ? name : "unnamed");
+	    exclib_stats_dump_counts(out, stats->codes[i].n, 0);
+	    fprintf(out, "\n");
+	}
+    }
+    if ( json )
+	fprintf(out, "],\"sites\":[");
+    for ( i = 0; i < stats->nsites; i++ ) {
+	site = stats->sites[i].site;
+	if ( json ) {
+	    fprintf(out, "%s{\"file\":", i ? "," : "");
+	    exclib_stats_json_str(out, site->file);
+	    fprintf(out, ",\"line\":%d,\"function\":", site->line);
+	    exclib_stats_json_str(out, site->function);
+	    fprintf(out, ",\"kind\":\"%s\",", site->kind == EXCLIB_SITE_TRY ? "TRY" : "THROW");
+	    exclib_stats_dump_counts(out, stats->sites[i].n, 1);
+	    fprintf(out, "}");
+	} else {
+	    fprintf(out, "site %s:%d:%s (%s):", site->file, site->line, site->function,
+		    site->kind == EXCLIB_SITE_TRY ? "TRY" : "THROW");
+	    exclib_stats_dump_counts(out, stats->sites[i].n, 0);
+	    fprintf(out, "\n");
+	}
+    }
+    if ( json )
+	fprintf(out, "]}\n");
+}
@@ -0,0 +1,47 @@
+#!/bin/sh
+#
+# Checks that a library or program built with EXCLIB_USDT carries the exclib
+# probes named after it, each with the arguments include/exclib.h documents:
+#
+#     tools/check-probes.sh lib/libexc.a try throw propagate uncaught
+#
+# Prints one line per probe and exits nonzero if any is missing or has the
+# wrong number of arguments. Needs readelf (binutils).
+
+if [ $# -lt 2 ]; then
+    echo "usage: $0 <library or program> <probe>..." >&2
+    exit 2
+fi
+file=$1
+shift
+if [ ! -f "$file" ]; then
+    echo "$file: not found" >&2
+    exit 2
+fi
+
+# "name nargs" for each exclib note
+notes=$(readelf -n "$file" 2>/dev/null | awk '
+    /Provider:/ { provider = $2 }
+    /Name:/ { name = $2 }
+    /Arguments:/ { if ( provider == "exclib" ) print name, NF - 1 }')
+
+status=0
+for probe in "$@"; do
+    case $probe in
+	try) want=2 ;;
+	catch|propagate) want=3 ;;
+	throw|uncaught) want=4 ;;
+	*) echo "$file: exclib:$probe isn't a probe exclib has"; status=1; continue ;;
+    esac
+    found=$(echo "$notes" | awk -v p="$probe" '$1 == p { print $2 }' | sort -u)
+    if [ -z "$found" ]; then
+	echo "$file: exclib:$probe missing"
+	status=1
+    elif [ "$found" != "$want" ]; then
+	echo "$file: exclib:$probe has" $found "arguments, not $want"
+	status=1
+    else
+	echo "$file: exclib:$probe ok ($(echo "$notes" | grep -c "^$probe ") note(s) with $want arguments)"
+    fi
+done
+exit $status
@@ -0,0 +1,188 @@
+#define _POSIX_C_SOURCE 200112L
+#include "exclib.h"
+#include <time.h>
+
+/*
+ * exclib-dump: prints what a flight recorder file (see exclib_recorder_open)
+ * holds, oldest record first, with every thread's ring merged by time:
+ *
+ *     tools/exclib-dump [-n count] <file>
+ *
+ * -n keeps only the last count records. It only reads the file, so it works
+ * as well on one a running process is still writing as after it died; a
+ * record that was being written at the time is left out.
+ */
+
+static const char *events[EXCLIB_STAT_EVENTS] = {"thrown", "caught", "propagated", "uncaught"};
+
+static char *flight;
+static long flight_size;
+
+static int by_time(const void *a, const void *b)
+{
+    const struct exclib_flight_record *x = *(const struct exclib_flight_record * const *)a;
+    const struct exclib_flight_record *y = *(const struct exclib_flight_record * const *)b;
+
+    if ( x->clock != y->clock )
+	return x->clock < y->clock ? -1 : 1;
+    if ( x->tid != y->tid )
+	return x->tid < y->tid ? -1 : 1;
+    if ( x->seq != y->seq )
+	return x->seq < y->seq ? -1 : 1;
+    return 0;
+}
+
+static void print_time(unsigned long ns)
+{
+    time_t secs = (time_t)(ns / 1000000000UL);
+    struct tm tm;
+    char buf[32];
+
+    gmtime_r(&secs, &tm);
+    strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+    printf("%s.%09luZ", buf, ns % 1000000000UL);
+}
+
+/* A record's clock as CLOCK_REALTIME ns, going by the header's calibration */
+static unsigned long record_time(const struct exclib_flight_header *h, unsigned long clock)
+{
+    double ticks = (double)(long)(clock - h->clock_base);
+
+    return h->started + (unsigned long)(long)(ticks * 1e9 / (double)h->clock_hz);
+}
+
+static int load(const char *path)
+{
+    FILE *in = fopen(path, "rb");
+
+    if ( !in ) {
+	perror(path);
+	return -1;
+    }
+    if ( fseek(in, 0, SEEK_END) != 0 || (flight_size = ftell(in)) < 0 || fseek(in, 0, SEEK_SET) != 0 ) {
+	perror(path);
+	fclose(in);
+	return -1;
+    }
+    flight = (char *)malloc(flight_size + 1);
+    if ( !flight || fread(flight, 1, flight_size, in) != (size_t)flight_size ) {
+	fprintf(stderr, "%s: can't read it\n", path);
+	fclose(in);
+	return -1;
+    }
+    fclose(in);
+    return 0;
+}
+
+/* Whether the header describes a file that fits in what was read */
+static int check(const char *path, const struct exclib_flight_header *h)
+{
+    unsigned long stride;
+
+    if ( flight_size < (long)sizeof(*h) || memcmp(h->magic, EXCLIB_FLIGHT_MAGIC, sizeof(EXCLIB_FLIGHT_MAGIC)) != 0 ) {
+	fprintf(stderr, "%s: not a flight recorder file\n", path);
+	return -1;
+    }
+    if ( h->version != EXCLIB_FLIGHT_VERSION || h->record_size != sizeof(struct exclib_flight_record) ) {
+	fprintf(stderr, "%s: version %u with %u byte records; this exclib-dump reads version %d, %d byte records\n",
+		path, h->version, h->record_size, EXCLIB_FLIGHT_VERSION, (int)sizeof(struct exclib_flight_record));
+	return -1;
+    }
+    stride = sizeof(struct exclib_flight_ring) + (unsigned long)h->nrecords * sizeof(struct exclib_flight_record);
+    if ( h->nrecords == 0 || h->clock_hz == 0 || h->sites_offset > h->strings_offset || h->strings_offset > h->rings_offset ||
+	 (unsigned long)h->sites_offset + (unsigned long)h->nsites * sizeof(struct exclib_flight_site) > h->strings_offset ||
+	 (unsigned long)h->rings_offset + h->nrings * stride > (unsigned long)flight_size ) {
+	fprintf(stderr, "%s: truncated or damaged\n", path);
+	return -1;
+    }
+    return 0;
+}
+
+/* A site's file or function name, or "?" if the offset is out of bounds */
+static const char *site_string(const struct exclib_flight_header *h, unsigned int off)
+{
+    const char *strings = flight + h->strings_offset;
+    unsigned int len = h->rings_offset - h->strings_offset;
+
+    if ( off >= len || memchr(strings + off, '\0', len - off) == NULL )
+	return "?";
+    return strings + off;
+}
+
+int main(int argc, char **argv)
+{
+    const struct exclib_flight_header *h;
+    const struct exclib_flight_site *sites;
+    const struct exclib_flight_site *fs;
+    const struct exclib_flight_ring *ring;
+    const struct exclib_flight_record *r;
+    const struct exclib_flight_record **all;
+    const char *path = NULL;
+    unsigned long stride;
+    unsigned long first;
+    unsigned long n = 0;
+    unsigned long limit = 0;
+    unsigned int i;
+    unsigned int j;
+    int a;
+
+    for ( a = 1; a < argc; a++ ) {
+	if ( strcmp(argv[a], "-n") == 0 && a + 1 < argc )
+	    limit = strtoul(argv[++a], NULL, 10);
+	else if ( argv[a][0] != '-' && !path )
+	    path = argv[a];
+	else {
+	    path = NULL;
+	    break;
+	}
+    }
+    if ( !path ) {
+	fprintf(stderr, "usage: %s [-n count] <flight recorder file>\n", argv[0]);
+	return 2;
+    }
+    if ( load(path) != 0 )
+	return 1;
+    h = (const struct exclib_flight_header *)flight;
+    if ( check(path, h) != 0 )
+	return 1;
+    sites = (const struct exclib_flight_site *)(flight + h->sites_offset);
+    stride = sizeof(struct exclib_flight_ring) + (unsigned long)h->nrecords * sizeof(struct exclib_flight_record);
+
+    printf("pid %d, started ", h->pid);
+    print_time(h->started);
+    printf(", %u rings of %u records, %u sites, %u records dropped\n", h->nrings, h->nrecords, h->nsites, h->dropped);
+
+    all = (const struct exclib_flight_record **)malloc((h->nrings * (unsigned long)h->nrecords + 1) * sizeof(*all));
+    if ( !all ) {
+	fprintf(stderr, "%s: out of memory\n", path);
+	return 1;
+    }
+    for ( i = 0; i < h->nrings; i++ ) {
+	ring = (const struct exclib_flight_ring *)(flight + h->rings_offset + i * stride);
+	/* only the last nrecords a ring was given are still in it */
+	first = ring->head > h->nrecords ? ring->head - h->nrecords : 0;
+	for ( j = 0; j < h->nrecords; j++ ) {
+	    r = (const struct exclib_flight_record *)(ring + 1) + j;
+	    if ( r->seq > first && r->seq <= ring->head + 1 && r->event < EXCLIB_STAT_EVENTS )
+		all[n++] = r;
+	}
+    }
+    qsort(all, n, sizeof(*all), by_time);
+
+    for ( i = (limit && limit < n) ? (unsigned int)(n - limit) : 0; i < n; i++ ) {
+	r = all[i];
+	print_time(record_time(h, r->clock));
+	printf("  tid %-6d depth %-3d %-10s code %-10d ", r->tid, r->depth, events[r->event], r->code);
+	if ( r->site > 0 && r->site <= h->nsites ) {
+	    fs = &sites[r->site - 1];
+	    printf("%s:%d %s()", site_string(h, fs->file), fs->line, site_string(h, fs->function));
+	} else
+	    printf("line %d", r->line);
+	if ( r->text[0] )
+	    printf("  \"%.*s\"", EXCLIB_FLIGHT_TEXT, r->text);
+	printf("\n");
+    }
+    free(all);
+    free(flight);
+    return 0;
+}
@@ -0,0 +1,53 @@
+#!/bin/sh
+#
+# perf's side of tools/*.bt: runs a program built with exclib's USDT probes
+# under perf, then prints how many of each exclib event it saw, a throw rate
+# per second and a histogram of the time from each THROW to the CATCH that
+# took it (per thread, in microseconds, powers of two):
+#
+#     tools/exclib-perf.sh ./demo/storm.exe
+#
+# Adding the probes needs root (or perf_event_paranoid <= -1 and write access
+# to tracefs); they're left registered, perf probe -d 'sdt_exclib:*' removes them.
+
+if [ $# -lt 1 ]; then
+    echo "usage: $0 <program> [args...]" >&2
+    exit 2
+fi
+prog=$1
+out=${EXCLIB_PERF_DATA:-exclib.perf.data}
+
+perf buildid-cache --add "$prog" || exit 1
+for probe in try throw catch propagate uncaught; do
+    perf probe -q -x "$prog" -a "sdt_exclib:$probe" 2>/dev/null
+done
+
+perf stat -e 'sdt_exclib:*' -- "$@" >/dev/null || exit 1
+
+perf record -q -o "$out" -e sdt_exclib:throw -e sdt_exclib:catch -- "$@" >/dev/null || exit 1
+perf script -i "$out" -F tid,time,event 2>/dev/null | awk '
+    {
+	tid = $1; t = $2; sub(":", "", t); t *= 1000000
+	if ( $3 ~ /throw/ ) {
+	    start[tid] = t
+	    sec = int(t / 1000000)
+	    rate[sec]++
+	    if ( first == "" || sec < first ) first = sec
+	    if ( sec > last ) last = sec
+	} else if ( tid in start ) {
+	    us = t - start[tid]
+	    b = 1
+	    while ( b < us ) b *= 2
+	    hist[b]++
+	    if ( b > top ) top = b
+	    delete start[tid]
+	}
+    }
+    END {
+	print "throws per second:"
+	for ( s = first; s != "" && s <= last; s++ )
+	    printf "  +%ds %d\n", s - first, rate[s]
+	print "throw to catch, us:"
+	for ( b = 1; b <= top; b *= 2 )
+	    if ( b in hist ) printf "  <= %-8d %d\n", b, hist[b]
+    }'